@@ -0,0 +1,870 @@
+// Benchmarks of the json library on ledger payloads, and an offline replay of
+// the close time search.
+//
+// The payloads are read from the data directory written by the record script:
+//   header.json         the reply to a "ledger" query for a header
+//   ledger.json         the reply to a "ledger" query with expanded transactions
+//   account_state.json  the reply to a "ledger_data" query, one chunk of state
+//   close_times.txt     "seq close_time" lines, sorted by seq
+// Any of them that is missing is replaced by a synthetic one of the same shape.
+// None is checked in, so without a run of the record script every number is
+// that of synthetic payloads, as the report says of each.
+//
+// For Reader::parse, ParallelReader (one thread per core), FastWriter,
+// StyledWriter, CborWriter and CborReader::parse on each payload, and for both
+// readers into a ValueArena, it reports the throughput, the time per document,
+// the number of allocations per document and the peak RSS of a process doing
+// nothing else.  For the search, it reports the number of
+// probes (RPCs) and rounds (round trips) taken to resolve each of a set of
+// targets, and how many of them it resolved to a wrong ledger.  It exits
+// with status 1 if any search did.
+
+#include "../ledger_search.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <json/json.h>
+
+// Allocation counting
+
+// Every allocation the json library makes goes through malloc, operator new
+// included, so counting in malloc, calloc and realloc counts them all.
+// This relies on glibc exporting the functions it implements them with.
+
+static std::atomic<std::size_t> allocation_count{0};
+
+extern "C" void* __libc_malloc(std::size_t size);
+extern "C" void* __libc_calloc(std::size_t n, std::size_t size);
+extern "C" void* __libc_realloc(void* p, std::size_t size);
+
+extern "C"
+void*
+malloc(std::size_t size) noexcept
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+extern "C"
+void*
+calloc(std::size_t n, std::size_t size) noexcept
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(n, size);
+}
+
+extern "C"
+void*
+realloc(void* p, std::size_t size) noexcept
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(p, size);
+}
+
+static
+std::size_t
+allocations()
+{
+    return allocation_count.load(std::memory_order_relaxed);
+}
+
+// Peak resident set size of this process, in KiB
+static
+long
+peak_rss()
+{
+    rusage usage;
+    ::getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// Synthetic payloads
+
+namespace
+{
+
+// Deterministic random fields shaped like the ones of rippled replies
+class field_maker
+{
+    std::mt19937_64 rng_;
+
+public:
+    explicit field_maker(std::uint64_t seed) : rng_{seed} {}
+
+    std::uint64_t number(std::uint64_t n) {return rng_() % n;}
+    std::string hex(std::size_t bytes);
+    std::string account();
+    std::string drops() {return std::to_string(number(100'000'000'000));}
+};
+
+}  // unnamed namespace
+
+std::string
+field_maker::hex(std::size_t bytes)
+{
+    static const char digits[] = "0123456789ABCDEF";
+    std::string s(2*bytes, '0');
+    for (auto& c : s)
+        c = digits[number(16)];
+    return s;
+}
+
+std::string
+field_maker::account()
+{
+    static const char alphabet[] =
+        "rpshnaf39wBUDNEGHJKLM4PQRST7VWXYZ2bcdeCg65jkm8oFqi1tuvAxyz";
+    std::string s(1, 'r');
+    for (int i = 0; i < 33; ++i)
+        s += alphabet[number(sizeof(alphabet) - 1)];
+    return s;
+}
+
+static
+Json::Value
+synthetic_ledger_header(field_maker& f, int seq, int close_time)
+{
+    Json::Value ledger = Json::objectValue;
+    ledger["accepted"] = true;
+    ledger["account_hash"] = f.hex(32);
+    ledger["close_flags"] = 0;
+    ledger["close_time"] = close_time;
+    ledger["close_time_human"] = "2019-Dec-31 23:59:59.000000000 UTC";
+    ledger["close_time_resolution"] = 10;
+    ledger["closed"] = true;
+    auto hash = f.hex(32);
+    ledger["hash"] = hash;
+    ledger["ledger_hash"] = hash;
+    ledger["ledger_index"] = std::to_string(seq);
+    ledger["parent_close_time"] = close_time - 3;
+    ledger["parent_hash"] = f.hex(32);
+    ledger["seqNum"] = std::to_string(seq);
+    ledger["totalCoins"] = "99989324415218949";
+    ledger["total_coins"] = "99989324415218949";
+    ledger["transaction_hash"] = f.hex(32);
+    return ledger;
+}
+
+static
+Json::Value
+synthetic_reply(Json::Value ledger, int seq)
+{
+    Json::Value reply = Json::objectValue;
+    Json::Value& result = reply["result"];
+    result["ledger_hash"] = ledger["hash"];
+    result["ledger"] = std::move(ledger);
+    result["ledger_index"] = seq;
+    result["status"] = "success";
+    result["validated"] = true;
+    return reply;
+}
+
+static
+Json::Value
+synthetic_amount(field_maker& f)
+{
+    if (f.number(3) != 0)
+        return f.drops();
+    Json::Value amount = Json::objectValue;
+    amount["currency"] = "USD";
+    amount["issuer"] = f.account();
+    amount["value"] = std::to_string(f.number(1'000'000)) + "." + std::to_string(f.number(1000));
+    return amount;
+}
+
+static
+Json::Value
+synthetic_transaction(field_maker& f, int seq, unsigned index)
+{
+    Json::Value tx = Json::objectValue;
+    tx["Account"] = f.account();
+    tx["Amount"] = synthetic_amount(f);
+    tx["Destination"] = f.account();
+    tx["Fee"] = "12";
+    tx["Flags"] = 2147483648u;
+    tx["LastLedgerSequence"] = seq + 4;
+    tx["Sequence"] = static_cast<int>(f.number(1'000'000));
+    tx["SigningPubKey"] = f.hex(33);
+    tx["TransactionType"] = f.number(2) ? "Payment" : "OfferCreate";
+    tx["TxnSignature"] = f.hex(71);
+    tx["hash"] = f.hex(32);
+
+    Json::Value& meta = tx["metaData"];
+    Json::Value& nodes = meta["AffectedNodes"] = Json::arrayValue;
+    for (unsigned i = 0, n = 2 + static_cast<unsigned>(f.number(3)); i < n; ++i)
+    {
+        Json::Value& node = nodes.append(Json::objectValue)["ModifiedNode"];
+        Json::Value& final_fields = node["FinalFields"];
+        final_fields["Account"] = f.account();
+        final_fields["Balance"] = f.drops();
+        final_fields["Flags"] = 0;
+        final_fields["OwnerCount"] = static_cast<int>(f.number(20));
+        final_fields["Sequence"] = static_cast<int>(f.number(1'000'000));
+        node["LedgerEntryType"] = "AccountRoot";
+        node["LedgerIndex"] = f.hex(32);
+        node["PreviousFields"]["Balance"] = f.drops();
+        node["PreviousTxnID"] = f.hex(32);
+        node["PreviousTxnLgrSeq"] = seq - static_cast<int>(f.number(100'000));
+    }
+    meta["TransactionIndex"] = index;
+    meta["TransactionResult"] = "tesSUCCESS";
+    meta["delivered_amount"] = tx["Amount"];
+    return tx;
+}
+
+static
+Json::Value
+synthetic_account_root(field_maker& f, int seq)
+{
+    Json::Value entry = Json::objectValue;
+    entry["Account"] = f.account();
+    entry["Balance"] = f.drops();
+    entry["Flags"] = 0;
+    entry["LedgerEntryType"] = "AccountRoot";
+    entry["OwnerCount"] = static_cast<int>(f.number(20));
+    entry["PreviousTxnID"] = f.hex(32);
+    entry["PreviousTxnLgrSeq"] = seq - static_cast<int>(f.number(10'000'000));
+    entry["Sequence"] = static_cast<int>(f.number(1'000'000));
+    entry["index"] = f.hex(32);
+    return entry;
+}
+
+static
+std::string
+synthetic_payload(std::string const& name)
+{
+    constexpr int seq = 52'000'000;
+    constexpr int close_time = 631151999;
+    field_maker f{0x1edce7};
+    Json::Value reply;
+    if (name == "header")
+        reply = synthetic_reply(synthetic_ledger_header(f, seq, close_time), seq);
+    else if (name == "ledger")
+    {
+        auto ledger = synthetic_ledger_header(f, seq, close_time);
+        Json::Value& txs = ledger["transactions"] = Json::arrayValue;
+        for (unsigned i = 0; i < 200; ++i)
+            txs.append(synthetic_transaction(f, seq, i));
+        reply = synthetic_reply(std::move(ledger), seq);
+    }
+    else
+    {
+        Json::Value& result = reply["result"];
+        result["ledger_hash"] = f.hex(32);
+        result["ledger_index"] = seq;
+        result["marker"] = f.hex(32);
+        Json::Value& state = result["state"] = Json::arrayValue;
+        for (unsigned i = 0; i < 2048; ++i)
+            state.append(synthetic_account_root(f, seq));
+        result["status"] = "success";
+        result["validated"] = true;
+    }
+    std::string text;
+    Json::FastWriter{}.write(reply, text);
+    return text;
+}
+
+// One close time every few seconds from the first ledger of the full history,
+// at rates drifting between 3.5 and 4.5 seconds a ledger, sampled every step
+// ledgers as the record script does.
+static
+std::vector<sample>
+synthetic_close_times()
+{
+    constexpr int first = 32570;
+    constexpr int last = 60'000'000;
+    constexpr int step = 100'000;
+    field_maker f{0xc105e};
+    std::vector<sample> table;
+    double t = 410'000'000;
+    double rate = 4;
+    for (int seq = first; seq <= last; seq += step)
+    {
+        table.push_back({seq, static_cast<int>(t)});
+        if (f.number(20) == 0)
+            rate = 3.5 + static_cast<double>(f.number(1000)) / 1000;
+        t += rate * step;
+    }
+    return table;
+}
+
+// Loading the payloads
+
+namespace
+{
+
+struct payload
+{
+    std::string name;
+    std::string text;
+    bool recorded;
+};
+
+}  // unnamed namespace
+
+static
+std::optional<std::string>
+read_file(std::string const& path)
+{
+    std::ifstream in{path, std::ios::binary};
+    if (!in)
+        return std::nullopt;
+    std::ostringstream text;
+    text << in.rdbuf();
+    return text.str();
+}
+
+static
+payload
+load_payload(std::string const& dir, std::string const& name)
+{
+    if (auto text = read_file(dir + '/' + name + ".json"))
+        return {name, std::move(*text), true};
+    return {name, synthetic_payload(name), false};
+}
+
+static
+std::vector<sample>
+load_close_times(std::string const& dir, bool& recorded)
+{
+    std::vector<sample> table;
+    if (auto text = read_file(dir + "/close_times.txt"))
+    {
+        std::istringstream in{*text};
+        sample s;
+        while (in >> s.seq >> s.close_time)
+            if (table.empty() ||
+                (s.seq > table.back().seq && s.close_time > table.back().close_time))
+                table.push_back(s);
+    }
+    recorded = table.size() >= 2;
+    if (!recorded)
+        table = synthetic_close_times();
+    return table;
+}
+
+// Document benchmarks
+
+namespace
+{
+
+struct measurement
+{
+    double mb_per_s;
+    double allocations_per_doc;
+};
+
+}  // unnamed namespace
+
+// Call run() until at least min_time has passed, each call handling bytes
+static
+measurement
+measure(std::size_t bytes, std::chrono::duration<double> min_time,
+        std::function<void()> const& run)
+{
+    using clock = std::chrono::steady_clock;
+    run();  // warm up, and grow whatever buffers are reused
+    std::size_t runs = 0;
+    auto allocated = allocations();
+    auto start = clock::now();
+    std::chrono::duration<double> elapsed{0};
+    do
+    {
+        run();
+        ++runs;
+        elapsed = clock::now() - start;
+    } while (elapsed < min_time || runs < 3);
+    allocated = allocations() - allocated;
+    return {static_cast<double>(bytes) * runs / elapsed.count() / 1e6,
+            static_cast<double>(allocated) / runs};
+}
+
+// Run job in a child process, so that the peak RSS it reports is its own
+// and not that of the benchmarks before it.
+static
+void
+isolated(std::function<void()> const& job)
+{
+    std::cout.flush();
+    pid_t pid = ::fork();
+    if (pid == 0)
+    {
+        job();
+        std::cout.flush();
+        ::_exit(0);
+    }
+    int status;
+    if (pid < 0 || ::waitpid(pid, &status, 0) != pid || !WIFEXITED(status))
+        std::cerr << "A benchmark failed to run\n";
+}
+
+static
+void
+report(payload const& p, char const* what, std::size_t bytes, measurement m)
+{
+    std::cout << std::left << std::setw(15) << p.name << std::setw(25) << what
+              << std::right << std::setw(10) << bytes
+              << std::setw(10) << std::setprecision(1) << std::fixed << m.mb_per_s
+              << std::setw(10) << std::setprecision(3) << bytes / m.mb_per_s / 1e3
+              << std::setw(12) << std::setprecision(1) << m.allocations_per_doc
+              << std::setw(10) << std::setprecision(1) << peak_rss() / 1024. << '\n';
+}
+
+static
+bool
+parse_payload(payload const& p, Json::Features const& features, Json::Value& root)
+{
+    Json::Reader reader{features};
+    if (reader.parse(p.text.data(), p.text.data() + p.text.size(), root, false))
+        return true;
+    std::cerr << p.name << ": " << reader.getFormatedErrorMessages();
+    return false;
+}
+
+static
+void
+bench_documents(std::vector<payload> const& payloads, std::chrono::duration<double> min_time)
+{
+    std::cout << std::left << std::setw(15) << "payload" << std::setw(25) << "benchmark"
+              << std::right << std::setw(10) << "bytes" << std::setw(10) << "MB/s"
+              << std::setw(10) << "ms/doc"
+              << std::setw(12) << "allocs/doc" << std::setw(10) << "RSS MiB" << '\n';
+    for (auto const& p : payloads)
+    {
+        isolated([&]
+        {
+            auto m = measure(p.text.size(), min_time, [&]
+            {
+                Json::Value root;
+                parse_payload(p, Json::Features::all(), root);
+            });
+            report(p, "Reader::parse", p.text.size(), m);
+        });
+        isolated([&]
+        {
+            auto m = measure(p.text.size(), min_time, [&]
+            {
+                Json::Value root;
+                parse_payload(p, Json::Features::strictMode(), root);
+            });
+            report(p, "Reader::parse strict", p.text.size(), m);
+        });
+        isolated([&]
+        {
+            auto m = measure(p.text.size(), min_time, [&]
+            {
+                Json::ValueArena arena;
+                Json::Value root;
+                Json::Reader{Json::Features::strictMode()}.parse(
+                    p.text.data(), p.text.data() + p.text.size(), root, arena, false);
+            });
+            report(p, "Reader::parse arena", p.text.size(), m);
+        });
+        isolated([&]
+        {
+            auto m = measure(p.text.size(), min_time, [&]
+            {
+                Json::Value root;
+                Json::ParallelReader reader;
+                reader.parse(p.text.data(), p.text.data() + p.text.size(), root);
+            });
+            report(p, "ParallelReader", p.text.size(), m);
+        });
+        isolated([&]
+        {
+            Json::Value root;
+            if (!parse_payload(p, Json::Features::all(), root))
+                return;
+            Json::FastWriter writer;
+            std::string document;
+            auto m = measure(writer.write(root).size(), min_time, [&]
+            {
+                document.clear();
+                writer.write(root, document);
+            });
+            report(p, "FastWriter", document.size(), m);
+        });
+        isolated([&]
+        {
+            Json::Value root;
+            if (!parse_payload(p, Json::Features::all(), root))
+                return;
+            Json::StyledWriter writer;
+            std::size_t size = writer.write(root).size();
+            auto m = measure(size, min_time, [&] {writer.write(root);});
+            report(p, "StyledWriter", size, m);
+        });
+        isolated([&]
+        {
+            Json::Value root;
+            if (!parse_payload(p, Json::Features::all(), root))
+                return;
+            Json::CborWriter writer;
+            std::string document;
+            auto m = measure(writer.write(root).size(), min_time, [&]
+            {
+                document.clear();
+                writer.write(root, document);
+            });
+            report(p, "CborWriter", document.size(), m);
+        });
+        isolated([&]
+        {
+            Json::Value root;
+            if (!parse_payload(p, Json::Features::all(), root))
+                return;
+            std::string const document = Json::CborWriter{}.write(root);
+            auto m = measure(document.size(), min_time, [&]
+            {
+                Json::Value copy;
+                Json::CborReader{}.parse(document.data(), document.data() + document.size(), copy);
+            });
+            report(p, "CborReader::parse", document.size(), m);
+        });
+        isolated([&]
+        {
+            Json::Value root;
+            if (!parse_payload(p, Json::Features::all(), root))
+                return;
+            std::string const document = Json::CborWriter{}.write(root);
+            auto m = measure(document.size(), min_time, [&]
+            {
+                Json::ValueArena arena;
+                Json::Value copy;
+                Json::CborReader{}.parse(document.data(), document.data() + document.size(),
+                                         copy, arena);
+            });
+            report(p, "CborReader::parse arena", document.size(), m);
+        });
+    }
+}
+
+// Search replay
+
+namespace
+{
+
+// Close times of the ledgers of a recorded table, fetched as ledger.cpp's
+// close_time_samples fetches them from the network, counting each one fetched
+// as a probe and each call as a round trip.
+// Between two recorded ledgers, close times are interpolated, plus a jitter of
+// a few seconds so that the search cannot just land on the exact line.
+// Like close_time_samples, it keeps a close_time_model of the samples it knows.
+class replay_samples
+{
+    std::vector<sample> const& table_;
+    std::vector<sample> known_;  // sorted by seq
+    close_time_model model_;
+    std::size_t probes_ = 0;
+    std::size_t rounds_ = 0;
+
+public:
+    // known are the samples a cache would hold, sorted by seq
+    replay_samples(std::vector<sample> const& table, std::vector<sample> known);
+
+    int get_close_time(int ledger_seq);
+    std::vector<int> get_close_times(std::vector<int> const& ledger_seqs);
+    std::pair<std::optional<sample>, std::optional<sample>> bracket(int target) const;
+
+    std::size_t probes() const {return probes_;}
+    std::size_t rounds() const {return rounds_;}
+    std::vector<sample> const& known() const {return known_;}
+    close_time_model const& model() const {return model_;}
+
+    // The close time of ledger_seq, or 0 if it is outside the table
+    static int close_time(std::vector<sample> const& table, int ledger_seq);
+
+private:
+    int fetch(int ledger_seq);
+};
+
+}  // unnamed namespace
+
+replay_samples::replay_samples(std::vector<sample> const& table, std::vector<sample> known)
+    : table_{table}
+    , known_{std::move(known)}
+{
+    model_.fit(known_);
+}
+
+int
+replay_samples::close_time(std::vector<sample> const& table, int ledger_seq)
+{
+    auto i = std::lower_bound(table.begin(), table.end(), ledger_seq,
+                              [](sample const& x, int seq) {return x.seq < seq;});
+    if (i == table.end() || ledger_seq < table.front().seq)
+        return 0;
+    if (i->seq == ledger_seq)
+        return i->close_time;
+    auto lo = i[-1];
+    auto span = static_cast<long long>(i->seq - lo.seq);
+    auto gap = static_cast<long long>(i->close_time - lo.close_time);
+    auto t = lo.close_time + gap * (ledger_seq - lo.seq) / span;
+    // Consecutive close times stay at least a second apart
+    auto amplitude = std::max(0LL, gap / span - 1);
+    auto jitter = amplitude == 0 ? 0
+                : (static_cast<std::uint32_t>(ledger_seq) * 2654435761u) % (amplitude + 1);
+    return static_cast<int>(t + jitter);
+}
+
+int
+replay_samples::fetch(int ledger_seq)
+{
+    auto i = std::lower_bound(known_.begin(), known_.end(), ledger_seq,
+                              [](sample const& x, int seq) {return x.seq < seq;});
+    if (i != known_.end() && i->seq == ledger_seq)
+        return i->close_time;
+    ++probes_;
+    int t = close_time(table_, ledger_seq);
+    if (t != 0)
+    {
+        known_.insert(i, {ledger_seq, t});
+        model_.update({ledger_seq, t});
+        if (model_.stale())
+            model_.fit(known_);
+    }
+    return t;
+}
+
+int
+replay_samples::get_close_time(int ledger_seq)
+{
+    auto probes = probes_;
+    int t = fetch(ledger_seq);
+    if (probes_ != probes)
+        ++rounds_;
+    return t;
+}
+
+std::vector<int>
+replay_samples::get_close_times(std::vector<int> const& ledger_seqs)
+{
+    auto probes = probes_;
+    std::vector<int> close_times;
+    for (auto seq : ledger_seqs)
+        close_times.push_back(fetch(seq));
+    if (probes_ != probes)
+        ++rounds_;
+    return close_times;
+}
+
+std::pair<std::optional<sample>, std::optional<sample>>
+replay_samples::bracket(int target) const
+{
+    std::optional<sample> lo;
+    std::optional<sample> hi;
+    auto i = std::partition_point(known_.begin(), known_.end(),
+                                  [target](sample const& x) {return x.close_time <= target;});
+    if (i != known_.begin())
+        lo = i[-1];
+    if (i != known_.end())
+        hi = *i;
+    return {lo, hi};
+}
+
+// The last ledger of the table closed at or before target
+static
+int
+last_ledger_before(std::vector<sample> const& table, int target)
+{
+    int lo = table.front().seq;
+    int hi = table.back().seq;
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo + 1) / 2;
+        if (replay_samples::close_time(table, mid) <= target)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+// find_ledger may settle on either of the two ledgers around target, so a
+// result is only wrong if it is neither of them.
+static
+bool
+missed(std::vector<sample> const& table, int target, int seq)
+{
+    int expected = last_ledger_before(table, target);
+    return seq != expected && seq != expected + 1;
+}
+
+static
+std::pair<int, int>
+replay_search(std::chrono::seconds target, replay_samples& samples, unsigned k, bool seeded)
+{
+    if (seeded)
+        seed_from_model(target, samples, samples.model(), k, false);
+    if (k > 1)
+        return find_ledger_concurrent(target, samples, k, false);
+    return find_ledger(target, samples, false);
+}
+
+// A batch has no maximum per target, printed as "-"
+static
+void
+report_search(std::string const& name, std::size_t targets, std::size_t probes,
+              std::optional<std::size_t> max_probes, std::size_t rounds,
+              std::optional<std::size_t> max_rounds, std::size_t misses)
+{
+    auto max = [](std::optional<std::size_t> n)
+    {
+        return n ? std::to_string(*n) : "-";
+    };
+    std::cout << std::left << std::setw(40) << name << std::right << std::fixed
+              << std::setw(12) << std::setprecision(2) << double(probes) / targets
+              << std::setw(8) << max(max_probes)
+              << std::setw(12) << std::setprecision(2) << double(rounds) / targets
+              << std::setw(8) << max(max_rounds)
+              << std::setw(8) << misses << '\n';
+}
+
+// Each search is replayed, with and without seeding by the model of the samples:
+// - cold, knowing only the last ledger, as a single run of ledger without a
+//   cache does, and in batch;
+// - warm, from a cache filled by a batch run over as many other targets.
+// Returns the number of targets resolved to a wrong ledger.
+static
+std::size_t
+bench_search(std::vector<sample> const& table, unsigned target_count)
+{
+    std::mt19937 rng{2020};
+    std::uniform_int_distribution<int> pick{table.front().close_time, table.back().close_time};
+    std::vector<int> targets(target_count);
+    for (auto& t : targets)
+        t = pick(rng);
+    std::vector<sample> const last{table.back()};
+
+    std::vector<int> others(target_count);
+    for (auto& t : others)
+        t = pick(rng);
+    std::sort(others.begin(), others.end());
+    replay_samples filler{table, last};
+    for (auto t : others)
+        replay_search(std::chrono::seconds{t}, filler, 1, false);
+    auto const& cache = filler.known();
+    std::size_t all_misses = 0;
+    std::cout << "cache of " << cache.size() << " samples, modeled by "
+              << filler.model().size() << " knots\n";
+
+    std::cout << std::left << std::setw(40) << "search" << std::right
+              << std::setw(12) << "probes/tgt" << std::setw(8) << "max"
+              << std::setw(12) << "rounds/tgt" << std::setw(8) << "max"
+              << std::setw(8) << "misses" << '\n';
+    for (unsigned k : {1u, 4u})
+    {
+        std::string name = k > 1 ? "find_ledger_concurrent k=" + std::to_string(k) : "find_ledger";
+        for (int warm = 0; warm != 2; ++warm)
+        {
+            for (int seeded = 0; seeded != 2; ++seeded)
+            {
+                std::size_t probes = 0, max_probes = 0, rounds = 0, max_rounds = 0, misses = 0;
+                for (auto t : targets)
+                {
+                    replay_samples samples{table, warm ? cache : last};
+                    auto found = replay_search(std::chrono::seconds{t}, samples, k, seeded);
+                    misses += missed(table, t, found.first);
+                    probes += samples.probes();
+                    rounds += samples.rounds();
+                    max_probes = std::max(max_probes, samples.probes());
+                    max_rounds = std::max(max_rounds, samples.rounds());
+                }
+                report_search(name + (warm ? " cached" : "") + (seeded ? "+model" : ""),
+                              targets.size(), probes, max_probes, rounds, max_rounds, misses);
+                all_misses += misses;
+            }
+        }
+
+        // All the targets in sorted order with shared samples, as batch mode does
+        auto sorted = targets;
+        std::sort(sorted.begin(), sorted.end());
+        for (int seeded = 0; seeded != 2; ++seeded)
+        {
+            replay_samples samples{table, last};
+            std::size_t misses = 0;
+            for (auto t : sorted)
+                misses += missed(table, t,
+                                 replay_search(std::chrono::seconds{t}, samples, k, seeded).first);
+            report_search(std::string{"  batch"} + (seeded ? "+model" : ""), sorted.size(),
+                          samples.probes(), std::nullopt, samples.rounds(), std::nullopt, misses);
+            all_misses += misses;
+        }
+    }
+    return all_misses;
+}
+
+static
+void
+usage(char const* argv0)
+{
+    std::cerr << "Usage: " << argv0 << " [--data DIR] [--time SECONDS] [--targets N]\n"
+                 "  --data DIR      recorded payloads, from the record script\n"
+                 "                  (default: data)\n"
+                 "  --time SECONDS  minimum time spent on each document benchmark\n"
+                 "                  (default: 0.5)\n"
+                 "  --targets N     number of close times the search replay resolves\n"
+                 "                  (default: 1000)\n";
+}
+
+int
+main(int argc, char* argv[])
+{
+    std::string dir = "data";
+    double min_time = 0.5;
+    unsigned target_count = 1000;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--data" && i + 1 < argc)
+            dir = argv[++i];
+        else if (arg == "--time" && i + 1 < argc)
+            min_time = std::atof(argv[++i]);
+        else if (arg == "--targets" && i + 1 < argc)
+            target_count = static_cast<unsigned>(std::max(1, std::atoi(argv[++i])));
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    std::vector<payload> payloads;
+    for (auto name : {"header", "ledger", "account_state"})
+        payloads.push_back(load_payload(dir, name));
+    bool recorded;
+    auto table = load_close_times(dir, recorded);
+
+    for (auto const& p : payloads)
+        std::cout << p.name << ": " << (p.recorded ? "recorded" : "synthetic") << ", "
+                  << p.text.size() << " bytes\n";
+    std::cout << "close_times: " << (recorded ? "recorded" : "synthetic") << ", "
+              << table.size() << " ledgers from " << table.front().seq
+              << " to " << table.back().seq << '\n'
+              << "RSS before the benchmarks: " << std::fixed << std::setprecision(1)
+              << peak_rss() / 1024. << " MiB\n\n";
+
+    bench_documents(payloads, std::chrono::duration<double>{min_time});
+    std::cout << '\n';
+    if (auto misses = bench_search(table, target_count))
+    {
+        std::cerr << misses << " searches settled on a wrong ledger\n";
+        return 1;
+    }
+}
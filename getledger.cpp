@@ -0,0 +1,3002 @@
+#include "../date/include/date/date.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <curl/curl.h>
+#include <json/json.h>
+#include "getledger.h"
+#include "ledger_search.h"
+
+// Instrumentation
+
+namespace
+{
+
+// What the queries, parses and searches of a run cost, kept when --stats asks
+// for it and reported as one JSON document.  While it is off, recording is a
+// test of enabled(): no clock is read and nothing is stored.
+class run_stats
+{
+public:
+    using clock = std::chrono::steady_clock;
+    using seconds = std::chrono::duration<double>;
+
+    // One transfer.  The phases are curl's, each from the end of the one
+    // before; a request on a WebSocket only has a total.
+    struct query
+    {
+        std::string endpoint;
+        unsigned attempt;    // 0, or 1 for a hedge or a retry
+        bool ok;
+        bool cancelled;      // lost to the other attempt of its post
+        seconds dns;
+        seconds connect;
+        seconds tls;
+        seconds wait;        // for the first byte of the reply
+        seconds transfer;    // of the rest of the reply
+        seconds total;
+        long long sent;
+        long long received;
+    };
+
+    // A piece of work done on the text of replies, queries and downloads
+    enum work {parse, stream_parse, scan, serialize, write, work_count};
+
+    // One close time search.  probes counts the close times it looked up,
+    // fetched those that went to the network, and rounds the times it did.
+    struct search
+    {
+        std::string target;
+        int ledger;
+        int close_time;
+        long long probes;
+        long long fetched;
+        long long rounds;
+        seconds total;
+    };
+
+    static run_stats& instance();
+    static bool enabled() {return enabled_.load(std::memory_order_relaxed);}
+    static void enable() {enabled_.store(true, std::memory_order_relaxed);}
+
+    void record(query q);
+    void record(work w, long long count, long long bytes, seconds spent);
+    void record(search s);
+
+    Json::Value report() const;
+
+private:
+    struct totals
+    {
+        long long count = 0;
+        long long bytes = 0;
+        seconds total{};
+        seconds max{};
+    };
+
+    // Read by every thread that queries, whenever stats are turned on
+    static inline std::atomic<bool> enabled_{false};
+    mutable std::mutex mut_;
+    std::vector<query> queries_;
+    std::array<totals, work_count> work_;
+    std::vector<search> searches_;
+};
+
+// Times a piece of work while stats are on
+class work_timer
+{
+    run_stats::work work_;
+    bool timed_;
+    run_stats::clock::time_point start_{};
+
+public:
+    explicit work_timer(run_stats::work w)
+        : work_{w}
+        , timed_{run_stats::enabled()}
+    {
+        if (timed_)
+            start_ = run_stats::clock::now();
+    }
+
+    void done(std::size_t bytes)
+    {
+        if (timed_)
+            run_stats::instance().record(work_, 1, static_cast<long long>(bytes),
+                                         run_stats::clock::now() - start_);
+    }
+};
+
+}  // unnamed namespace
+
+run_stats&
+run_stats::instance()
+{
+    static run_stats stats;
+    return stats;
+}
+
+void
+run_stats::record(query q)
+{
+    std::lock_guard<std::mutex> lock{mut_};
+    queries_.push_back(std::move(q));
+}
+
+void
+run_stats::record(work w, long long count, long long bytes, seconds spent)
+{
+    std::lock_guard<std::mutex> lock{mut_};
+    auto& t = work_[w];
+    t.count += count;
+    t.bytes += bytes;
+    t.total += spent;
+    t.max = std::max(t.max, spent);
+}
+
+void
+run_stats::record(search s)
+{
+    std::lock_guard<std::mutex> lock{mut_};
+    searches_.push_back(std::move(s));
+}
+
+// {"queries": totals and each transfer, "work": {"parse": totals, ...},
+//  "searches": [...], "allocations": {...}}, with times in seconds.
+// "allocations" is there if the json library counts them.
+Json::Value
+run_stats::report() const
+{
+    static char const* const work_names[work_count] =
+        {"parse", "stream_parse", "scan", "serialize", "write"};
+    static char const* const phase_names[] =
+        {"dns", "connect", "tls", "wait", "transfer", "total"};
+    constexpr seconds query::* phases[] =
+        {&query::dns, &query::connect, &query::tls, &query::wait, &query::transfer,
+         &query::total};
+    auto count = [](long long n) {return Json::Value{static_cast<Json::Int64>(n)};};
+
+    std::lock_guard<std::mutex> lock{mut_};
+    Json::Value root = Json::objectValue;
+    Json::Value& queries = root["queries"] = Json::objectValue;
+    Json::Value& log = queries["each"] = Json::arrayValue;
+    long long failed = 0;
+    long long cancelled = 0;
+    long long sent = 0;
+    long long received = 0;
+    std::array<seconds, std::size(phases)> phase_totals{};
+    for (auto const& q : queries_)
+    {
+        failed += !q.ok && !q.cancelled;
+        cancelled += q.cancelled;
+        sent += q.sent;
+        received += q.received;
+        Json::Value& e = log.append(Json::objectValue);
+        e["endpoint"] = q.endpoint;
+        e["attempt"] = q.attempt;
+        e["ok"] = q.ok;
+        if (q.cancelled)
+            e["cancelled"] = true;
+        for (std::size_t i = 0; i < std::size(phases); ++i)
+        {
+            e[phase_names[i]] = (q.*phases[i]).count();
+            phase_totals[i] += q.*phases[i];
+        }
+        e["sent"] = count(q.sent);
+        e["received"] = count(q.received);
+    }
+    queries["count"] = count(static_cast<long long>(queries_.size()));
+    queries["failed"] = count(failed);
+    queries["cancelled"] = count(cancelled);
+    queries["sent"] = count(sent);
+    queries["received"] = count(received);
+    for (std::size_t i = 0; i < std::size(phases); ++i)
+        queries[phase_names[i]] = phase_totals[i].count();
+
+    Json::Value& work = root["work"] = Json::objectValue;
+    for (std::size_t i = 0; i < work_count; ++i)
+    {
+        Json::Value& w = work[work_names[i]] = Json::objectValue;
+        w["count"] = count(work_[i].count);
+        w["bytes"] = count(work_[i].bytes);
+        w["total"] = work_[i].total.count();
+        w["max"] = work_[i].max.count();
+    }
+
+    Json::Value& searches = root["searches"] = Json::arrayValue;
+    for (auto const& s : searches_)
+    {
+        Json::Value& e = searches.append(Json::objectValue);
+        e["target"] = s.target;
+        e["ledger"] = s.ledger;
+        e["close_time"] = s.close_time;
+        e["probes"] = count(s.probes);
+        e["fetched"] = count(s.fetched);
+        e["rounds"] = count(s.rounds);
+        e["total"] = s.total.count();
+    }
+
+#ifdef JSON_COUNT_ALLOCATIONS
+    auto allocs = Json::allocationStats();
+    Json::Value& a = root["allocations"] = Json::objectValue;
+    a["strings"] = allocs.strings_;
+    a["string_bytes"] = allocs.stringBytes_;
+    a["containers"] = allocs.containers_;
+    a["blocks"] = allocs.blocks_;
+    a["block_bytes"] = allocs.blockBytes_;
+#endif
+    return root;
+}
+
+// CURL tools
+
+static
+int
+curl_global()
+{
+    if (::curl_global_init(CURL_GLOBAL_DEFAULT) != 0)
+        throw std::runtime_error("CURL global initialization failed");
+    return 0;
+}
+
+namespace
+{
+
+struct curl_deleter
+{
+    void operator()(CURL* p) const
+    {
+        ::curl_easy_cleanup(p);
+    }
+};
+
+struct curl_share_deleter
+{
+    void operator()(CURLSH* p) const
+    {
+        ::curl_share_cleanup(p);
+    }
+};
+
+using curl_handle = std::unique_ptr<CURL, curl_deleter>;
+
+// A process-wide pool of CURL easy handles.
+// A handle returned to the pool keeps its open connection, so the next query
+// that picks it up skips DNS, TCP (and TLS) setup.  All handles also share one
+// DNS cache and one connection cache, so a connection opened by any handle can
+// be reused by every other one.
+class curl_pool
+{
+    // Declared so that idle handles are cleaned up before the share they use
+    std::mutex mut_;
+    std::mutex share_mut_[CURL_LOCK_DATA_LAST];
+    std::unique_ptr<CURLSH, curl_share_deleter> share_;
+    std::vector<curl_handle> idle_;
+
+public:
+    class lease
+    {
+        curl_pool* pool_;
+        curl_handle h_;
+
+    public:
+        lease(curl_pool& pool, curl_handle h) noexcept
+            : pool_{&pool}
+            , h_{std::move(h)}
+        {}
+
+        lease(lease&&) = default;
+        lease& operator=(lease&&) = default;
+
+        ~lease()
+        {
+            if (h_)
+                pool_->release(std::move(h_));
+        }
+
+        CURL* get() const noexcept {return h_.get();}
+        explicit operator bool() const noexcept {return h_ != nullptr;}
+    };
+
+    static curl_pool& instance();
+
+    lease acquire();
+
+private:
+    curl_pool();
+
+    curl_handle make_handle();
+    void release(curl_handle h);
+
+    static void lock_cb(CURL*, curl_lock_data data, curl_lock_access, void* userp);
+    static void unlock_cb(CURL*, curl_lock_data data, void* userp);
+};
+
+}  // unnamed namespace
+
+static
+void
+curl_ensure_initialized()
+{
+    static const auto curl_is_now_initiailized = curl_global();
+    (void)curl_is_now_initiailized;
+}
+
+static
+curl_handle
+curl_init()
+{
+    curl_ensure_initialized();
+    return curl_handle{::curl_easy_init()};
+}
+
+curl_pool::curl_pool()
+{
+    curl_ensure_initialized();
+    share_.reset(::curl_share_init());
+    if (share_)
+    {
+        curl_share_setopt(share_.get(), CURLSHOPT_LOCKFUNC, lock_cb);
+        curl_share_setopt(share_.get(), CURLSHOPT_UNLOCKFUNC, unlock_cb);
+        curl_share_setopt(share_.get(), CURLSHOPT_USERDATA, this);
+        curl_share_setopt(share_.get(), CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(share_.get(), CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    }
+}
+
+curl_pool&
+curl_pool::instance()
+{
+    static curl_pool pool;
+    return pool;
+}
+
+void
+curl_pool::lock_cb(CURL*, curl_lock_data data, curl_lock_access, void* userp)
+{
+    static_cast<curl_pool*>(userp)->share_mut_[data].lock();
+}
+
+void
+curl_pool::unlock_cb(CURL*, curl_lock_data data, void* userp)
+{
+    static_cast<curl_pool*>(userp)->share_mut_[data].unlock();
+}
+
+static
+std::size_t
+write_to_string(char* contents, std::size_t size, std::size_t nmemb, void* userp)
+{
+    auto& userstr = *static_cast<std::string*>(userp);
+    auto realsize = size * nmemb;
+    userstr.append(contents, realsize);
+    return realsize;
+}
+
+namespace
+{
+
+// Parses a reply as it is downloaded, so that parsing overlaps the transfer
+// and the reply is never held in full
+class reply_parser
+{
+    Json::ValueBuilder builder_;
+    Json::StreamParser parser_{builder_};
+    bool failed_ = false;
+    std::size_t parsed_ = 0;         // while stats are on
+    run_stats::seconds spent_{};
+
+public:
+    reply_parser() = default;
+    reply_parser(reply_parser const&) = delete;
+    reply_parser& operator=(reply_parser const&) = delete;
+
+    bool feed(char const* data, std::size_t size);
+    bool finish(Json::Value& root);
+};
+
+}  // unnamed namespace
+
+bool
+reply_parser::feed(char const* data, std::size_t size)
+{
+    if (failed_)
+        return false;
+    std::optional<run_stats::clock::time_point> start;
+    if (run_stats::enabled())
+        start = run_stats::clock::now();
+    if (!parser_.feed(data, data + size))
+    {
+        std::cerr << parser_.getFormatedErrorMessages() << '\n';
+        failed_ = true;
+    }
+    if (start)
+    {
+        spent_ += run_stats::clock::now() - *start;
+        parsed_ += size;
+    }
+    return !failed_;
+}
+
+// Call once the transfer is complete
+bool
+reply_parser::finish(Json::Value& root)
+{
+    if (run_stats::enabled())
+        run_stats::instance().record(run_stats::stream_parse, 1,
+                                     static_cast<long long>(parsed_), spent_);
+    if (failed_)
+        return false;
+    if (!parser_.finish())
+    {
+        std::cerr << parser_.getFormatedErrorMessages() << '\n';
+        return false;
+    }
+    root = std::move(builder_.root());
+    return true;
+}
+
+// Returning less than realsize aborts the transfer: there is no point in
+// downloading the rest of a reply that cannot be parsed.
+static
+std::size_t
+write_to_parser(char* contents, std::size_t size, std::size_t nmemb, void* userp)
+{
+    auto realsize = size * nmemb;
+    if (!static_cast<reply_parser*>(userp)->feed(contents, realsize))
+        return 0;
+    return realsize;
+}
+
+// Direct the body of the next transfer on curl to sink
+static
+void
+set_sink(CURL* curl, std::string& sink)
+{
+    sink.clear();
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_to_string);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &sink);
+}
+
+static
+void
+set_sink(CURL* curl, reply_parser& sink)
+{
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_to_parser);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &sink);
+}
+
+// Give sink a reply received whole, as over a WebSocket.  reply may be left
+// with any content.
+static
+bool
+take_reply(std::string& sink, std::string& reply)
+{
+    sink.swap(reply);
+    return true;
+}
+
+static
+bool
+take_reply(reply_parser& sink, std::string& reply)
+{
+    return sink.feed(reply.data(), reply.size());
+}
+
+// Options that are the same for every query are set once, when the handle is made
+curl_handle
+curl_pool::make_handle()
+{
+    auto curl = curl_init();
+    if (!curl)
+        return curl;
+    curl_easy_setopt(curl.get(), CURLOPT_USERAGENT, "curl");
+    curl_easy_setopt(curl.get(), CURLOPT_SSL_VERIFYPEER, false);
+    curl_easy_setopt(curl.get(), CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl.get(), CURLOPT_TCP_KEEPIDLE, 30L);
+    curl_easy_setopt(curl.get(), CURLOPT_TCP_KEEPINTVL, 15L);
+    curl_easy_setopt(curl.get(), CURLOPT_DNS_CACHE_TIMEOUT, 600L);
+    if (share_)
+        curl_easy_setopt(curl.get(), CURLOPT_SHARE, share_.get());
+    return curl;
+}
+
+curl_pool::lease
+curl_pool::acquire()
+{
+    {
+        std::lock_guard<std::mutex> lock{mut_};
+        if (!idle_.empty())
+        {
+            auto h = std::move(idle_.back());
+            idle_.pop_back();
+            return lease{*this, std::move(h)};
+        }
+    }
+    return lease{*this, make_handle()};
+}
+
+void
+curl_pool::release(curl_handle h)
+{
+    std::lock_guard<std::mutex> lock{mut_};
+    idle_.push_back(std::move(h));
+}
+
+namespace
+{
+
+// A minimal forward-only scanner over the raw text of a JSON document.
+// It can skip any value and read strings and integers, which is all that is
+// needed to pick a few fields out of a small machine-generated reply without
+// building a Json::Value tree.  Strings are returned raw, escapes and all.
+class json_scanner
+{
+    char const* p_;
+    char const* end_;
+
+public:
+    json_scanner(char const* first, char const* last)
+        : p_{first}
+        , end_{last}
+    {}
+
+    // Call f(key) for each member of the object at the current position.
+    // f must consume the member's value, and return false on error.
+    template <class F> bool members(F f);
+
+    bool string(std::string_view& s);
+    bool integer(long long& i);  // Also accepts an integer in a string
+    bool skip_value();
+
+private:
+    bool consume(char c);
+    void skip_spaces();
+    bool skip_string();
+};
+
+}  // unnamed namespace
+
+void
+json_scanner::skip_spaces()
+{
+    while (p_ != end_ && (*p_ == ' ' || *p_ == '\t' || *p_ == '\r' || *p_ == '\n'))
+        ++p_;
+}
+
+bool
+json_scanner::consume(char c)
+{
+    skip_spaces();
+    if (p_ == end_ || *p_ != c)
+        return false;
+    ++p_;
+    return true;
+}
+
+template <class F>
+bool
+json_scanner::members(F f)
+{
+    if (!consume('{'))
+        return false;
+    if (consume('}'))
+        return true;
+    do
+    {
+        std::string_view key;
+        if (!string(key) || !consume(':') || !f(key))
+            return false;
+    } while (consume(','));
+    return consume('}');
+}
+
+// Skip a string, the opening quote already consumed
+bool
+json_scanner::skip_string()
+{
+    while (p_ != end_)
+    {
+        char c = *p_++;
+        if (c == '"')
+            return true;
+        if (c == '\\' && p_ != end_)
+            ++p_;
+    }
+    return false;
+}
+
+bool
+json_scanner::string(std::string_view& s)
+{
+    if (!consume('"'))
+        return false;
+    auto first = p_;
+    if (!skip_string())
+        return false;
+    s = std::string_view(first, static_cast<std::size_t>(p_ - 1 - first));
+    return true;
+}
+
+bool
+json_scanner::integer(long long& i)
+{
+    skip_spaces();
+    bool quoted = p_ != end_ && *p_ == '"';
+    if (quoted)
+        ++p_;
+    auto first = p_;
+    auto [ptr, ec] = std::from_chars(p_, end_, i);
+    if (ec != std::errc{} || ptr == first)
+        return false;
+    p_ = ptr;
+    return !quoted || consume('"');
+}
+
+bool
+json_scanner::skip_value()
+{
+    skip_spaces();
+    if (p_ == end_)
+        return false;
+    if (*p_ == '"')
+    {
+        ++p_;
+        return skip_string();
+    }
+    if (*p_ == '{' || *p_ == '[')
+    {
+        unsigned depth = 0;
+        while (p_ != end_)
+        {
+            char c = *p_++;
+            if (c == '"')
+            {
+                if (!skip_string())
+                    return false;
+            }
+            else if (c == '{' || c == '[')
+                ++depth;
+            else if ((c == '}' || c == ']') && --depth == 0)
+                return true;
+        }
+        return false;
+    }
+    auto first = p_;
+    while (p_ != end_ && *p_ != ',' && *p_ != '}' && *p_ != ']' &&
+           *p_ != ' ' && *p_ != '\t' && *p_ != '\r' && *p_ != '\n')
+        ++p_;
+    return p_ != first;
+}
+
+const char s2_url[] = "http://s2.ripple.com:51234";
+
+namespace
+{
+
+// The servers queries can go to, with what is known of how fast and how
+// reliable each one has been lately.
+// Each query goes to the healthy endpoint with the lowest mean latency, which
+// unlike the median counts how often it is slow; one that has not answered yet
+// counts as the fastest, so that each is tried.  An
+// endpoint that failed several times in a row is left alone for a while.
+// The hedge delay of an endpoint is a high percentile of its latency, but no
+// less than twice its median, so that ordinary jitter sends nothing twice: a
+// query still unanswered by then is sent again, to another endpoint if there
+// is one.
+class endpoint_set
+{
+    struct endpoint
+    {
+        std::string url;
+        std::vector<double> latencies;  // in seconds, a ring of the last ones
+        std::size_t next = 0;
+        unsigned failures = 0;          // in a row
+        std::chrono::steady_clock::time_point failed_at;
+    };
+
+    static constexpr std::size_t max_latencies_ = 64;
+    static constexpr std::size_t min_latencies_ = 8;   // before hedging
+    static constexpr double hedge_percentile_ = 0.95;
+    static constexpr double hedge_floor_ = 2;          // times the median
+    static constexpr unsigned max_failures_ = 3;
+    static constexpr std::chrono::seconds retry_after_{30};
+
+    std::mutex mut_;
+    std::vector<endpoint> endpoints_;
+
+public:
+    static constexpr std::size_t none = static_cast<std::size_t>(-1);
+
+    static endpoint_set& instance();
+
+    // Replace the endpoints.  The default is the S2 cluster alone.
+    void assign(std::vector<std::string> const& urls);
+
+    std::size_t size();
+    std::string url(std::size_t i);
+
+    // The endpoint to query next, other than except if there is another one
+    std::size_t pick(std::size_t except = none);
+    void record(std::size_t i, std::chrono::steady_clock::duration latency, bool ok);
+    std::optional<std::chrono::steady_clock::duration> hedge_delay(std::size_t i);
+
+private:
+    endpoint_set();
+
+    bool healthy(endpoint const& e, std::chrono::steady_clock::time_point now) const;
+    static double mean(std::vector<double> const& latencies);
+};
+
+}  // unnamed namespace
+
+endpoint_set::endpoint_set()
+{
+    assign({s2_url});
+}
+
+endpoint_set&
+endpoint_set::instance()
+{
+    static endpoint_set endpoints;
+    return endpoints;
+}
+
+void
+endpoint_set::assign(std::vector<std::string> const& urls)
+{
+    std::lock_guard<std::mutex> lock{mut_};
+    endpoints_.clear();
+    endpoints_.resize(urls.size());
+    for (std::size_t i = 0; i < urls.size(); ++i)
+        endpoints_[i].url = urls[i];
+}
+
+std::size_t
+endpoint_set::size()
+{
+    std::lock_guard<std::mutex> lock{mut_};
+    return endpoints_.size();
+}
+
+std::string
+endpoint_set::url(std::size_t i)
+{
+    std::lock_guard<std::mutex> lock{mut_};
+    return endpoints_[i].url;
+}
+
+bool
+endpoint_set::healthy(endpoint const& e, std::chrono::steady_clock::time_point now) const
+{
+    return e.failures < max_failures_ || now - e.failed_at >= retry_after_;
+}
+
+double
+endpoint_set::mean(std::vector<double> const& latencies)
+{
+    if (latencies.empty())
+        return 0;
+    return std::accumulate(latencies.begin(), latencies.end(), 0.) / latencies.size();
+}
+
+std::size_t
+endpoint_set::pick(std::size_t except)
+{
+    std::lock_guard<std::mutex> lock{mut_};
+    auto now = std::chrono::steady_clock::now();
+    std::size_t best = none;
+    double best_latency = 0;
+    bool best_healthy = false;
+    for (std::size_t i = 0; i < endpoints_.size(); ++i)
+    {
+        if (i == except)
+            continue;
+        auto const& e = endpoints_[i];
+        bool h = healthy(e, now);
+        auto latency = mean(e.latencies);
+        if (best == none || (h && !best_healthy) ||
+            (h == best_healthy && latency < best_latency))
+        {
+            best = i;
+            best_latency = latency;
+            best_healthy = h;
+        }
+    }
+    return best != none ? best : except;
+}
+
+void
+endpoint_set::record(std::size_t i, std::chrono::steady_clock::duration latency, bool ok)
+{
+    std::lock_guard<std::mutex> lock{mut_};
+    auto& e = endpoints_[i];
+    if (!ok)
+    {
+        ++e.failures;
+        e.failed_at = std::chrono::steady_clock::now();
+        return;
+    }
+    e.failures = 0;
+    double seconds = std::chrono::duration<double>(latency).count();
+    if (e.latencies.size() < max_latencies_)
+        e.latencies.push_back(seconds);
+    else
+        e.latencies[e.next] = seconds;
+    e.next = (e.next + 1) % max_latencies_;
+}
+
+std::optional<std::chrono::steady_clock::duration>
+endpoint_set::hedge_delay(std::size_t i)
+{
+    std::lock_guard<std::mutex> lock{mut_};
+    auto latencies = endpoints_[i].latencies;
+    if (latencies.size() < min_latencies_)
+        return std::nullopt;
+    auto p = latencies.begin() +
+             static_cast<std::ptrdiff_t>(hedge_percentile_ * (latencies.size() - 1));
+    std::nth_element(latencies.begin(), p, latencies.end());
+    auto delay = *p;
+    auto m = latencies.begin() + static_cast<std::ptrdiff_t>(latencies.size() / 2);
+    std::nth_element(latencies.begin(), m, p);
+    delay = std::max(delay, hedge_floor_ * *m);
+    return std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>{delay});
+}
+
+void
+set_endpoints(std::vector<std::string> const& urls)
+{
+    endpoint_set::instance().assign(urls);
+}
+
+// Whether url is that of a WebSocket endpoint rather than an HTTP one
+static
+bool
+is_ws_url(std::string const& url)
+{
+    return url.compare(0, 5, "ws://") == 0 || url.compare(0, 6, "wss://") == 0;
+}
+
+namespace
+{
+
+// A WebSocket connection to one endpoint, kept open from query to query.
+// Any number of requests may be outstanding on it: rippled tags each reply
+// with the id of its request, and replies may come back in any order.
+// The body of a query, {"method":M,"params":[{P...}]} as make_query writes
+// it, is sent as the request {"id":N,"command":M,P...}.
+class ws_connection
+{
+    std::string url_;
+    curl_handle h_;
+    std::string request_;
+    std::string message_;  // the part of a reply received so far
+    unsigned last_id_ = 0;
+
+public:
+    explicit ws_connection(std::string url);
+
+    std::string const& url() const {return url_;}
+
+    bool open();
+    curl_socket_t socket() const;
+
+    // Send post.  Returns the id its reply will carry, or 0 on failure.
+    unsigned send(std::string const& post);
+
+    // Call f(id, reply) for each reply that has arrived, without waiting for
+    // more, with id 0 for a message that answers no request, from a stream
+    // subscribed to.  f may take the storage of reply.  Returns false if the
+    // connection failed.
+    template <class F> bool receive(F f);
+
+private:
+    bool make_request(std::string const& post, unsigned id);
+    bool wait_writable() const;
+    static unsigned reply_id(std::string const& reply);
+};
+
+// The open WebSocket connections that no query is using.  Like the handles of
+// curl_pool, a connection is leased by one caller at a time.
+class ws_pool
+{
+    std::mutex mut_;
+    std::vector<std::unique_ptr<ws_connection>> idle_;
+
+public:
+    static ws_pool& instance();
+
+    // An open connection to url, or nullptr if none can be opened
+    std::unique_ptr<ws_connection> acquire(std::string const& url);
+    void release(std::unique_ptr<ws_connection> c);
+};
+
+}  // unnamed namespace
+
+ws_connection::ws_connection(std::string url)
+    : url_{std::move(url)}
+{
+}
+
+// The handshake is made here, before anything is sent: it blocks for a few
+// round trips, once per connection.
+bool
+ws_connection::open()
+{
+    h_ = curl_init();
+    if (!h_)
+        return false;
+    curl_easy_setopt(h_.get(), CURLOPT_URL, url_.c_str());
+    curl_easy_setopt(h_.get(), CURLOPT_CONNECT_ONLY, 2L);
+    curl_easy_setopt(h_.get(), CURLOPT_USERAGENT, "curl");
+    curl_easy_setopt(h_.get(), CURLOPT_SSL_VERIFYPEER, false);
+    curl_easy_setopt(h_.get(), CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(h_.get(), CURLOPT_TCP_KEEPIDLE, 30L);
+    curl_easy_setopt(h_.get(), CURLOPT_TCP_KEEPINTVL, 15L);
+    return curl_easy_perform(h_.get()) == CURLE_OK;
+}
+
+curl_socket_t
+ws_connection::socket() const
+{
+    curl_socket_t s = CURL_SOCKET_BAD;
+    curl_easy_getinfo(h_.get(), CURLINFO_ACTIVESOCKET, &s);
+    return s;
+}
+
+bool
+ws_connection::make_request(std::string const& post, unsigned id)
+{
+    static constexpr std::string_view method = "{\"method\":";
+    static constexpr std::string_view params = ",\"params\":[{";
+    auto p = post.find(params);
+    auto last = post.find_last_not_of(" \n");  // FastWriter ends with a newline
+    if (post.compare(0, method.size(), method) != 0 || p == std::string::npos ||
+        last == std::string::npos || last < p + params.size() + 2 ||
+        post.compare(last - 1, 2, "]}") != 0)
+        return false;
+    request_.assign("{\"id\":");
+    char buf[std::numeric_limits<unsigned>::digits10 + 2];
+    request_.append(buf, std::to_chars(std::begin(buf), std::end(buf), id).ptr);
+    request_.append(",\"command\":");
+    request_.append(post, method.size(), p - method.size());
+    auto fields = p + params.size();
+    if (post[fields] != '}')
+        request_ += ',';
+    request_.append(post, fields, last - 1 - fields);  // less "]}"
+    return true;
+}
+
+bool
+ws_connection::wait_writable() const
+{
+    pollfd fd{socket(), POLLOUT, 0};
+    return ::poll(&fd, 1, 1000) > 0;
+}
+
+unsigned
+ws_connection::send(std::string const& post)
+{
+    unsigned id = last_id_ + 1;
+    if (id == 0)
+        ++id;
+    if (!make_request(post, id))
+        return 0;
+    std::size_t offset = 0;
+    while (offset < request_.size())
+    {
+        std::size_t sent = 0;
+        auto rc = curl_ws_send(h_.get(), request_.data() + offset, request_.size() - offset,
+                               &sent, 0, CURLWS_TEXT);
+        offset += sent;
+        if (rc == CURLE_AGAIN)
+        {
+            if (!wait_writable())
+                return 0;
+        }
+        else if (rc != CURLE_OK)
+            return 0;
+    }
+    last_id_ = id;
+    return id;
+}
+
+// The id of a reply, or 0 if it has none
+unsigned
+ws_connection::reply_id(std::string const& reply)
+{
+    json_scanner scan{reply.data(), reply.data() + reply.size()};
+    long long id = 0;
+    scan.members([&](std::string_view key)
+    {
+        if (key == "id")
+            return scan.integer(id);
+        return scan.skip_value();
+    });
+    if (id <= 0 || id > std::numeric_limits<unsigned>::max())
+        return 0;
+    return static_cast<unsigned>(id);
+}
+
+// libcurl 8.14 made the frame of curl_ws_recv const, earlier ones do not
+// declare it so.  Frame is deduced from whichever signature the headers have.
+template <class Frame>
+static
+CURLcode
+ws_recv(CURLcode (*recv)(CURL*, void*, std::size_t, std::size_t*, Frame**),
+        CURL* h, void* buf, std::size_t size, std::size_t* n, curl_ws_frame const** meta)
+{
+    Frame* frame = nullptr;
+    auto rc = recv(h, buf, size, n, &frame);
+    *meta = frame;
+    return rc;
+}
+
+// A reply may arrive as several frames, and each frame in several pieces.
+// Control frames are answered by libcurl.
+template <class F>
+bool
+ws_connection::receive(F f)
+{
+    char buf[16384];
+    for (;;)
+    {
+        std::size_t n = 0;
+        curl_ws_frame const* meta = nullptr;
+        auto rc = ws_recv(curl_ws_recv, h_.get(), buf, sizeof(buf), &n, &meta);
+        if (rc == CURLE_AGAIN)
+            return true;
+        if (rc != CURLE_OK || (meta->flags & CURLWS_CLOSE))
+            return false;
+        if (!(meta->flags & (CURLWS_TEXT | CURLWS_BINARY | CURLWS_CONT)))
+            continue;
+        message_.append(buf, n);
+        if (meta->bytesleft == 0 && !(meta->flags & CURLWS_CONT))
+        {
+            f(reply_id(message_), message_);
+            message_.clear();
+        }
+    }
+}
+
+ws_pool&
+ws_pool::instance()
+{
+    static ws_pool pool;
+    return pool;
+}
+
+std::unique_ptr<ws_connection>
+ws_pool::acquire(std::string const& url)
+{
+    {
+        std::lock_guard<std::mutex> lock{mut_};
+        auto i = std::find_if(idle_.begin(), idle_.end(),
+                              [&url](auto const& c) {return c->url() == url;});
+        if (i != idle_.end())
+        {
+            auto c = std::move(*i);
+            idle_.erase(i);
+            return c;
+        }
+    }
+    auto c = std::make_unique<ws_connection>(url);
+    if (!c->open())
+        c.reset();
+    return c;
+}
+
+void
+ws_pool::release(std::unique_ptr<ws_connection> c)
+{
+    std::lock_guard<std::mutex> lock{mut_};
+    idle_.push_back(std::move(c));
+}
+
+namespace
+{
+
+struct curl_multi_deleter
+{
+    void operator()(CURLM* p) const
+    {
+        ::curl_multi_cleanup(p);
+    }
+};
+
+// A transfer of one of the posts of post_and_download_many.
+// Each post may have two at a time: the first one, and a hedge, or a retry
+// on another endpoint if the first one failed.  A transfer is an HTTP POST
+// on a handle of its own, or a request on the WebSocket connection to its
+// endpoint, which it shares with the other posts to that endpoint.
+struct attempt
+{
+    curl_pool::lease curl;  // empty for a request on a WebSocket
+    ws_connection* ws;
+    unsigned id;            // of the request on ws
+    std::size_t post;
+    std::size_t endpoint;
+    int slot;  // the sink of the post that receives the reply
+    std::chrono::steady_clock::time_point start;
+    long long received = 0;  // the size of the reply on ws
+};
+
+}  // unnamed namespace
+
+// Post every string of posts at the same time, each to the endpoint that
+// endpoint_set picks.  Each reply goes to one of the two sinks of the post,
+// which are each a std::string or a reply_parser: sinks[i][slot[i]] receives
+// the reply to posts[i], where slot is the vector returned, or slot[i] is -1
+// if there is no reply.
+// A post without reply once the hedge delay of its endpoint has passed is
+// sent again, to another endpoint if there is one.  The one that answers
+// first wins, and the other one is cancelled.  A post whose transfer failed
+// is retried once on another endpoint.
+// The posts to a WebSocket endpoint are all pipelined on one connection,
+// which stays open for the next call.
+template <class Sink>
+static
+std::vector<int>
+post_and_download_many(std::string const* posts, std::array<Sink, 2>* sinks, std::size_t n)
+{
+    using clock = std::chrono::steady_clock;
+    std::vector<int> slot(n, -1);
+    curl_ensure_initialized();
+    std::unique_ptr<CURLM, curl_multi_deleter> multi{::curl_multi_init()};
+    if (!multi)
+        return slot;
+    auto& endpoints = endpoint_set::instance();
+    std::vector<std::unique_ptr<attempt>> attempts;  // running
+    std::vector<std::unique_ptr<ws_connection>> sockets;  // leased by this call
+    std::vector<ws_connection*> failed;  // of sockets, those a send failed on
+    std::vector<unsigned> tries(n, 0);
+    std::vector<std::optional<clock::time_point>> hedge_at(n);
+
+    auto socket_for = [&](std::string const& url) -> ws_connection*
+    {
+        for (auto const& c : sockets)
+            if (c->url() == url &&
+                std::find(failed.begin(), failed.end(), c.get()) == failed.end())
+                return c.get();
+        auto c = ws_pool::instance().acquire(url);
+        if (!c)
+            return nullptr;
+        sockets.push_back(std::move(c));
+        return sockets.back().get();
+    };
+    // Give run_stats the phases of a transfer, before its handle is reused
+    auto note = [&](attempt const& a, bool ran, bool ok, bool cancelled)
+    {
+        if (!run_stats::enabled())
+            return;
+        using us = std::chrono::microseconds;
+        run_stats::query q{endpoints.url(a.endpoint), static_cast<unsigned>(a.slot), ok,
+                           cancelled, {}, {}, {}, {}, {}, {},
+                           static_cast<long long>(posts[a.post].size()), a.received};
+        if (a.curl && ran)
+        {
+            auto info = [h = a.curl.get()](CURLINFO what)
+            {
+                curl_off_t v = 0;
+                curl_easy_getinfo(h, what, &v);
+                return v;
+            };
+            auto dns = info(CURLINFO_NAMELOOKUP_TIME_T);
+            auto connect = std::max(info(CURLINFO_CONNECT_TIME_T), dns);
+            auto tls = std::max(info(CURLINFO_APPCONNECT_TIME_T), connect);
+            auto pretransfer = std::max(info(CURLINFO_PRETRANSFER_TIME_T), tls);
+            auto first_byte = std::max(info(CURLINFO_STARTTRANSFER_TIME_T), pretransfer);
+            auto total = std::max(info(CURLINFO_TOTAL_TIME_T), first_byte);
+            q.dns = us{dns};
+            q.connect = us{connect - dns};
+            q.tls = us{tls - connect};
+            q.wait = us{first_byte - pretransfer};
+            q.transfer = us{total - first_byte};
+            q.total = us{total};
+            q.sent = info(CURLINFO_SIZE_UPLOAD_T);
+            q.received = info(CURLINFO_SIZE_DOWNLOAD_T);
+        }
+        else if (ran)
+            q.total = clock::now() - a.start;
+        else
+            q.sent = 0;
+        run_stats::instance().record(std::move(q));
+    };
+    // Start a transfer of post to endpoint.  One that cannot even start
+    // counts as failed, and is retried at once if the post has a try left.
+    // A post fails over to another endpoint if there is one, else it is
+    // retried on the same one: the server may have closed a connection that
+    // waited in a pool, and the retry gets a new one.
+    auto start = [&](std::size_t post, std::size_t endpoint)
+    {
+        for (;;)
+        {
+            int s = static_cast<int>(tries[post]++);
+            auto a = std::make_unique<attempt>(
+                attempt{curl_pool::lease{curl_pool::instance(), nullptr}, nullptr, 0,
+                        post, endpoint, s, clock::now()});
+            auto url = endpoints.url(endpoint);
+            bool started = false;
+            if (is_ws_url(url))
+            {
+                a->ws = socket_for(url);
+                a->id = a->ws ? a->ws->send(posts[post]) : 0;
+                started = a->id != 0;
+                if (a->ws && !started)  // dropped with its requests in the loop below
+                    failed.push_back(a->ws);
+            }
+            else if ((a->curl = curl_pool::instance().acquire()))
+            {
+                CURL* h = a->curl.get();
+                curl_easy_setopt(h, CURLOPT_URL, url.c_str());
+                curl_easy_setopt(h, CURLOPT_POSTFIELDSIZE, posts[post].size());
+                curl_easy_setopt(h, CURLOPT_POSTFIELDS, posts[post].c_str());
+                set_sink(h, sinks[post][s]);
+                curl_easy_setopt(h, CURLOPT_PRIVATE, a.get());
+                started = curl_multi_add_handle(multi.get(), h) == CURLM_OK;
+            }
+            if (started)
+            {
+                if (s == 0)
+                    if (auto delay = endpoints.hedge_delay(endpoint))
+                        hedge_at[post] = a->start + *delay;
+                attempts.push_back(std::move(a));
+                return;
+            }
+            note(*a, false, false, false);
+            endpoints.record(endpoint, clock::duration{}, false);
+            if (tries[post] >= 2)
+                return;
+            if (endpoints.size() > 1)
+                endpoint = endpoints.pick(endpoint);
+        }
+    };
+    auto stop = [&](attempt* a)
+    {
+        if (a->curl)
+            curl_multi_remove_handle(multi.get(), a->curl.get());
+        attempts.erase(std::find_if(attempts.begin(), attempts.end(),
+                                    [a](auto const& x) {return x.get() == a;}));
+    };
+    auto running_for = [&](std::size_t post)
+    {
+        return std::find_if(attempts.begin(), attempts.end(),
+                            [post](auto const& x) {return x->post == post;});
+    };
+    auto finish = [&](attempt* a, bool ok)
+    {
+        auto post = a->post;
+        auto endpoint = a->endpoint;
+        endpoints.record(endpoint, clock::now() - a->start, ok);
+        if (ok)
+            slot[post] = a->slot;
+        note(*a, true, ok, false);
+        stop(a);
+        hedge_at[post].reset();
+        auto other = running_for(post);
+        if (ok && other != attempts.end())
+        {   // The loser took at least this long
+            endpoints.record((*other)->endpoint, clock::now() - (*other)->start, true);
+            note(**other, true, false, true);
+            stop(other->get());
+        }
+        else if (!ok && other == attempts.end() && tries[post] < 2)
+            start(post, endpoints.size() > 1 ? endpoints.pick(endpoint) : endpoint);
+    };
+
+    for (std::size_t i = 0; i < n; ++i)
+        start(i, endpoints.pick());
+    std::vector<curl_waitfd> fds;
+    while (!attempts.empty())
+    {
+        int running;
+        if (curl_multi_perform(multi.get(), &running) != CURLM_OK)
+            break;
+        int left;
+        while (CURLMsg* msg = curl_multi_info_read(multi.get(), &left))
+        {
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+            char* priv;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &priv);
+            finish(reinterpret_cast<attempt*>(priv), msg->data.result == CURLE_OK);
+        }
+
+        for (std::size_t c = 0; c < sockets.size();)
+        {
+            ws_connection* ws = sockets[c].get();
+            auto f = std::find(failed.begin(), failed.end(), ws);
+            bool ok = f == failed.end() && ws->receive([&](unsigned id, std::string& reply)
+            {
+                auto a = std::find_if(attempts.begin(), attempts.end(),
+                                      [&](auto const& x) {return x->ws == ws && x->id == id;});
+                if (a == attempts.end())  // a reply to a cancelled request, or a stream
+                    return;
+                (*a)->received = static_cast<long long>(reply.size());
+                finish(a->get(), take_reply(sinks[(*a)->post][(*a)->slot], reply));
+            });
+            if (ok)
+            {
+                ++c;
+                continue;
+            }
+            // Every request on a broken connection failed.  Drop it first, so
+            // that their retries open a new one.
+            auto broken = std::move(sockets[c]);
+            sockets.erase(sockets.begin() + static_cast<std::ptrdiff_t>(c));
+            if (f != failed.end())
+                failed.erase(f);
+            std::vector<attempt*> lost;
+            for (auto const& a : attempts)
+                if (a->ws == ws)
+                    lost.push_back(a.get());
+            for (auto a : lost)
+                finish(a, false);
+        }
+
+        auto now = clock::now();
+        auto wait = std::chrono::milliseconds{1000};
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            if (!hedge_at[i])
+                continue;
+            if (*hedge_at[i] <= now)
+            {
+                hedge_at[i].reset();
+                auto first = running_for(i);
+                if (first == attempts.end())
+                    continue;
+                auto endpoint = endpoints.pick((*first)->endpoint);
+                // A hedge pipelined behind the slow request would not overtake it
+                if (endpoint != (*first)->endpoint || !(*first)->ws)
+                    start(i, endpoint);
+            }
+            else
+                wait = std::min(wait, std::chrono::ceil<std::chrono::milliseconds>(*hedge_at[i] - now));
+        }
+        fds.clear();
+        for (auto const& c : sockets)
+            fds.push_back({c->socket(), CURL_WAIT_POLLIN, 0});
+        if (!attempts.empty() &&
+            curl_multi_poll(multi.get(), fds.data(), static_cast<unsigned>(fds.size()),
+                            static_cast<int>(wait.count()), nullptr) != CURLM_OK)
+            break;
+    }
+    for (auto& a : attempts)
+        if (a->curl)
+            curl_multi_remove_handle(multi.get(), a->curl.get());
+    for (auto& c : sockets)
+        if (std::find(failed.begin(), failed.end(), c.get()) == failed.end())
+            ws_pool::instance().release(std::move(c));
+    return slot;
+}
+
+// Post post, as post_and_download_many does.  Returns the slot of the sink
+// that received the reply, or -1.
+template <class Sink>
+static
+int
+post_and_download(std::string const& post, std::array<Sink, 2>& sinks)
+{
+    return post_and_download_many(&post, &sinks, 1)[0];
+}
+
+static
+bool
+post_and_download_to_string(std::string const& post, std::string& reply)
+{
+    std::array<std::string, 2> sinks;
+    int slot = post_and_download(post, sinks);
+    if (slot < 0)
+        return false;
+    reply.swap(sinks[slot]);
+    return true;
+}
+
+// Member names looked up in every reply, hashed once
+static const Json::StaticKey result_key{"result"};
+static const Json::StaticKey status_key{"status"};
+static const Json::StaticKey ledger_key{"ledger"};
+
+// Write the body of a query into post, whose storage is reused
+static
+void
+make_query(std::string const& method, Json::Value const& params, std::string& post)
+{
+    Json::Value query = Json::objectValue;
+    query["method"] = method;
+    Json::Value& p = (query["params"] = Json::arrayValue);
+    p.append(params);
+
+    work_timer timer{run_stats::serialize};
+    post.clear();
+    Json::FastWriter w;
+    w.write(query, post);
+    timer.done(post.size());
+}
+
+static
+std::string
+make_query(std::string const& method, Json::Value const& params)
+{
+    std::string post;
+    make_query(method, params, post);
+    return post;
+}
+
+namespace
+{
+
+// The body of a query, serialized once with holes for the fields that change
+// from one query to the next.  Build it from params holding slot() wherever a
+// field goes, then render() it with the fields in document order.  Rendering
+// appends text only: no Json::Value tree and no FastWriter pass per query.
+class request_template
+{
+    std::vector<std::string> pieces_;
+
+public:
+    request_template(std::string const& method, Json::Value const& params);
+
+    // The placeholder for a field.  No real parameter is this string.
+    static
+    Json::Value
+    slot()
+    {
+        return "\x01";
+    }
+
+    template <class ...Fields>
+        void render(std::string& post, Fields const& ...fields) const;
+
+private:
+    static void append_field(std::string& post, long long field);
+    static void append_field(std::string& post, std::string_view field);
+};
+
+request_template::request_template(std::string const& method,
+                                   Json::Value const& params)
+{
+    auto skeleton = make_query(method, params);
+    auto const hole = Json::valueToQuotedString(slot().asCString());
+    std::string::size_type first = 0;
+    for (auto i = skeleton.find(hole); i != std::string::npos;
+              i = skeleton.find(hole, first))
+    {
+        pieces_.push_back(skeleton.substr(first, i - first));
+        first = i + hole.size();
+    }
+    pieces_.push_back(skeleton.substr(first));
+}
+
+// Write the body of a query into post, whose storage is reused
+template <class ...Fields>
+void
+request_template::render(std::string& post, Fields const& ...fields) const
+{
+    assert(sizeof...(fields) + 1 == pieces_.size());
+    work_timer timer{run_stats::serialize};
+    post.assign(pieces_.front());
+    [[maybe_unused]] std::size_t i = 0;
+    ((append_field(post, fields), post.append(pieces_[++i])), ...);
+    timer.done(post.size());
+}
+
+void
+request_template::append_field(std::string& post, long long field)
+{
+    char buf[std::numeric_limits<long long>::digits10 + 2];
+    auto r = std::to_chars(std::begin(buf), std::end(buf), field);
+    post.append(buf, r.ptr);
+}
+
+void
+request_template::append_field(std::string& post, std::string_view field)
+{
+    if (std::none_of(field.begin(), field.end(), [](unsigned char c)
+                     {return c < 0x20 || c == '"' || c == '\\';}))
+    {
+        post += '"';
+        post.append(field);
+        post += '"';
+    }
+    else
+        post += Json::valueToQuotedString(std::string(field).c_str());
+}
+
+}  // unnamed namespace
+
+// A buffer for the body of the queries made one at a time by this thread
+static
+std::string&
+query_buffer()
+{
+    thread_local std::string post;
+    return post;
+}
+
+// Check the server's reply to a query.  On success reply holds the whole
+// document.  If the server reported a failure, reply holds its "result".
+// Over a WebSocket the status is next to the result, and a failure is
+// reported in place of the result.
+static
+bool
+check_reply(Json::Value& root, Json::Value& reply)
+{
+    bool ws = root.isObject() && root.isMember(status_key);
+    if (ws && !root.isMember(result_key))
+    {
+        std::cerr << "Result is '" << root[status_key].asString() << "', not success\n";
+        reply = std::move(root);
+        return false;
+    }
+    Json::Value& result = root[result_key];
+    if (! result.isObject())
+    {
+        std::cerr << "Result is not object\n";
+        return false;
+    }
+    Json::Value& status = ws ? root[status_key] : result[status_key];
+    if (!status.isString() || (status.asString() != "success"))
+    {
+        std::cerr << "Result is '" << status.asString() << "', not success\n";
+        reply = std::move(result);
+        return false;
+    }
+
+    reply = std::move(root);
+    return true;
+}
+
+// Parse and check the server's reply to a query.  rippled writes strict JSON.
+static
+bool
+parse_reply(std::string const& out, Json::Value& reply)
+{
+    Json::Reader reader{Json::Features::strictMode()};
+    Json::Value root;
+    work_timer timer{run_stats::parse};
+    bool ok = reader.parse(out.data(), out.data() + out.size(), root, false);
+    timer.done(out.size());
+    if (!ok)
+    {
+        std::cerr << reader.getFormatedErrorMessages() << '\n';
+        return false;
+    }
+    return check_reply(root, reply);
+}
+
+// Execute a query against the fastest of the endpoints, by default the S2
+// cluster of full history XRP Ledger nodes.
+// Note that this is a best-effort service that does not guarantee
+// any particular level of reliability.
+static
+bool
+do_query(std::string const& post, Json::Value& reply)
+{
+    std::array<reply_parser, 2> parsers;
+    Json::Value root;
+    int slot = post_and_download(post, parsers);
+    if (slot < 0 || !parsers[slot].finish(root))
+        return false;
+    return check_reply(root, reply);
+}
+
+bool
+do_query(std::string const& method, Json::Value const& params, Json::Value& reply)
+{
+    auto& q = query_buffer();
+    make_query(method, params, q);
+    return do_query(q, reply);
+}
+
+// Execute one query per element of params concurrently, with the same method.
+// replies[i] and the i-th element of the returned vector are what do_query
+// would have produced for params[i].
+std::vector<bool>
+do_queries(std::string const& method, std::vector<Json::Value> const& params,
+           std::vector<Json::Value>& replies)
+{
+    std::vector<std::string> qs;
+    qs.reserve(params.size());
+    for (auto const& p : params)
+        qs.push_back(make_query(method, p));
+
+    std::vector<std::array<reply_parser, 2>> parsers(qs.size());
+    auto slots = post_and_download_many(qs.data(), parsers.data(), qs.size());
+    replies.assign(params.size(), Json::Value{});
+    std::vector<bool> ok(params.size(), false);
+    for (std::size_t i = 0; i < params.size(); ++i)
+    {
+        Json::Value root;
+        if (slots[i] >= 0)
+            ok[i] = parsers[i][slots[i]].finish(root) && check_reply(root, replies[i]);
+    }
+    return ok;
+}
+
+// Parameters asking for a ledger header, with a slot for the ledger index
+static
+Json::Value
+header_params()
+{
+    Json::Value params = Json::objectValue;
+    params["ledger_index"] = request_template::slot();
+    return params;
+}
+
+static
+request_template const&
+header_query()
+{
+    static const request_template query{"ledger", header_params()};
+    return query;
+}
+
+// Write a "ledger" query for ledger_seq, or for the last validated ledger if
+// ledger_seq is 0, from a template whose only slot is the ledger index
+static
+void
+render_ledger_query(request_template const& query, unsigned ledger_seq,
+                    std::string& post)
+{
+    if (ledger_seq == 0)
+        query.render(post, "validated");
+    else
+        query.render(post, ledger_seq);
+}
+
+// Extract the ledger header from a successful reply to a "ledger" query
+static
+bool
+reply_to_header(bool ok, Json::Value& reply, Json::Value& header)
+{
+    if (!ok)
+    {
+        header = std::move(reply);
+        return false;
+    }
+    header = reply[result_key][ledger_key];
+    if (header.isObject() && !header.isNull())
+        return true;
+    header = std::move(reply);
+    return false;
+}
+
+// Get the header of a ledger given its sequence number
+bool getHeader (unsigned ledger_seq, Json::Value& header)
+{
+    auto& q = query_buffer();
+    render_ledger_query(header_query(), ledger_seq, q);
+    Json::Value reply;
+    bool ok = do_query(q, reply);
+    return reply_to_header(ok, reply, header);
+}
+
+// Parameters asking for a ledger header in binary.  That is the smallest reply
+// rippled sends for a ledger: the serialized header as hex, and a few flags.
+static
+Json::Value
+close_time_params()
+{
+    auto params = header_params();
+    params["binary"] = true;
+    return params;
+}
+
+static
+request_template const&
+close_time_query()
+{
+    static const request_template query{"ledger", close_time_params()};
+    return query;
+}
+
+static
+bool
+decode_hex_u32(std::string_view hex, std::size_t offset, long long& value)
+{
+    if (hex.size() < offset + 8)
+        return false;
+    auto first = hex.data() + offset;
+    std::uint32_t v;
+    auto [ptr, ec] = std::from_chars(first, first + 8, v, 16);
+    if (ec != std::errc{} || ptr != first + 8)
+        return false;
+    value = v;
+    return true;
+}
+
+// Pick the sequence number and close time of the ledger out of the raw reply
+// to a "ledger" query, touching nothing else in the document.
+// In a binary reply the header is serialized as: sequence (4 bytes), total
+// drops (8), parent hash, transaction hash and account state hash (32 each),
+// parent close time (4), close time (4), close time resolution and close
+// flags (1 each).  A JSON reply carries the same two fields by name.
+// Returns {0, 0} if the reply is not a successful one.
+static
+std::pair<int, int>
+extract_seq_and_close_time(std::string const& out)
+{
+    work_timer timer{run_stats::scan};
+    json_scanner scan{out.data(), out.data() + out.size()};
+    std::string_view status;
+    std::string_view ledger_data;
+    long long result_seq = 0;
+    long long seq = 0;
+    long long close_time = 0;
+    bool ok = scan.members([&](std::string_view key)
+    {
+        if (key == "status")  // over a WebSocket
+            return scan.string(status);
+        if (key != "result")
+            return scan.skip_value();
+        return scan.members([&](std::string_view key)
+        {
+            if (key == "status")
+                return scan.string(status);
+            if (key == "ledger_index")
+                return scan.integer(result_seq);
+            if (key != "ledger")
+                return scan.skip_value();
+            return scan.members([&](std::string_view key)
+            {
+                if (key == "ledger_data")
+                    return scan.string(ledger_data);
+                if (key == "close_time")
+                    return scan.integer(close_time);
+                if (key == "ledger_index")
+                    return scan.integer(seq);
+                return scan.skip_value();
+            });
+        });
+    });
+    timer.done(out.size());
+    if (!ok || status != "success")
+        return {0, 0};
+    if (!ledger_data.empty() && (!decode_hex_u32(ledger_data, 0, seq) ||
+                                 !decode_hex_u32(ledger_data, 2*(4+8+3*32+4), close_time)))
+        return {0, 0};
+    if (seq == 0)
+        seq = result_seq;
+    if ((result_seq != 0 && seq != result_seq) || seq <= 0 || close_time <= 0 ||
+        seq > std::numeric_limits<int>::max() || close_time > std::numeric_limits<int>::max())
+        return {0, 0};
+    return {static_cast<int>(seq), static_cast<int>(close_time)};
+}
+
+// Report why a reply that extract_seq_and_close_time could not use failed
+static
+void
+report_bad_header_reply(std::string const& out)
+{
+    Json::Value reply;
+    if (parse_reply(out, reply))
+        std::cerr << "Reply does not hold a ledger header\n";
+}
+
+// Get the sequence number and close time of a ledger, or of the last validated
+// ledger if ledger_seq is 0.  Returns {0, 0} on failure.
+static
+std::pair<int, int>
+get_seq_and_close_time(unsigned ledger_seq)
+{
+    std::string out;
+    auto& q = query_buffer();
+    render_ledger_query(close_time_query(), ledger_seq, q);
+    if (!post_and_download_to_string(q, out))
+        return {0, 0};
+    auto r = extract_seq_and_close_time(out);
+    if (r.first == 0)
+        report_bad_header_reply(out);
+    return r;
+}
+
+std::pair<int, int>
+get_last_validated_close_time()
+{
+    return get_seq_and_close_time(0);
+}
+
+int
+get_close_time(unsigned ledger_seq)
+{
+    return get_seq_and_close_time(ledger_seq).second;
+}
+
+// Get the close times of several ledgers at once.  Failures are reported as 0.
+std::vector<int>
+get_close_times(std::vector<unsigned> const& ledger_seqs)
+{
+    std::vector<std::string> qs(ledger_seqs.size());
+    for (std::size_t i = 0; i < ledger_seqs.size(); ++i)
+        render_ledger_query(close_time_query(), ledger_seqs[i], qs[i]);
+    std::vector<std::array<std::string, 2>> outs(qs.size());
+    auto slots = post_and_download_many(qs.data(), outs.data(), qs.size());
+    std::vector<int> close_times(ledger_seqs.size(), 0);
+    for (std::size_t i = 0; i < ledger_seqs.size(); ++i)
+    {
+        if (slots[i] < 0)
+            continue;
+        auto const& out = outs[i][slots[i]];
+        auto [seq, t] = extract_seq_and_close_time(out);
+        if (seq == static_cast<int>(ledger_seqs[i]))
+            close_times[i] = t;
+        else
+            report_bad_header_reply(out);
+    }
+    return close_times;
+}
+
+namespace
+{
+
+// A file of (seq, close_time) samples shared by every run of this program.
+// The file is an 8 byte magic number followed by fixed width records sorted by
+// seq.  It is memory-mapped read-only for lookups.  New samples are held in
+// memory until flush() merges them into the file, which it replaces atomically.
+// Flushes are serialized by a lock on a file of their own, path + ".lock": the
+// cache file itself is a different file after each flush, and a lock on it
+// would not keep a flush from merging into a file another one has replaced.
+class sample_cache
+{
+    struct record
+    {
+        std::uint32_t seq;
+        std::uint32_t close_time;
+    };
+
+    static constexpr char magic_[8] = {'L', 'G', 'R', 'S', 'A', 'M', 'P', '1'};
+    static constexpr std::size_t max_pending_ = 4096;
+
+    std::string path_;
+    void* map_ = nullptr;
+    std::size_t map_size_ = 0;
+    record const* begin_ = nullptr;
+    record const* end_ = nullptr;
+    std::vector<sample> pending_;  // sorted by seq
+
+public:
+    explicit sample_cache(std::string path);
+    ~sample_cache();
+
+    sample_cache(sample_cache const&) = delete;
+    sample_cache& operator=(sample_cache const&) = delete;
+
+    bool is_open() const {return !path_.empty();}
+
+    // Return the close time of ledger_seq, or 0 if it is not in the cache
+    int find(int ledger_seq) const;
+    void insert(int ledger_seq, int close_time);
+    std::pair<std::optional<sample>, std::optional<sample>> bracket(int target) const;
+    std::vector<sample> samples() const;
+
+    bool flush();
+
+private:
+    bool map();
+    void unmap();
+};
+
+}  // unnamed namespace
+
+sample_cache::sample_cache(std::string path)
+    : path_{std::move(path)}
+{
+    if (!map())
+    {
+        std::cerr << "Unable to use " << path_ << " as a ledger sample cache\n";
+        path_.clear();
+    }
+}
+
+sample_cache::~sample_cache()
+{
+    flush();
+    unmap();
+}
+
+// Map the current contents of the cache file, creating it if needed
+bool
+sample_cache::map()
+{
+    unmap();
+    int fd = ::open(path_.c_str(), O_RDONLY | O_CREAT, 0644);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (::fstat(fd, &st) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+    auto size = static_cast<std::size_t>(st.st_size);
+    if (size == 0)
+    {
+        ::close(fd);
+        return true;
+    }
+    if (size < sizeof(magic_) || (size - sizeof(magic_)) % sizeof(record) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+    void* p = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+        return false;
+    if (std::memcmp(p, magic_, sizeof(magic_)) != 0)
+    {
+        ::munmap(p, size);
+        return false;
+    }
+    map_ = p;
+    map_size_ = size;
+    begin_ = reinterpret_cast<record const*>(static_cast<char const*>(p) + sizeof(magic_));
+    end_ = begin_ + (size - sizeof(magic_)) / sizeof(record);
+    return true;
+}
+
+void
+sample_cache::unmap()
+{
+    if (map_ != nullptr)
+        ::munmap(map_, map_size_);
+    map_ = nullptr;
+    map_size_ = 0;
+    begin_ = end_ = nullptr;
+}
+
+int
+sample_cache::find(int ledger_seq) const
+{
+    auto seq = static_cast<std::uint32_t>(ledger_seq);
+    auto r = std::lower_bound(begin_, end_, seq,
+                              [](record const& x, std::uint32_t s) {return x.seq < s;});
+    if (r != end_ && r->seq == seq)
+        return static_cast<int>(r->close_time);
+    auto i = std::lower_bound(pending_.begin(), pending_.end(), ledger_seq,
+                              [](sample const& x, int s) {return x.seq < s;});
+    if (i != pending_.end() && i->seq == ledger_seq)
+        return i->close_time;
+    return 0;
+}
+
+void
+sample_cache::insert(int ledger_seq, int close_time)
+{
+    if (!is_open() || ledger_seq <= 0 || close_time <= 0 || find(ledger_seq) != 0)
+        return;
+    auto i = std::lower_bound(pending_.begin(), pending_.end(), ledger_seq,
+                              [](sample const& x, int s) {return x.seq < s;});
+    pending_.insert(i, {ledger_seq, close_time});
+    if (pending_.size() >= max_pending_)
+        flush();
+}
+
+// Return the last sample closed at or before target, and the first one closed after it
+std::pair<std::optional<sample>, std::optional<sample>>
+sample_cache::bracket(int target) const
+{
+    std::optional<sample> lo;
+    std::optional<sample> hi;
+    auto t = static_cast<std::uint32_t>(target);
+    auto r = std::partition_point(begin_, end_,
+                                  [t](record const& x) {return x.close_time <= t;});
+    if (r != begin_)
+        lo = sample{static_cast<int>(r[-1].seq), static_cast<int>(r[-1].close_time)};
+    if (r != end_)
+        hi = sample{static_cast<int>(r->seq), static_cast<int>(r->close_time)};
+    auto i = std::partition_point(pending_.begin(), pending_.end(),
+                                  [target](sample const& x) {return x.close_time <= target;});
+    if (i != pending_.begin() && (!lo || i[-1].seq > lo->seq))
+        lo = i[-1];
+    if (i != pending_.end() && (!hi || i->seq < hi->seq))
+        hi = *i;
+    return {lo, hi};
+}
+
+// Every sample in the cache, sorted by seq
+std::vector<sample>
+sample_cache::samples() const
+{
+    std::vector<sample> all;
+    all.reserve(static_cast<std::size_t>(end_ - begin_) + pending_.size());
+    std::transform(begin_, end_, std::back_inserter(all), [](record const& x)
+    {
+        return sample{static_cast<int>(x.seq), static_cast<int>(x.close_time)};
+    });
+    auto middle = all.insert(all.end(), pending_.begin(), pending_.end());
+    std::inplace_merge(all.begin(), middle, all.end(),
+                       [](sample const& x, sample const& y) {return x.seq < y.seq;});
+    return all;
+}
+
+// Merge the pending samples with the file as it is now (another process may
+// have added to it since it was mapped), write the result to a temporary file
+// and rename it over the cache.  An exclusive lock on the lock file keeps two
+// processes from merging at the same time.
+bool
+sample_cache::flush()
+{
+    if (!is_open() || pending_.empty())
+        return true;
+    auto lock_path = path_ + ".lock";
+    int lock_fd = ::open(lock_path.c_str(), O_RDONLY | O_CREAT, 0644);
+    if (lock_fd < 0)
+        return false;
+    ::flock(lock_fd, LOCK_EX);
+    bool ok = map();
+    if (ok)
+    {
+        auto tmp = path_ + ".tmp." + std::to_string(::getpid());
+        std::ofstream out{tmp, std::ios::binary | std::ios::trunc};
+        out.write(magic_, sizeof(magic_));
+        auto r = begin_;
+        auto i = pending_.begin();
+        while (r != end_ || i != pending_.end())
+        {
+            record x;
+            if (i == pending_.end() || (r != end_ && r->seq <= static_cast<std::uint32_t>(i->seq)))
+            {
+                if (i != pending_.end() && r->seq == static_cast<std::uint32_t>(i->seq))
+                    ++i;
+                x = *r++;
+            }
+            else
+            {
+                x = {static_cast<std::uint32_t>(i->seq), static_cast<std::uint32_t>(i->close_time)};
+                ++i;
+            }
+            out.write(reinterpret_cast<char const*>(&x), sizeof(x));
+        }
+        out.close();
+        ok = out && ::rename(tmp.c_str(), path_.c_str()) == 0;
+        if (!ok)
+            ::unlink(tmp.c_str());
+    }
+    ::flock(lock_fd, LOCK_UN);
+    ::close(lock_fd);
+    if (ok)
+    {
+        pending_.clear();
+        ok = map();
+    }
+    return ok;
+}
+
+namespace
+{
+
+// The close times of ledgers already known to this process.
+// The close time of a validated ledger never changes, and close times increase
+// with the sequence number, so every sample fetched while resolving one target
+// can bracket the search for any later target.
+// If a sample_cache is given, it is consulted before the network, and every
+// newly fetched sample is added to it.
+// All the samples, cached or fetched, go into a close_time_model that can
+// seed each search with a tight bracket.
+// Any number of searches may share the samples, each through a search_samples
+// of its own: a mutex guards them, and is not held across a query.
+class close_time_samples
+{
+    mutable std::mutex mut_;
+    std::vector<sample> samples_;  // sorted by seq, and so also by close_time
+    sample_cache* cache_;
+    close_time_model model_;
+
+public:
+    explicit close_time_samples(sample_cache* cache = nullptr);
+
+    // Return the close time of ledger_seq if this process or the cache knows it, else 0
+    int find(int ledger_seq);
+    void insert(int ledger_seq, int close_time);
+
+    // Return the last sample closed at or before target, and the first sample
+    // closed after it.  Either may be empty.
+    std::pair<std::optional<sample>, std::optional<sample>> bracket(int target) const;
+
+    std::size_t size() const;
+    close_time_model model() const;
+};
+
+// One search's access to the samples it shares with other searches: what
+// ledger_search.h needs.  It fetches what is not known yet, and counts the
+// probes of its search.
+class search_samples
+{
+    close_time_samples& shared_;
+    long long probes_ = 0;   // close times looked up
+    long long fetched_ = 0;  // of those, fetched from the network
+    long long rounds_ = 0;   // calls to the network that fetched them
+
+public:
+    explicit search_samples(close_time_samples& shared)
+        : shared_{shared}
+    {
+    }
+
+    int get_close_time(int ledger_seq);
+    std::vector<int> get_close_times(std::vector<int> const& ledger_seqs);
+
+    std::pair<std::optional<sample>, std::optional<sample>>
+    bracket(int target) const
+    {
+        return shared_.bracket(target);
+    }
+
+    close_time_model model() const {return shared_.model();}
+
+    // {probes, fetched, rounds} so far
+    std::array<long long, 3> counts() const {return {probes_, fetched_, rounds_};}
+};
+
+}  // unnamed namespace
+
+close_time_samples::close_time_samples(sample_cache* cache)
+    : cache_{cache != nullptr && cache->is_open() ? cache : nullptr}
+{
+    if (cache_ != nullptr)
+        model_.fit(cache_->samples());
+}
+
+int
+close_time_samples::find(int ledger_seq)
+{
+    std::lock_guard<std::mutex> lock{mut_};
+    auto i = std::lower_bound(samples_.begin(), samples_.end(), ledger_seq,
+                              [](sample const& x, int seq) {return x.seq < seq;});
+    if (i != samples_.end() && i->seq == ledger_seq)
+        return i->close_time;
+    int t = cache_ != nullptr ? cache_->find(ledger_seq) : 0;
+    if (t != 0)
+        samples_.insert(i, {ledger_seq, t});
+    return t;
+}
+
+void
+close_time_samples::insert(int ledger_seq, int close_time)
+{
+    std::lock_guard<std::mutex> lock{mut_};
+    auto i = std::lower_bound(samples_.begin(), samples_.end(), ledger_seq,
+                              [](sample const& x, int seq) {return x.seq < seq;});
+    if (i != samples_.end() && i->seq == ledger_seq)
+        return;  // another search fetched it too
+    samples_.insert(i, {ledger_seq, close_time});
+    if (cache_ != nullptr)
+        cache_->insert(ledger_seq, close_time);
+    model_.update({ledger_seq, close_time});
+    if (model_.stale())
+        model_.fit(cache_ != nullptr ? cache_->samples() : samples_);
+}
+
+std::pair<std::optional<sample>, std::optional<sample>>
+close_time_samples::bracket(int target) const
+{
+    std::lock_guard<std::mutex> lock{mut_};
+    std::optional<sample> lo;
+    std::optional<sample> hi;
+    if (cache_ != nullptr)
+        std::tie(lo, hi) = cache_->bracket(target);
+    auto i = std::partition_point(samples_.begin(), samples_.end(),
+                                  [target](sample const& x) {return x.close_time <= target;});
+    if (i != samples_.begin() && (!lo || i[-1].seq > lo->seq))
+        lo = i[-1];
+    if (i != samples_.end() && (!hi || i->seq < hi->seq))
+        hi = *i;
+    return {lo, hi};
+}
+
+std::size_t
+close_time_samples::size() const
+{
+    std::lock_guard<std::mutex> lock{mut_};
+    return samples_.size();
+}
+
+// A copy, that other searches can update while this one uses it
+close_time_model
+close_time_samples::model() const
+{
+    std::lock_guard<std::mutex> lock{mut_};
+    return model_;
+}
+
+// Return the close time of ledger_seq, fetching it only if it is not yet known.
+// Returns 0 on failure.
+int
+search_samples::get_close_time(int ledger_seq)
+{
+    ++probes_;
+    int t = shared_.find(ledger_seq);
+    if (t == 0)
+    {
+        ++fetched_;
+        ++rounds_;
+        t = ::get_close_time(ledger_seq);
+        if (t != 0)
+            shared_.insert(ledger_seq, t);
+    }
+    return t;
+}
+
+// Return the close times of ledger_seqs, fetching all of the unknown ones at
+// the same time.  Failures are reported as 0.
+std::vector<int>
+search_samples::get_close_times(std::vector<int> const& ledger_seqs)
+{
+    probes_ += static_cast<long long>(ledger_seqs.size());
+    std::vector<int> close_times(ledger_seqs.size(), 0);
+    std::vector<unsigned> unknown;
+    std::vector<std::size_t> where;
+    for (std::size_t i = 0; i < ledger_seqs.size(); ++i)
+    {
+        close_times[i] = shared_.find(ledger_seqs[i]);
+        if (close_times[i] == 0 && ledger_seqs[i] > 0)
+        {
+            unknown.push_back(static_cast<unsigned>(ledger_seqs[i]));
+            where.push_back(i);
+        }
+    }
+    if (unknown.empty())
+        return close_times;
+    fetched_ += static_cast<long long>(unknown.size());
+    ++rounds_;
+    auto fetched = ::get_close_times(unknown);
+    for (std::size_t j = 0; j < fetched.size(); ++j)
+    {
+        close_times[where[j]] = fetched[j];
+        if (fetched[j] != 0)
+            shared_.insert(static_cast<int>(unknown[j]), fetched[j]);
+    }
+    return close_times;
+}
+
+// Ledger download
+
+namespace
+{
+
+// A fixed set of threads running tasks in the order they are submitted
+class thread_pool
+{
+    std::mutex mut_;
+    std::condition_variable cv_;
+    std::deque<std::function<void()>> tasks_;
+    bool stopping_ = false;
+    std::vector<std::thread> threads_;
+
+public:
+    explicit thread_pool(unsigned n);
+    thread_pool(thread_pool const&) = delete;
+    thread_pool& operator=(thread_pool const&) = delete;
+    ~thread_pool();  // runs the tasks left first
+
+    void submit(std::function<void()> task);
+
+private:
+    void run();
+};
+
+}  // unnamed namespace
+
+thread_pool::thread_pool(unsigned n)
+{
+    threads_.reserve(n);
+    for (unsigned i = 0; i < n; ++i)
+        threads_.emplace_back([this] {run();});
+}
+
+thread_pool::~thread_pool()
+{
+    {
+        std::lock_guard<std::mutex> lock{mut_};
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    for (auto& t : threads_)
+        t.join();
+}
+
+void
+thread_pool::submit(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock{mut_};
+        tasks_.push_back(std::move(task));
+    }
+    cv_.notify_one();
+}
+
+void
+thread_pool::run()
+{
+    for (;;)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock{mut_};
+            cv_.wait(lock, [this] {return stopping_ || !tasks_.empty();});
+            if (tasks_.empty())
+                return;
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        task();
+    }
+}
+
+// Parameters asking for a page of the state of a ledger as JSON, with slots
+// for the ledger index and, if with_marker, the marker to continue after
+static
+Json::Value
+ledger_data_params(bool with_marker)
+{
+    Json::Value params = Json::objectValue;
+    params["ledger_index"] = request_template::slot();
+    params["binary"] = false;
+    params["limit"] = 2048;  // the server may send less
+    if (with_marker)
+        params["marker"] = request_template::slot();
+    return params;
+}
+
+static
+request_template const&
+ledger_data_query(bool with_marker)
+{
+    static const request_template first{"ledger_data", ledger_data_params(false)};
+    static const request_template next{"ledger_data", ledger_data_params(true)};
+    return with_marker ? next : first;
+}
+
+// Pick the status and the marker out of the raw reply to a "ledger_data"
+// query.  marker is left empty on the last page.
+static
+bool
+scan_ledger_data(std::string const& out, std::string_view& marker)
+{
+    work_timer timer{run_stats::scan};
+    json_scanner scan{out.data(), out.data() + out.size()};
+    std::string_view status;
+    bool ok = scan.members([&](std::string_view key)
+    {
+        if (key == "status")  // over a WebSocket
+            return scan.string(status);
+        if (key != "result")
+            return scan.skip_value();
+        return scan.members([&](std::string_view key)
+        {
+            if (key == "status")
+                return scan.string(status);
+            if (key == "marker")
+                return scan.string(marker);
+            return scan.skip_value();
+        });
+    });
+    timer.done(out.size());
+    return ok && status == "success";
+}
+
+// The marker that makes a "ledger_data" query start at the first key of the
+// part-th of parts equal ranges of keys: the key just before it, in hex.
+// Keys are 256 bits.
+static
+std::string
+partition_marker(unsigned part, unsigned parts)
+{
+    assert(0 < part && part < parts);
+    auto first = static_cast<std::uint64_t>((static_cast<unsigned __int128>(part) << 64) / parts);
+    char buf[17];
+    auto r = std::to_chars(std::begin(buf), std::end(buf), first - 1, 16);
+    std::string marker(static_cast<std::size_t>(16 - (r.ptr - buf)), '0');
+    marker.append(buf, r.ptr);
+    marker.append(48, 'F');
+    std::transform(marker.begin(), marker.end(), marker.begin(),
+                   [](unsigned char c) {return static_cast<char>(std::toupper(c));});
+    return marker;
+}
+
+namespace
+{
+
+// Downloads the state of a ledger as one "ledger_data" query after the other
+// in each of several ranges of keys at the same time.  rippled takes any key
+// as a marker, so each range starts on its own from the key before its
+// first, and ends once a page reaches the last key of the range: its reply
+// holds keys in order, so the entries of the ranges, in the order of the
+// ranges, are the state in key order.
+// Pages are parsed on a thread pool while the next pages download, and their
+// entries are handed to write in key order as the pages are ready: their
+// text depends on where they are in the document, so they are serialized by
+// the writer of the document.  A range that is ahead of the one being written
+// waits once max_pending_ pages are held, so memory stays bounded whatever
+// the size of the ledger.
+class ledger_download
+{
+    struct page
+    {
+        std::string reply;
+        Json::Value state;  // the entries in the range
+        bool ready = false;
+        bool ok = false;
+    };
+
+    struct range
+    {
+        std::string marker;  // empty before the first page of the first range
+        std::string last;    // the last key, or empty for the last range
+        bool fetched = false;
+        std::deque<std::unique_ptr<page>> pages;  // not yet written
+    };
+
+    static constexpr std::size_t max_pending_per_range_ = 4;
+
+    unsigned ledger_seq_;
+    std::function<void(Json::Value const&)> write_;
+    std::vector<range> ranges_;
+    std::size_t pending_ = 0;  // pages held
+    std::size_t max_pending_;
+    std::size_t entries_ = 0;
+    std::mutex mut_;
+    std::condition_variable ready_;
+    thread_pool pool_;  // last, so that it is done with the pages before they go
+
+public:
+    ledger_download(unsigned ledger_seq, std::function<void(Json::Value const&)> write,
+                    unsigned ranges);
+
+    // Call write with each entry of the state.
+    // Returns the number of entries written, or -1 on failure
+    long long run();
+
+private:
+    bool fetch(std::vector<std::size_t> const& which);
+    void parse(page& p, std::string const& last);
+    bool write_ready(std::size_t& current);
+};
+
+}  // unnamed namespace
+
+ledger_download::ledger_download(unsigned ledger_seq,
+                                 std::function<void(Json::Value const&)> write,
+                                 unsigned ranges)
+    : ledger_seq_{ledger_seq}
+    , write_{std::move(write)}
+    , ranges_(std::max(ranges, 1u))
+    , max_pending_{max_pending_per_range_ * ranges_.size()}
+    , pool_{std::clamp(std::thread::hardware_concurrency(), 1u, 4u)}
+{
+    auto n = static_cast<unsigned>(ranges_.size());
+    for (unsigned i = 1; i < n; ++i)
+    {
+        ranges_[i].marker = partition_marker(i, n);
+        ranges_[i-1].last = ranges_[i].marker;
+    }
+}
+
+// The entries of a page past the last key of its range belong to the next one
+void
+ledger_download::parse(page& p, std::string const& last)
+{
+    static const Json::StaticKey state_key{"state"};
+    static const Json::StaticKey index_key{"index"};
+    Json::Value reply;
+    bool ok = parse_reply(p.reply, reply);
+    Json::UInt entries = 0;
+    if (ok)
+    {
+        auto& state = reply[result_key][state_key];
+        for (auto const& entry : state)
+        {
+            if (!last.empty() && entry[index_key].asString() > last)
+                break;
+            ++entries;
+        }
+        if (state.isArray())
+            state.resize(entries);
+        p.state = std::move(state);
+    }
+    {
+        std::lock_guard<std::mutex> lock{mut_};
+        p.reply = std::string{};
+        p.ready = true;
+        p.ok = ok;
+        entries_ += entries;
+    }
+    ready_.notify_one();
+}
+
+// Fetch the next page of each range in which, and hand the pages to the pool
+bool
+ledger_download::fetch(std::vector<std::size_t> const& which)
+{
+    std::vector<std::string> qs(which.size());
+    for (std::size_t i = 0; i < which.size(); ++i)
+    {
+        auto const& r = ranges_[which[i]];
+        if (r.marker.empty())
+            ledger_data_query(false).render(qs[i], ledger_seq_);
+        else
+            ledger_data_query(true).render(qs[i], ledger_seq_, r.marker);
+    }
+    std::vector<std::array<std::string, 2>> outs(qs.size());
+    auto slots = post_and_download_many(qs.data(), outs.data(), qs.size());
+    for (std::size_t i = 0; i < which.size(); ++i)
+    {
+        auto& r = ranges_[which[i]];
+        std::string_view marker;
+        if (slots[i] < 0 || !scan_ledger_data(outs[i][slots[i]], marker))
+        {
+            Json::Value reply;
+            if (slots[i] >= 0 && parse_reply(outs[i][slots[i]], reply))
+                std::cerr << "Reply does not continue the state\n";
+            std::cerr << "Unable to download the state of ledger " << ledger_seq_ << '\n';
+            return false;
+        }
+        if (marker.empty() || (!r.last.empty() && marker >= r.last))
+            r.fetched = true;
+        else
+            r.marker = marker;
+        auto p = std::make_unique<page>();
+        p->reply.swap(outs[i][slots[i]]);
+        auto& pr = *p;
+        {
+            std::lock_guard<std::mutex> lock{mut_};
+            r.pages.push_back(std::move(p));
+            ++pending_;
+        }
+        pool_.submit([this, &pr, &last = r.last] {parse(pr, last);});
+    }
+    return true;
+}
+
+// Write the pages that are ready, in order, from the range current on
+bool
+ledger_download::write_ready(std::size_t& current)
+{
+    std::unique_lock<std::mutex> lock{mut_};
+    while (current < ranges_.size())
+    {
+        auto& r = ranges_[current];
+        if (r.pages.empty())
+        {
+            if (!r.fetched)
+                return true;
+            ++current;
+            continue;
+        }
+        if (!r.pages.front()->ready)
+            return true;
+        auto p = std::move(r.pages.front());
+        r.pages.pop_front();
+        --pending_;
+        lock.unlock();
+        if (!p->ok)
+            return false;
+        for (auto const& entry : p->state)
+            write_(entry);
+        lock.lock();
+    }
+    return true;
+}
+
+long long
+ledger_download::run()
+{
+    std::size_t current = 0;  // the range being written
+    bool ok = true;
+    while (ok && current < ranges_.size())
+    {
+        std::vector<std::size_t> which;
+        for (auto i = current; i < ranges_.size(); ++i)
+            if (!ranges_[i].fetched && (i == current || pending_ < max_pending_))
+                which.push_back(i);
+        if (which.empty())
+        {   // Only parsing is left to do in the current range
+            std::unique_lock<std::mutex> lock{mut_};
+            auto& r = ranges_[current];
+            ready_.wait(lock, [&r] {return r.pages.empty() || r.pages.front()->ready;});
+        }
+        else
+            ok = fetch(which);
+        ok = write_ready(current) && ok;
+    }
+    if (!ok)
+        return -1;
+    return static_cast<long long>(entries_);
+}
+// Write ledger ledger_seq with writer, a Json::StreamingWriter or a
+// Json::CborStreamingWriter, as one object: the members of header, and its
+// state in key order as "accountState".
+// Returns the number of state entries written, or -1 on failure
+template <class Writer>
+static
+long long
+write_ledger(Writer& writer, unsigned ledger_seq, Json::Value const& header,
+             unsigned ranges)
+{
+    static const std::string account_state = "accountState";
+    writer.beginObject();
+    for (auto const& name : header.getMemberNames())
+    {
+        if (name == account_state)
+            continue;
+        writer.name(name);
+        writer.value(header[name]);
+    }
+    writer.name(account_state);
+    writer.beginArray();
+    auto entries = ledger_download{ledger_seq,
+                                   [&writer](Json::Value const& entry)
+                                   {
+                                       work_timer timer{run_stats::write};
+                                       writer.value(entry);
+                                       timer.done(0);
+                                   },
+                                   ranges}.run();
+    if (entries < 0)
+        return -1;
+    writer.end();
+    writer.end();
+    return entries;
+}
+
+bool
+download_ledger(unsigned ledger_seq, std::string const& path, unsigned ranges,
+                bool cbor, bool compact)
+{
+    std::ofstream out{path, std::ios::binary};
+    if (!out)
+    {
+        std::cerr << "Unable to open " << path << '\n';
+        return false;
+    }
+    Json::Value header;
+    if (!getHeader(ledger_seq, header))
+    {
+        std::cerr << "Unable to get the header of ledger " << ledger_seq << '\n';
+        return false;
+    }
+    long long entries;
+    if (cbor)
+    {
+        Json::CborStreamingWriter writer{out};
+        entries = write_ledger(writer, ledger_seq, header, ranges);
+    }
+    else
+    {
+        Json::StreamingWriter writer{out, compact};
+        entries = write_ledger(writer, ledger_seq, header, ranges);
+    }
+    if (entries < 0)
+        return false;
+    if (!out.flush())
+    {
+        std::cerr << "Unable to write " << path << '\n';
+        return false;
+    }
+    if (run_stats::enabled())  // the bytes of the entries, and of the rest
+        run_stats::instance().record(run_stats::write, 0,
+                                     static_cast<long long>(out.tellp()), {});
+    std::cerr << entries << " state entries of ledger " << ledger_seq
+              << " written to " << path << '\n';
+    return true;
+}
+
+void
+enable_run_stats()
+{
+    run_stats::enable();
+}
+
+Json::Value
+run_stats_report()
+{
+    return run_stats::instance().report();
+}
+
+// Ledger resolver
+
+// Search for target in samples, seeded by their model, probing probes ledgers
+// at the same time in each round if probes > 1
+static
+std::pair<int, int>
+search(std::chrono::seconds target, close_time_samples& shared, unsigned probes, bool trace)
+{
+    std::optional<run_stats::clock::time_point> start;
+    if (run_stats::enabled())
+        start = run_stats::clock::now();
+    search_samples samples{shared};
+    seed_from_model(target, samples, samples.model(), probes, trace);
+    auto found = probes > 1 ? find_ledger_concurrent(target, samples, probes, trace)
+                            : find_ledger(target, samples, trace);
+    if (start)
+    {
+        auto counts = samples.counts();
+        using namespace date;
+        std::ostringstream os;
+        os << target + epoch;
+        run_stats::instance().record(run_stats::search{
+            os.str(), found.first, found.second, counts[0], counts[1], counts[2],
+            run_stats::clock::now() - *start});
+    }
+    return found;
+}
+
+// Pick the sequence number and close time of a validated ledger out of a
+// message on a WebSocket: the reply to a "subscribe" to the "ledger" stream,
+// which tells the last one, or a "ledgerClosed" message of the stream.
+// Returns {0, 0} if the message is neither.
+static
+std::pair<int, int>
+extract_validated_ledger(std::string const& message)
+{
+    json_scanner scan{message.data(), message.data() + message.size()};
+    std::string_view type;
+    std::string_view status;
+    long long seq = 0;
+    long long close_time = 0;
+    auto ledger = [&](std::string_view key)
+    {
+        if (key == "ledger_index")
+            return scan.integer(seq);
+        if (key == "ledger_time")
+            return scan.integer(close_time);
+        return scan.skip_value();
+    };
+    bool ok = scan.members([&](std::string_view key)
+    {
+        if (key == "type")
+            return scan.string(type);
+        if (key == "status")
+            return scan.string(status);
+        if (key == "result")
+            return scan.members(ledger);
+        return ledger(key);
+    });
+    if (!ok || (type != "ledgerClosed" && status != "success") || seq <= 0 || close_time <= 0 ||
+        seq > std::numeric_limits<int>::max() || close_time > std::numeric_limits<int>::max())
+        return {0, 0};
+    return {static_cast<int>(seq), static_cast<int>(close_time)};
+}
+
+// The cache and the samples outlive the searches of the pool, which the pool
+// finishes when it is destroyed, and the follower, which is stopped first.
+struct ledger_resolver::impl
+{
+    // A ledger is validated every 3 to 4 seconds
+    static constexpr std::chrono::seconds follow_interval{3};
+
+    std::optional<sample_cache> cache;
+    close_time_samples samples;
+    unsigned probes;
+    std::function<void(std::function<void()>)> executor;
+    thread_pool pool;  // without threads if there is an executor
+    std::mutex mut;
+    std::condition_variable cv;
+    bool stopping = false;
+    unsigned submitted = 0;  // to executor and not done yet
+    std::thread follower;
+
+    explicit impl(resolver_options const& opts);
+    ~impl();
+    result find(date::sys_seconds target, bool trace);
+    void submit(std::function<void()> task);
+    void follow();
+
+private:
+    void follow_stream(std::string const& url);
+    bool stopped();
+    bool wait(std::chrono::milliseconds d);
+};
+
+ledger_resolver::impl::impl(resolver_options const& opts)
+    : cache{opts.cache_path.empty() ? std::nullopt
+                                    : std::optional<sample_cache>{std::in_place, opts.cache_path}}
+    , samples{cache ? &*cache : nullptr}
+    , probes{std::clamp(opts.probes, 1u, max_concurrent_probes)}
+    , executor{opts.executor}
+    , pool{executor ? 0u : std::max(opts.threads, 1u)}
+{
+}
+
+// The pool runs the tasks left to it as it is destroyed, after this
+ledger_resolver::impl::~impl()
+{
+    std::unique_lock<std::mutex> lock{mut};
+    stopping = true;
+    cv.notify_all();
+    cv.wait(lock, [this] {return submitted == 0;});
+    lock.unlock();
+    if (follower.joinable())
+        follower.join();
+}
+
+void
+ledger_resolver::impl::submit(std::function<void()> task)
+{
+    if (!executor)
+    {
+        pool.submit(std::move(task));
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock{mut};
+        ++submitted;
+    }
+    executor([this, task = std::move(task)]
+    {
+        task();
+        std::lock_guard<std::mutex> lock{mut};
+        if (--submitted == 0)
+            cv.notify_all();
+    });
+}
+
+bool
+ledger_resolver::impl::stopped()
+{
+    std::lock_guard<std::mutex> lock{mut};
+    return stopping;
+}
+
+// Wait for d, or less if the resolver is stopping.  Returns true if it is.
+bool
+ledger_resolver::impl::wait(std::chrono::milliseconds d)
+{
+    std::unique_lock<std::mutex> lock{mut};
+    return cv.wait_for(lock, d, [this] {return stopping;});
+}
+
+// Add each ledger validated from now on to the samples, until the resolver is
+// stopped: from the "ledger" stream of the first WebSocket endpoint if there
+// is one, else by asking for the last validated ledger every follow_interval.
+// Ledgers the servers validate in between are left to be probed if a search
+// needs them.
+void
+ledger_resolver::impl::follow()
+{
+    auto& endpoints = endpoint_set::instance();
+    std::string ws_url;
+    for (std::size_t i = 0; i < endpoints.size() && ws_url.empty(); ++i)
+        if (is_ws_url(endpoints.url(i)))
+            ws_url = endpoints.url(i);
+    do
+    {
+        if (!ws_url.empty())
+            follow_stream(ws_url);  // until the connection fails
+        else if (auto [seq, close_time] = get_last_validated_close_time(); seq != 0)
+            samples.insert(seq, close_time);
+    } while (!wait(follow_interval));
+}
+
+// The connection is one of its own: the messages of a stream answer no request
+void
+ledger_resolver::impl::follow_stream(std::string const& url)
+{
+    Json::Value params = Json::objectValue;
+    params["streams"].append("ledger");
+    ws_connection ws{url};
+    if (!ws.open() || ws.send(make_query("subscribe", params)) == 0)
+    {
+        std::cerr << "Unable to subscribe to the ledgers validated by " << url << '\n';
+        return;
+    }
+    while (!stopped())
+    {
+        pollfd fd{ws.socket(), POLLIN, 0};
+        if (::poll(&fd, 1, 250) < 0 && errno != EINTR)
+            return;
+        bool ok = ws.receive([this](unsigned, std::string& message)
+        {
+            if (auto [seq, close_time] = extract_validated_ledger(message); seq != 0)
+                samples.insert(seq, close_time);
+        });
+        if (!ok)
+        {
+            std::cerr << "Lost the ledger stream of " << url << '\n';
+            return;
+        }
+    }
+}
+
+// A search needs a sample closed after target to start from: without one, the
+// last validated ledger is fetched
+ledger_resolver::result
+ledger_resolver::impl::find(date::sys_seconds target, bool trace)
+{
+    auto t = target - epoch;
+    auto [lo, hi] = samples.bracket(static_cast<int>(t.count()));
+    if (!hi && !(lo && lo->close_time == t.count()))
+    {
+        auto [seq, close_time] = get_last_validated_close_time();
+        if (seq == 0)
+            return {0, 0};
+        samples.insert(seq, close_time);
+    }
+    return search(t, samples, probes, trace);
+}
+
+ledger_resolver::ledger_resolver(resolver_options const& opts)
+    : impl_{std::make_unique<impl>(opts)}
+{
+}
+
+ledger_resolver::~ledger_resolver() = default;
+
+ledger_resolver::result
+ledger_resolver::find_ledger_by_close_time(date::sys_seconds target, bool trace)
+{
+    return impl_->find(target, trace);
+}
+
+std::future<ledger_resolver::result>
+ledger_resolver::async_find_ledger_by_close_time(date::sys_seconds target)
+{
+    auto task = std::make_shared<std::packaged_task<result()>>(
+        [impl = impl_.get(), target] {return impl->find(target, false);});
+    auto found = task->get_future();
+    impl_->submit([task] {(*task)();});
+    return found;
+}
+
+void
+ledger_resolver::async_find_ledger_by_close_time(date::sys_seconds target,
+                                                 std::function<void(result)> done)
+{
+    impl_->submit([impl = impl_.get(), target, done = std::move(done)]
+    {
+        done(impl->find(target, false));
+    });
+}
+
+void
+ledger_resolver::follow_validated_ledgers()
+{
+    if (!impl_->follower.joinable())
+        impl_->follower = std::thread{[impl = impl_.get()] {impl->follow();}};
+}
+
+void
+ledger_resolver::insert(int ledger_seq, int close_time)
+{
+    impl_->samples.insert(ledger_seq, close_time);
+}
+
+std::size_t
+ledger_resolver::size() const
+{
+    return impl_->samples.size();
+}
@@ -0,0 +1,168 @@
+#ifndef GETLEDGER_H
+#define GETLEDGER_H
+
+// The library behind the ledger program: queries to XRP Ledger servers, the
+// search for the ledger closed at a given time, and ledger downloads.
+// The build script makes libgetledger.a of getledger.cpp and json/*.cpp: link
+// it, and libcurl, with the program.
+//
+// All queries share one process-wide pool of connections and the health of
+// the endpoints, whichever thread makes them: any number of threads may query
+// at the same time.  A ledger_resolver runs many searches at once on threads
+// of its own or of an executor, and answers each with a future, a callback,
+// or, when compiled as C++20, by resuming a coroutine.
+
+#include "../date/include/date/date.h"
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <json/json.h>
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#define GETLEDGER_COROUTINES 1
+#endif
+
+// The endpoint queried by default
+extern const char s2_url[];
+
+// Query these servers from now on.  With several, each query goes to the
+// fastest, and is hedged on another one when slow.  Queries to a ws:// or
+// wss:// URL are pipelined on one WebSocket connection.  By default s2_url,
+// the S2 cluster of full history XRP Ledger nodes, is queried.
+void set_endpoints(std::vector<std::string> const& urls);
+
+// Execute a query.  On success reply holds the whole document.  If the server
+// reported a failure, reply holds its "result".
+bool do_query(std::string const& method, Json::Value const& params, Json::Value& reply);
+
+// Execute one query per element of params concurrently, with the same method.
+// replies[i] and the i-th element of the returned vector are what do_query
+// would have produced for params[i].
+std::vector<bool> do_queries(std::string const& method, std::vector<Json::Value> const& params,
+                             std::vector<Json::Value>& replies);
+
+// Get the header of a ledger given its sequence number
+bool getHeader (unsigned ledger_seq, Json::Value& header);
+
+// {sequence number, close time} of the last validated ledger, {0, 0} on failure.
+// Close times are in seconds since the XRP Ledger epoch, 2000-01-01.
+std::pair<int, int> get_last_validated_close_time();
+
+// The close time of a ledger, and of several at once.  Failures are reported as 0.
+int get_close_time(unsigned ledger_seq);
+std::vector<int> get_close_times(std::vector<unsigned> const& ledger_seqs);
+
+// Write ledger ledger_seq to path, in JSON, compact or pretty, or else in CBOR,
+// as rippled sends a ledger with its accounts expanded.  The state is written
+// as it downloads, ranges ranges of keys at the same time.
+bool download_ledger(unsigned ledger_seq, std::string const& path, unsigned ranges,
+                     bool cbor, bool compact);
+
+// Time and count queries, parses and searches from now on
+void enable_run_stats();
+
+// What was recorded since enable_run_stats(), as documented for --stats
+Json::Value run_stats_report();
+
+struct resolver_options
+{
+    std::string cache_path;   // keep close time samples in this file across runs
+    unsigned probes = 1;      // ledgers probed at the same time in each search round, up to 8
+    unsigned threads = 4;     // searches run at the same time
+
+    // If set, the searches started by async_find_ledger_by_close_time are given
+    // to executor to run, on threads of the caller, rather than run on threads
+    // of the resolver.  The resolver waits for them as it is destroyed, so that
+    // must not happen on a thread the executor needs to run them.
+    std::function<void(std::function<void()>)> executor;
+};
+
+// Finds the ledgers closed at given times.  Every search is bracketed by the
+// samples that the searches before it fetched, whatever thread made them.
+class ledger_resolver
+{
+public:
+    using result = std::pair<int, int>;  // {sequence number, close time}, {0, 0} on failure
+
+    explicit ledger_resolver(resolver_options const& opts = resolver_options{});
+    ledger_resolver(ledger_resolver const&) = delete;
+    ledger_resolver& operator=(ledger_resolver const&) = delete;
+    ~ledger_resolver();  // finishes the searches submitted first
+
+    // Find the ledger that closed at target, or the closest one the search
+    // settles on, on this thread.  If trace is true, each probe is printed to
+    // std::cout as it is made.
+    result find_ledger_by_close_time(date::sys_seconds target, bool trace = false);
+
+    // Start the same search on a thread of the resolver, or of the executor
+    std::future<result> async_find_ledger_by_close_time(date::sys_seconds target);
+    // done is called on that thread
+    void async_find_ledger_by_close_time(date::sys_seconds target,
+                                         std::function<void(result)> done);
+
+#ifdef GETLEDGER_COROUTINES
+    class awaiter;
+    // co_await it to search without blocking the coroutine's thread.  The
+    // coroutine resumes on a thread of the resolver, or of the executor.
+    awaiter co_find_ledger_by_close_time(date::sys_seconds target);
+#endif
+
+    // From now on, add each ledger the servers validate to the samples, on a
+    // thread of the resolver: searches for recent times then find them
+    // bracketed, without a query if the ledgers on both sides are known.
+    // With a ws:// or wss:// endpoint, the resolver subscribes to its stream
+    // of ledgers, else it asks for the last validated ledger every few seconds.
+    void follow_validated_ledgers();
+
+    // Add a sample known from elsewhere, such as the last validated ledger
+    void insert(int ledger_seq, int close_time);
+
+    // The number of samples fetched or read from the cache so far
+    std::size_t size() const;
+
+private:
+    struct impl;
+    std::unique_ptr<impl> impl_;
+};
+
+#ifdef GETLEDGER_COROUTINES
+class ledger_resolver::awaiter
+{
+    ledger_resolver& resolver_;
+    date::sys_seconds target_;
+    result found_{0, 0};
+
+public:
+    awaiter(ledger_resolver& resolver, date::sys_seconds target)
+        : resolver_{resolver}
+        , target_{target}
+    {
+    }
+
+    bool await_ready() const noexcept {return false;}
+
+    void await_suspend(std::coroutine_handle<> h)
+    {
+        resolver_.async_find_ledger_by_close_time(target_, [this, h](result r)
+        {
+            found_ = r;
+            h.resume();
+        });
+    }
+
+    result await_resume() const {return found_;}
+};
+
+inline
+ledger_resolver::awaiter
+ledger_resolver::co_find_ledger_by_close_time(date::sys_seconds target)
+{
+    return awaiter{*this, target};
+}
+#endif  // GETLEDGER_COROUTINES
+
+#endif  // GETLEDGER_H
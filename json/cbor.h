@@ -0,0 +1,166 @@
+#ifndef JSON_CBOR_H_INCLUDED
+# define JSON_CBOR_H_INCLUDED
+
+# include "reader.h"
+# include "value.h"
+# include "writer.h"
+# include <iosfwd>
+# include <string>
+# include <vector>
+
+namespace Json {
+
+   /** \brief Outputs a Value in <a HREF="https://www.rfc-editor.org/rfc/rfc8949">CBOR</a>, binary JSON.
+    *
+    * Values are walked as FastWriter walks them.  Integers are written as CBOR integers of their
+    * type, and doubles as the shortest CBOR float that holds them exactly, so that nothing goes
+    * through text.  Arrays and objects are written with their number of elements.
+    *
+    * Strings of upper case hex digits, 16 or more, are written as the bytes they spell, tagged
+    * 23 ("expected conversion to base16"), and strings that read as XRP Ledger addresses as the
+    * bytes of their base58, tagged 0x8058: these are most of the text of a ledger.  The text
+    * read back is the same: other strings stay text.
+    *
+    * An array or object whose encoding takes at least skipThreshold() bytes is wrapped as an
+    * "encoded CBOR data item" (tag 24 and a byte string), so that it follows its length in bytes:
+    * CborReader::skip() jumps over it without reading what is inside.
+    * \sa CborReader, FastWriter
+    */
+   class JSON_API CborWriter : public Writer
+   {
+   public:
+      CborWriter();
+      virtual ~CborWriter(){}
+
+      /// Wrap the containers whose encoding takes at least bytes bytes (default 64).
+      void setSkipThreshold( size_t bytes );
+      size_t skipThreshold() const;
+
+      /// Append the encoding of root to document.
+      void write( const Value &root, std::string &document );
+
+   public: // overridden from Writer
+      virtual std::string write( const Value &root );
+
+   private:
+      void writeValue( const Value &value, std::string &document );
+
+      size_t skipThreshold_;
+      std::string bytes_;
+      std::string check_;
+   };
+
+   /** \brief Writes a CBOR item to a stream a piece at a time, as StreamingWriter writes JSON.
+    *
+    * The containers opened with beginObject() and beginArray() do not know their number of
+    * elements: they are written with an indefinite length, and cannot be skipped in one step.
+    * The values given to value() are written by a CborWriter, so that those inside them can.
+    * \sa StreamingWriter, CborWriter
+    */
+   class JSON_API CborStreamingWriter
+   {
+   public:
+      CborStreamingWriter( std::ostream &out );
+
+      void beginObject();
+      void beginArray();
+      /// The name of the next member of the innermost container, an object.
+      void name( const std::string &name );
+      void value( const Value &value );
+      void end();
+
+   private:
+      std::ostream *out_;
+      CborWriter writer_;
+      std::vector<bool> containers_; // isArray, from the outermost
+      std::string buffer_;
+   };
+
+   /** \brief Reads a Value from its <a HREF="https://www.rfc-editor.org/rfc/rfc8949">CBOR</a> encoding.
+    *
+    * The Value read is the one Reader reads from the FastWriter text of what was written, except
+    * that doubles keep every bit.  Integers become an #intValue if they fit in an Int, a
+    * #uintValue if they only fit in a UInt64.
+    *
+    * Any CBOR that maps to JSON is read, whoever wrote it: items of indefinite length, floats of
+    * any size and tags are accepted, and "encoded CBOR data items" are read in place.  Byte
+    * strings tagged as CborWriter tags them are read as the text they stand for.  Other byte
+    * strings, undefined and simple values are errors, as are map keys that are not text.
+    * \sa CborWriter
+    */
+   class JSON_API CborReader
+   {
+   public:
+      /// What an error found while reading is about.
+      enum ErrorCode
+      {
+         errorUnexpectedEnd = 0,     ///< The input ends in the middle of an item.
+         errorUnsupportedItem,       ///< An item that has no JSON equivalent.
+         errorBadKey,                ///< A map key that is not a text string.
+         errorBadLength,             ///< A length that is reserved, or runs past the input.
+         errorBadEncodedItem,        ///< An encoded data item that is not exactly one item.
+         errorTooDeep,               ///< Containers nested more than maxDepth deep.
+         errorExtraData,             ///< Something after the item.
+         errorStopped,               ///< The ParseHandler stopped the read.
+         errorCodeCount
+      };
+
+      /// Nesting of arrays and objects beyond which the input is rejected.
+      enum { maxDepth = 1000 };
+
+      CborReader();
+
+      /** \brief Read the item in [begin, end) into root.
+       * \return \c true if [begin, end) is exactly one item that maps to JSON.
+       */
+      bool parse( const char *begin, const char *end, Value &root );
+
+      /** \brief Read the item in [begin, end) into root, allocating its strings, member names
+       * and containers from arena, as Reader::parse() does.
+       * root must be destroyed or reassigned before arena is.
+       */
+      bool parse( const char *begin, const char *end, Value &root, ValueArena &arena );
+
+      /** \brief Report the item in [begin, end) to handler, as StreamParser reports its JSON text.
+       */
+      bool parse( const char *begin, const char *end, ParseHandler &handler );
+
+      /** \brief Find the end of the item that starts at begin.
+       *
+       * A container wrapped by CborWriter is jumped over in one step.
+       * \return The end of the item, or NULL if it is malformed or runs past end.
+       */
+      static const char *skip( const char *begin, const char *end );
+
+      /// A user friendly description of the error, located by its offset in bytes.
+      std::string getFormatedErrorMessages() const;
+
+      ErrorCode errorCode() const;
+      size_t errorOffset() const;
+      static const char *getErrorMessage( ErrorCode code );
+
+   private:
+      bool parse( const char *begin, const char *end, Value &root, ValueArena *arena );
+      bool readValue( Value &value, unsigned depth );
+      bool readItem( ParseHandler &handler, unsigned depth );
+      bool readText( unsigned major, unsigned info, UInt64 length, UInt64 tag,
+                     const char *&textBegin, const char *&textEnd );
+      bool readHead( unsigned &major, unsigned &info, UInt64 &argument );
+      bool readString( std::string &text, unsigned major, unsigned info, UInt64 length );
+      bool readFloat( unsigned info, UInt64 bits, double &value );
+      bool addError( ErrorCode code, const char *at );
+      static const char *skipItem( const char *current, const char *end, unsigned depth );
+
+      const char *begin_;
+      const char *end_;
+      const char *current_;
+      ValueArena *arena_;
+      std::string text_;
+      ErrorCode error_;
+      size_t errorOffset_;
+      bool failed_;
+   };
+
+} // namespace Json
+
+#endif // JSON_CBOR_H_INCLUDED
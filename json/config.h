@@ -9,6 +9,10 @@
 /// If defined, indicates that cpptl vector based map should be used instead of std::map
 /// as Value container.
 //#  define JSON_USE_CPPTL_SMALLMAP 1
+/// If defined, indicates that std::map should be used instead of the insertion
+/// ordered hash map (Value::ObjectMap) as Value container. Members are then
+/// iterated in key order.
+//#  define JSON_VALUE_USE_STD_MAP 1
 /// If defined, indicates that Json specific container should be used
 /// (hash table & simple deque container with customizable allocator).
 /// THIS FEATURE IS STILL EXPERIMENTAL!
@@ -23,6 +27,10 @@
 /// instead of C assert macro.
 # define JSON_USE_EXCEPTION 1
 
+/// If defined, the memory allocated for values (strings, containers and the blocks of arenas)
+/// is counted and reported by Json::allocationStats(). Otherwise no counting code is compiled.
+//#  define JSON_COUNT_ALLOCATIONS 1
+
 # ifdef JSON_IN_CPPTL
 #  include <cpptl/config.h>
 #  ifndef JSON_USE_CPPTL
@@ -22,6 +22,7 @@ namespace Json {
       /** \brief A configuration that is strictly compatible with the JSON specification.
        * - Comments are forbidden.
        * - Root object must be either an array or an object value.
+       * - Parsing stops at the first error.
        * - Assumes Value strings are encoded in UTF-8
        */
       static Features strictMode();
@@ -35,6 +36,11 @@ namespace Json {
 
       /// \c true if root must be either an array or an object value. Default: \c false.
       bool strictRoot_;
+
+      /// \c true to stop at the first error instead of skipping to the end of
+      /// the container it is in, looking for more.  Default: \c false.
+      /// Documents without comments are always read this way, as is a stream.
+      bool failFast_;
    };
 
 } // namespace Json
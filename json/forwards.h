@@ -8,6 +8,7 @@ namespace Json {
    // writer.h
    class FastWriter;
    class StyledWriter;
+   class StreamingWriter;
 
    // reader.h
    class Reader;
@@ -18,7 +19,10 @@ namespace Json {
    // value.h
    typedef int Int;
    typedef unsigned int UInt;
+   typedef long long int Int64;
+   typedef unsigned long long int UInt64;
    class StaticString;
+   class ValueArena;
    class Path;
    class PathArgument;
    class Value;
@@ -5,5 +5,6 @@
 # include "reader.h"
 # include "writer.h"
 # include "features.h"
+# include "cbor.h"
 
 #endif // JSON_JSON_H_INCLUDED
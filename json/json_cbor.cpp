@@ -0,0 +1,1080 @@
+#include "cbor.h"
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+#include <limits>
+#include <ostream>
+#include <sstream>
+
+namespace Json {
+
+// Major types of CBOR items
+enum
+{
+   majorUnsigned = 0,
+   majorNegative,
+   majorBytes,
+   majorText,
+   majorArray,
+   majorMap,
+   majorTag,
+   majorSimple
+};
+
+// Additional information of the initial byte of an item
+enum
+{
+   infoOneByte = 24,
+   infoTwoBytes,
+   infoFourBytes,
+   infoEightBytes,
+   infoIndefinite = 31
+};
+
+// Simple values and floats, of majorSimple
+enum
+{
+   simpleFalse = 20,
+   simpleTrue,
+   simpleNull,
+   simpleUndefined,
+   simpleHalf = 25,
+   simpleSingle,
+   simpleDouble,
+   simpleBreak = 31
+};
+
+// Tags of byte strings that stand for text: hex digits, and the base58 of XRP
+// Ledger addresses.  tagBase16 is the standard "expected conversion to base16"
+// tag, tagRippleBase58 one of the first come first served range.
+static const unsigned tagBase16 = 23;
+static const unsigned tagEncodedItem = 24;
+static const unsigned tagRippleBase58 = 0x8058;
+static const char ripple58[] = "rpshnaf39wBUDNEGHJKLM4PQRST7VWXYZ2bcdeCg65jkm8oFqi1tuvAxyz";
+static const unsigned char breakByte = majorSimple << 5 | simpleBreak;
+
+
+static void
+appendHead( std::string &document, unsigned major, UInt64 argument )
+{
+   char head[9];
+   unsigned size;
+   unsigned char initial = static_cast<unsigned char>( major << 5 );
+   if ( argument < infoOneByte )
+   {
+      document += static_cast<char>( initial | argument );
+      return;
+   }
+   if ( argument <= 0xff )
+   {
+      size = 1;
+      initial |= infoOneByte;
+   }
+   else if ( argument <= 0xffff )
+   {
+      size = 2;
+      initial |= infoTwoBytes;
+   }
+   else if ( argument <= 0xffffffffu )
+   {
+      size = 4;
+      initial |= infoFourBytes;
+   }
+   else
+   {
+      size = 8;
+      initial |= infoEightBytes;
+   }
+   head[0] = static_cast<char>( initial );
+   for ( unsigned index = 0; index < size; ++index )
+      head[1 + index] = static_cast<char>( argument >> ( 8 * ( size - 1 - index ) ) );
+   document.append( head, 1 + size );
+}
+
+
+static void
+appendText( std::string &document, const char *text )
+{
+   size_t length = strlen( text );
+   appendHead( document, majorText, length );
+   document.append( text, length );
+}
+
+
+static int
+hexDigit( char c )
+{
+   if ( c >= '0'  &&  c <= '9' )
+      return c - '0';
+   if ( c >= 'A'  &&  c <= 'F' )
+      return c - 'A' + 10;
+   return -1;
+}
+
+
+static int
+ripple58Digit( char c )
+{
+   struct Digits
+   {
+      signed char of_[256];
+
+      Digits()
+      {
+         memset( of_, -1, sizeof(of_) );
+         for ( int digit = 0; digit < 58; ++digit )
+            of_[static_cast<unsigned char>( ripple58[digit] )] = static_cast<signed char>( digit );
+      }
+   };
+   static const Digits digits;
+   return digits.of_[static_cast<unsigned char>( c )];
+}
+
+
+// Upper case hex of at least 8 bytes, the digits of hashes, keys and blobs
+static bool
+decodeBase16( const char *text, size_t length, std::string &bytes )
+{
+   if ( length < 16  ||  length % 2 != 0 )
+      return false;
+   bytes.clear();
+   for ( size_t index = 0; index < length; index += 2 )
+   {
+      int high = hexDigit( text[index] );
+      int low = hexDigit( text[index + 1] );
+      if ( high < 0  ||  low < 0 )
+         return false;
+      bytes += static_cast<char>( high << 4 | low );
+   }
+   return true;
+}
+
+
+static void
+encodeBase16( const char *bytes, size_t length, std::string &text )
+{
+   static const char digits[] = "0123456789ABCDEF";
+   text.resize( 2 * length );
+   for ( size_t index = 0; index < length; ++index )
+   {
+      unsigned char byte = static_cast<unsigned char>( bytes[index] );
+      text[2 * index] = digits[byte >> 4];
+      text[2 * index + 1] = digits[byte & 0xf];
+   }
+}
+
+
+// Each leading zero byte is a leading 'r', and the other bytes are the
+// big-endian number the other digits spell.  Addresses are short: the bytes
+// are at most 26.  The number is worked on in limbs of five digits, or of four
+// bytes.
+enum { maxRipple58Bytes = 26, maxLimbs = 8 };
+static const UInt limb58 = 58u * 58 * 58 * 58 * 58;
+
+static void
+encodeRipple58( const char *bytes, size_t length, std::string &text )
+{
+   UInt limbs[maxLimbs]; // of five digits, least significant first
+   size_t count = 0;
+   size_t zeros = 0;
+   while ( zeros < length  &&  bytes[zeros] == 0 )
+      ++zeros;
+   for ( size_t index = zeros; index < length; )
+   {
+      UInt64 carry = 0;
+      unsigned shift = 0;
+      for ( ; index < length  &&  shift < 32; ++index, shift += 8 )
+         carry = carry << 8 | static_cast<unsigned char>( bytes[index] );
+      for ( size_t limb = 0; limb < count; ++limb )
+      {
+         carry += UInt64( limbs[limb] ) << shift;
+         limbs[limb] = static_cast<UInt>( carry % limb58 );
+         carry /= limb58;
+      }
+      for ( ; carry  &&  count < maxLimbs; carry /= limb58 )
+         limbs[count++] = static_cast<UInt>( carry % limb58 );
+   }
+   text.assign( zeros, ripple58[0] );
+   char digits[5 * maxLimbs];
+   size_t digit = sizeof(digits);
+   for ( size_t limb = 0; limb < count; ++limb )
+   {
+      UInt value = limbs[limb];
+      for ( int place = 0; place < 5  &&  ( value  ||  limb + 1 < count ); ++place, value /= 58 )
+         digits[--digit] = ripple58[value % 58];
+   }
+   text.append( digits + digit, sizeof(digits) - digit );
+}
+
+
+// An XRP Ledger address, or anything else of its alphabet and length that
+// encodes back to the same text
+static bool
+decodeRipple58( const char *text, size_t length, std::string &bytes, std::string &check )
+{
+   if ( length < 25  ||  length > 35  ||  text[0] != ripple58[0] )
+      return false;
+   UInt limbs[maxLimbs]; // of four bytes, least significant first
+   size_t count = 0;
+   size_t zeros = 0;
+   while ( zeros < length  &&  text[zeros] == ripple58[0] )
+      ++zeros;
+   for ( size_t index = zeros; index < length; )
+   {
+      UInt64 carry = 0;
+      UInt scale = 1;
+      for ( ; index < length  &&  scale < limb58; ++index, scale *= 58 )
+      {
+         int digit = ripple58Digit( text[index] );
+         if ( digit < 0 )
+            return false;
+         carry = carry * 58 + static_cast<unsigned>( digit );
+      }
+      for ( size_t limb = 0; limb < count; ++limb )
+      {
+         carry += UInt64( limbs[limb] ) * scale;
+         limbs[limb] = static_cast<UInt>( carry );
+         carry >>= 32;
+      }
+      if ( carry )
+      {
+         if ( count == maxLimbs )
+            return false;
+         limbs[count++] = static_cast<UInt>( carry );
+      }
+   }
+   bytes.assign( zeros, '\0' );
+   bool leading = true;
+   for ( size_t limb = count; limb-- > 0; )
+      for ( int shift = 24; shift >= 0; shift -= 8 )
+      {
+         char byte = static_cast<char>( limbs[limb] >> shift );
+         if ( leading  &&  byte == 0 )
+            continue;
+         leading = false;
+         bytes += byte;
+      }
+   if ( bytes.size() > maxRipple58Bytes )
+      return false;
+   encodeRipple58( bytes.data(), bytes.size(), check );
+   return check.size() == length  &&  memcmp( check.data(), text, length ) == 0;
+}
+
+
+// Hex digits and addresses are written as the bytes they stand for, tagged
+// with how to turn them back into the same text.
+static void
+appendString( std::string &document, const char *text, std::string &bytes, std::string &check )
+{
+   size_t length = strlen( text );
+   unsigned tag;
+   if ( decodeBase16( text, length, bytes ) )
+      tag = tagBase16;
+   else if ( decodeRipple58( text, length, bytes, check ) )
+      tag = tagRippleBase58;
+   else
+   {
+      appendHead( document, majorText, length );
+      document.append( text, length );
+      return;
+   }
+   appendHead( document, majorTag, tag );
+   appendHead( document, majorBytes, bytes.size() );
+   document += bytes;
+}
+
+
+static void
+appendDouble( std::string &document, double value )
+{
+   float single = static_cast<float>( value );
+   if ( static_cast<double>( single ) == value  ||  value != value )
+   {
+      UInt bits;
+      memcpy( &bits, &single, sizeof(bits) );
+      document += static_cast<char>( majorSimple << 5 | simpleSingle );
+      for ( int shift = 24; shift >= 0; shift -= 8 )
+         document += static_cast<char>( bits >> shift );
+   }
+   else
+   {
+      UInt64 bits;
+      memcpy( &bits, &value, sizeof(bits) );
+      document += static_cast<char>( majorSimple << 5 | simpleDouble );
+      for ( int shift = 56; shift >= 0; shift -= 8 )
+         document += static_cast<char>( bits >> shift );
+   }
+}
+
+
+// Class CborWriter
+// //////////////////////////////////////////////////////////////////
+
+CborWriter::CborWriter()
+   : skipThreshold_( 64 )
+{
+}
+
+
+void
+CborWriter::setSkipThreshold( size_t bytes )
+{
+   skipThreshold_ = bytes;
+}
+
+
+size_t
+CborWriter::skipThreshold() const
+{
+   return skipThreshold_;
+}
+
+
+std::string
+CborWriter::write( const Value &root )
+{
+   std::string document;
+   write( root, document );
+   return document;
+}
+
+
+void
+CborWriter::write( const Value &root, std::string &document )
+{
+   writeValue( root, document );
+}
+
+
+// A container is written first, and wrapped once its size is known: the
+// wrapping moves it once for each wrapped container around it.
+void
+CborWriter::writeValue( const Value &value, std::string &document )
+{
+   size_t start = document.size();
+   switch ( value.type() )
+   {
+   case nullValue:
+      document += static_cast<char>( majorSimple << 5 | simpleNull );
+      return;
+   case intValue:
+      {
+         Value::Int64 integer = value.asInt64();
+         if ( integer >= 0 )
+            appendHead( document, majorUnsigned, static_cast<UInt64>( integer ) );
+         else
+            appendHead( document, majorNegative, static_cast<UInt64>( -1 - integer ) );
+      }
+      return;
+   case uintValue:
+      appendHead( document, majorUnsigned, value.asUInt64() );
+      return;
+   case realValue:
+      appendDouble( document, value.asDouble() );
+      return;
+   case stringValue:
+      appendString( document, value.asCString(), bytes_, check_ );
+      return;
+   case booleanValue:
+      document += static_cast<char>( majorSimple << 5 | ( value.asBool() ? simpleTrue : simpleFalse ) );
+      return;
+   case arrayValue:
+      {
+         Value::UInt size = value.size();
+         appendHead( document, majorArray, size );
+         // Elements never assigned are not stored, and are written as null
+         Value::UInt index = 0;
+         for ( Value::const_iterator it = value.begin(); it != value.end(); ++it, ++index )
+         {
+            for ( ; index < it.index(); ++index )
+               document += static_cast<char>( majorSimple << 5 | simpleNull );
+            writeValue( *it, document );
+         }
+         for ( ; index < size; ++index )
+            document += static_cast<char>( majorSimple << 5 | simpleNull );
+      }
+      break;
+   case objectValue:
+      appendHead( document, majorMap, value.size() );
+      for ( Value::const_iterator it = value.begin(); it != value.end(); ++it )
+      {
+         appendText( document, it.memberName() );
+         writeValue( *it, document );
+      }
+      break;
+   }
+   size_t length = document.size() - start;
+   if ( length == 1  ||  length < skipThreshold_ )
+      return;
+   std::string wrapper;
+   appendHead( wrapper, majorTag, tagEncodedItem );
+   appendHead( wrapper, majorBytes, length );
+   document.insert( start, wrapper );
+}
+
+
+// Class CborStreamingWriter
+// //////////////////////////////////////////////////////////////////
+
+CborStreamingWriter::CborStreamingWriter( std::ostream &out )
+   : out_( &out )
+{
+}
+
+
+void
+CborStreamingWriter::beginObject()
+{
+   containers_.push_back( false );
+   *out_ << static_cast<char>( majorMap << 5 | infoIndefinite );
+}
+
+
+void
+CborStreamingWriter::beginArray()
+{
+   containers_.push_back( true );
+   *out_ << static_cast<char>( majorArray << 5 | infoIndefinite );
+}
+
+
+void
+CborStreamingWriter::name( const std::string &name )
+{
+   assert( !containers_.empty()  &&  !containers_.back() );
+   buffer_.clear();
+   appendHead( buffer_, majorText, name.size() );
+   buffer_ += name;
+   *out_ << buffer_;
+}
+
+
+void
+CborStreamingWriter::value( const Value &value )
+{
+   buffer_.clear();
+   writer_.write( value, buffer_ );
+   *out_ << buffer_;
+}
+
+
+void
+CborStreamingWriter::end()
+{
+   assert( !containers_.empty() );
+   containers_.pop_back();
+   *out_ << static_cast<char>( breakByte );
+}
+
+
+// Class CborReader
+// //////////////////////////////////////////////////////////////////
+
+static const char *errorMessages[CborReader::errorCodeCount] =
+{
+   "Unexpected end of input",
+   "Item without JSON equivalent",
+   "Map key is not a text string",
+   "Bad length",
+   "Encoded data item is not exactly one item",
+   "Containers nested too deep",
+   "Extra data after the item",
+   "Stopped by the handler"
+};
+
+
+CborReader::CborReader()
+   : begin_( 0 )
+   , end_( 0 )
+   , current_( 0 )
+   , arena_( 0 )
+   , error_( errorUnexpectedEnd )
+   , errorOffset_( 0 )
+   , failed_( false )
+{
+}
+
+
+bool
+CborReader::parse( const char *begin, const char *end, Value &root )
+{
+   return parse( begin, end, root, 0 );
+}
+
+
+bool
+CborReader::parse( const char *begin, const char *end, Value &root, ValueArena &arena )
+{
+   return parse( begin, end, root, &arena );
+}
+
+
+bool
+CborReader::parse( const char *begin, const char *end, Value &root, ValueArena *arena )
+{
+   begin_ = begin;
+   end_ = end;
+   current_ = begin;
+   arena_ = arena;
+   failed_ = false;
+   Value value;
+   bool ok = readValue( value, 0 );
+   arena_ = 0;
+   if ( !ok )
+      return false;
+   if ( current_ != end_ )
+      return addError( errorExtraData, current_ );
+   root = std::move( value );
+   return true;
+}
+
+
+bool
+CborReader::parse( const char *begin, const char *end, ParseHandler &handler )
+{
+   begin_ = begin;
+   end_ = end;
+   current_ = begin;
+   failed_ = false;
+   if ( !readItem( handler, 0 ) )
+      return false;
+   if ( current_ != end_ )
+      return addError( errorExtraData, current_ );
+   return true;
+}
+
+
+bool
+CborReader::addError( ErrorCode code, const char *at )
+{
+   if ( !failed_ )
+   {
+      failed_ = true;
+      error_ = code;
+      errorOffset_ = at - begin_;
+   }
+   return false;
+}
+
+
+bool
+CborReader::readHead( unsigned &major, unsigned &info, UInt64 &argument )
+{
+   const char *start = current_;
+   if ( current_ == end_ )
+      return addError( errorUnexpectedEnd, start );
+   unsigned char initial = static_cast<unsigned char>( *current_++ );
+   major = initial >> 5;
+   info = initial & 0x1f;
+   if ( info < infoOneByte  ||  info == infoIndefinite )
+   {
+      argument = info;
+      return true;
+   }
+   if ( info > infoEightBytes )
+      return addError( errorBadLength, start );
+   size_t size = size_t( 1 ) << ( info - infoOneByte );
+   if ( static_cast<size_t>( end_ - current_ ) < size )
+      return addError( errorUnexpectedEnd, start );
+   argument = 0;
+   for ( size_t index = 0; index < size; ++index )
+      argument = argument << 8 | static_cast<unsigned char>( *current_++ );
+   return true;
+}
+
+
+// A text string of indefinite length is a series of definite ones, and is
+// gathered in text.
+bool
+CborReader::readString( std::string &text, unsigned major, unsigned info, UInt64 length )
+{
+   const char *start = current_ - 1;
+   if ( info != infoIndefinite )
+   {
+      if ( static_cast<UInt64>( end_ - current_ ) < length )
+         return addError( errorBadLength, start );
+      text.assign( current_, static_cast<size_t>( length ) );
+      current_ += length;
+      return true;
+   }
+   text.clear();
+   for ( ;; )
+   {
+      unsigned chunkMajor, chunkInfo;
+      UInt64 chunkLength;
+      const char *chunk = current_;
+      if ( !readHead( chunkMajor, chunkInfo, chunkLength ) )
+         return false;
+      if ( chunkMajor == majorSimple  &&  chunkInfo == simpleBreak )
+         return true;
+      if ( chunkMajor != major  ||  chunkInfo == infoIndefinite )
+         return addError( errorBadLength, chunk );
+      if ( static_cast<UInt64>( end_ - current_ ) < chunkLength )
+         return addError( errorBadLength, chunk );
+      text.append( current_, static_cast<size_t>( chunkLength ) );
+      current_ += chunkLength;
+   }
+}
+
+
+bool
+CborReader::readFloat( unsigned info, UInt64 bits, double &value )
+{
+   if ( info == simpleDouble )
+   {
+      memcpy( &value, &bits, sizeof(value) );
+      return true;
+   }
+   if ( info == simpleSingle )
+   {
+      UInt single = static_cast<UInt>( bits );
+      float f;
+      memcpy( &f, &single, sizeof(f) );
+      value = f;
+      return true;
+   }
+   // Half precision: 1 sign bit, 5 exponent bits, 10 mantissa bits
+   unsigned exponent = ( bits >> 10 ) & 0x1f;
+   double mantissa = static_cast<double>( bits & 0x3ff );
+   if ( exponent == 0 )
+      value = ldexp( mantissa, -24 );
+   else if ( exponent == 0x1f )
+      value = mantissa == 0 ? std::numeric_limits<double>::infinity()
+                            : std::numeric_limits<double>::quiet_NaN();
+   else
+      value = ldexp( mantissa + 1024, int( exponent ) - 25 );
+   if ( bits & 0x8000 )
+      value = -value;
+   return true;
+}
+
+
+// The text of a text string, or of a byte string tagged as hex digits or an
+// address: [textBegin, textEnd) is in the input if it can be, else in text_.
+bool
+CborReader::readText( unsigned major, unsigned info, UInt64 length, UInt64 tag,
+                      const char *&textBegin, const char *&textEnd )
+{
+   const char *start = current_ - 1;
+   if ( major == majorBytes  &&  ( info == infoIndefinite
+                                   ||  ( tag != tagBase16  &&  tag != tagRippleBase58 )
+                                   ||  ( tag == tagRippleBase58  &&  length > maxRipple58Bytes ) ) )
+      return addError( errorUnsupportedItem, start );
+   if ( info == infoIndefinite )
+   {
+      if ( !readString( text_, major, info, length ) )
+         return false;
+      textBegin = text_.data();
+      textEnd = textBegin + text_.size();
+      return true;
+   }
+   if ( static_cast<UInt64>( end_ - current_ ) < length )
+      return addError( errorBadLength, start );
+   const char *bytes = current_;
+   current_ += length;
+   if ( major == majorText )
+   {
+      textBegin = bytes;
+      textEnd = current_;
+      return true;
+   }
+   if ( tag == tagBase16 )
+      encodeBase16( bytes, static_cast<size_t>( length ), text_ );
+   else
+      encodeRipple58( bytes, static_cast<size_t>( length ), text_ );
+   textBegin = text_.data();
+   textEnd = textBegin + text_.size();
+   return true;
+}
+
+
+static Value
+integerValue( unsigned major, UInt64 argument )
+{
+   if ( major == majorUnsigned )
+   {
+      if ( argument <= UInt( Value::maxInt ) )
+         return Value( Value::Int( argument ) );
+      return Value( argument );
+   }
+   if ( argument > UInt64( Value::maxInt64 ) )
+      return Value( -1.0 - double( argument ) );
+   Value::Int64 integer = -1 - Value::Int64( argument );
+   if ( integer >= Value::minInt )
+      return Value( Value::Int( integer ) );
+   return Value( integer );
+}
+
+
+// Builds the value directly rather than through a ValueBuilder: each string
+// is copied once, from the input when it can be, and with an arena, member
+// names and strings come from it.
+bool
+CborReader::readValue( Value &value, unsigned depth )
+{
+   const char *start = current_;
+   unsigned major, info;
+   UInt64 argument;
+   UInt64 tag = 0;
+   if ( !readHead( major, info, argument ) )
+      return false;
+   while ( major == majorTag )
+   {
+      if ( argument == tagEncodedItem )
+      {
+         const char *bytes = current_;
+         if ( !readHead( major, info, argument ) )
+            return false;
+         if ( major != majorBytes  ||  info == infoIndefinite )
+            return addError( errorBadEncodedItem, bytes );
+         if ( static_cast<UInt64>( end_ - current_ ) < argument )
+            return addError( errorBadLength, bytes );
+         const char *end = end_;
+         const char *itemEnd = current_ + argument;
+         end_ = itemEnd;
+         bool ok = readValue( value, depth );
+         end_ = end;
+         if ( !ok )
+            return false;
+         if ( current_ != itemEnd )
+            return addError( errorBadEncodedItem, bytes );
+         return true;
+      }
+      tag = argument;
+      start = current_;
+      if ( !readHead( major, info, argument ) )
+         return false;
+   }
+
+   bool indefinite = info == infoIndefinite;
+   if ( indefinite  &&  ( major == majorUnsigned  ||  major == majorNegative ) )
+      return addError( errorBadLength, start );
+   switch ( major )
+   {
+   case majorUnsigned:
+   case majorNegative:
+      value = integerValue( major, argument );
+      return true;
+   case majorBytes:
+   case majorText:
+      {
+         const char *textBegin, *textEnd;
+         if ( !readText( major, info, argument, tag, textBegin, textEnd ) )
+            return false;
+         if ( arena_ )
+            value = StaticString( arena_->duplicate( textBegin, textEnd - textBegin ) );
+         else
+            value = Value( textBegin, textEnd );
+         return true;
+      }
+   case majorArray:
+   case majorMap:
+      {
+         bool isMap = major == majorMap;
+         if ( depth == maxDepth )
+            return addError( errorTooDeep, start );
+         // Each element takes at least one byte
+         if ( !indefinite  &&  argument > static_cast<UInt64>( end_ - current_ ) )
+            return addError( errorBadLength, start );
+         ValueType type = isMap ? objectValue : arrayValue;
+         value = arena_ ? Value( type, *arena_ ) : Value( type );
+         for ( UInt64 index = 0; indefinite  ||  index < argument; ++index )
+         {
+            if ( indefinite )
+            {
+               if ( current_ == end_ )
+                  return addError( errorUnexpectedEnd, current_ );
+               if ( static_cast<unsigned char>( *current_ ) == breakByte )
+               {
+                  ++current_;
+                  break;
+               }
+            }
+            if ( !isMap )
+            {
+               if ( !readValue( value[Value::UInt( index )], depth + 1 ) )
+                  return false;
+               continue;
+            }
+            const char *key = current_;
+            unsigned keyMajor, keyInfo;
+            UInt64 keyLength;
+            const char *keyBegin, *keyEnd;
+            if ( !readHead( keyMajor, keyInfo, keyLength ) )
+               return false;
+            if ( keyMajor != majorText )
+               return addError( errorBadKey, key );
+            if ( !readText( keyMajor, keyInfo, keyLength, 0, keyBegin, keyEnd ) )
+               return false;
+            Value *member;
+            if ( arena_ )
+               member = &value.resolveArenaReference( arena_->duplicate( keyBegin, keyEnd - keyBegin ) );
+            else
+            {
+               if ( keyBegin != text_.data() )
+                  text_.assign( keyBegin, keyEnd );
+               member = &value[text_];
+            }
+            if ( !readValue( *member, depth + 1 ) )
+               return false;
+         }
+         return true;
+      }
+   case majorSimple:
+      switch ( info )
+      {
+      case simpleFalse:
+      case simpleTrue:
+         value = info == simpleTrue;
+         return true;
+      case simpleNull:
+         value = Value();
+         return true;
+      case simpleHalf:
+      case simpleSingle:
+      case simpleDouble:
+         {
+            double number;
+            readFloat( info, argument, number );
+            value = number;
+            return true;
+         }
+      default:
+         return addError( errorUnsupportedItem, start );
+      }
+   }
+   return addError( errorUnsupportedItem, start );
+}
+
+
+bool
+CborReader::readItem( ParseHandler &handler, unsigned depth )
+{
+   const char *start = current_;
+   unsigned major, info;
+   UInt64 argument;
+   UInt64 tag = 0;
+   if ( !readHead( major, info, argument ) )
+      return false;
+   while ( major == majorTag )
+   {
+      if ( argument == tagEncodedItem )
+      {
+         const char *bytes = current_;
+         if ( !readHead( major, info, argument ) )
+            return false;
+         if ( major != majorBytes  ||  info == infoIndefinite )
+            return addError( errorBadEncodedItem, bytes );
+         if ( static_cast<UInt64>( end_ - current_ ) < argument )
+            return addError( errorBadLength, bytes );
+         const char *end = end_;
+         const char *itemEnd = current_ + argument;
+         end_ = itemEnd;
+         bool ok = readItem( handler, depth );
+         end_ = end;
+         if ( !ok )
+            return false;
+         if ( current_ != itemEnd )
+            return addError( errorBadEncodedItem, bytes );
+         return true;
+      }
+      tag = argument;
+      start = current_;
+      if ( !readHead( major, info, argument ) )
+         return false;
+   }
+
+   bool indefinite = info == infoIndefinite;
+   if ( indefinite  &&  ( major == majorUnsigned  ||  major == majorNegative ) )
+      return addError( errorBadLength, start );
+   switch ( major )
+   {
+   case majorUnsigned:
+   case majorNegative:
+      return handler.number( integerValue( major, argument ) )  ||  addError( errorStopped, start );
+   case majorBytes:
+   case majorText:
+      {
+         const char *textBegin, *textEnd;
+         if ( !readText( major, info, argument, tag, textBegin, textEnd ) )
+            return false;
+         return handler.string( textBegin, textEnd )  ||  addError( errorStopped, start );
+      }
+   case majorArray:
+   case majorMap:
+      {
+         bool isMap = major == majorMap;
+         if ( depth == maxDepth )
+            return addError( errorTooDeep, start );
+         // Each element takes at least one byte
+         if ( !indefinite  &&  argument > static_cast<UInt64>( end_ - current_ ) )
+            return addError( errorBadLength, start );
+         if ( !( isMap ? handler.startObject() : handler.startArray() ) )
+            return addError( errorStopped, start );
+         for ( UInt64 index = 0; indefinite  ||  index < argument; ++index )
+         {
+            if ( indefinite )
+            {
+               if ( current_ == end_ )
+                  return addError( errorUnexpectedEnd, current_ );
+               if ( static_cast<unsigned char>( *current_ ) == breakByte )
+               {
+                  ++current_;
+                  break;
+               }
+            }
+            if ( isMap )
+            {
+               const char *key = current_;
+               unsigned keyMajor, keyInfo;
+               UInt64 keyLength;
+               if ( !readHead( keyMajor, keyInfo, keyLength ) )
+                  return false;
+               if ( keyMajor != majorText )
+                  return addError( errorBadKey, key );
+               const char *keyBegin, *keyEnd;
+               if ( !readText( keyMajor, keyInfo, keyLength, 0, keyBegin, keyEnd ) )
+                  return false;
+               if ( !handler.key( keyBegin, keyEnd ) )
+                  return addError( errorStopped, key );
+            }
+            if ( !readItem( handler, depth + 1 ) )
+               return false;
+         }
+         if ( !( isMap ? handler.endObject() : handler.endArray() ) )
+            return addError( errorStopped, start );
+         return true;
+      }
+   case majorSimple:
+      switch ( info )
+      {
+      case simpleFalse:
+      case simpleTrue:
+         return handler.boolean( info == simpleTrue )  ||  addError( errorStopped, start );
+      case simpleNull:
+         return handler.null()  ||  addError( errorStopped, start );
+      case simpleHalf:
+      case simpleSingle:
+      case simpleDouble:
+         {
+            double value;
+            readFloat( info, argument, value );
+            return handler.number( Value( value ) )  ||  addError( errorStopped, start );
+         }
+      default:
+         return addError( errorUnsupportedItem, start );
+      }
+   }
+   return addError( errorUnsupportedItem, start );
+}
+
+
+const char *
+CborReader::skip( const char *begin, const char *end )
+{
+   return skipItem( begin, end, 0 );
+}
+
+
+// Reads heads only: strings and wrapped containers are jumped over.
+const char *
+CborReader::skipItem( const char *current, const char *end, unsigned depth )
+{
+   CborReader reader;
+   reader.begin_ = current;
+   reader.current_ = current;
+   reader.end_ = end;
+   unsigned major, info;
+   UInt64 argument;
+   if ( !reader.readHead( major, info, argument ) )
+      return 0;
+   while ( major == majorTag )
+   {
+      if ( argument == tagEncodedItem )
+      {
+         if ( !reader.readHead( major, info, argument )
+              ||  major != majorBytes  ||  info == infoIndefinite
+              ||  static_cast<UInt64>( end - reader.current_ ) < argument )
+            return 0;
+         return reader.current_ + argument;
+      }
+      if ( !reader.readHead( major, info, argument ) )
+         return 0;
+   }
+   current = reader.current_;
+   bool indefinite = info == infoIndefinite;
+   switch ( major )
+   {
+   case majorBytes:
+   case majorText:
+      if ( indefinite )
+      {
+         while ( current != end  &&  static_cast<unsigned char>( *current ) != breakByte )
+         {
+            current = skipItem( current, end, depth );
+            if ( !current )
+               return 0;
+         }
+         return current == end ? 0 : current + 1;
+      }
+      if ( static_cast<UInt64>( end - current ) < argument )
+         return 0;
+      return current + argument;
+   case majorArray:
+   case majorMap:
+      {
+         if ( depth == maxDepth )
+            return 0;
+         UInt64 items = major == majorMap ? 2 * argument : argument;
+         for ( UInt64 index = 0; indefinite  ||  index < items; ++index )
+         {
+            if ( current == end )
+               return 0;
+            if ( indefinite  &&  static_cast<unsigned char>( *current ) == breakByte )
+               return current + 1;
+            current = skipItem( current, end, depth + 1 );
+            if ( !current )
+               return 0;
+         }
+         return current;
+      }
+   default:
+      return indefinite  &&  major != majorSimple ? 0 : current;
+   }
+}
+
+
+std::string
+CborReader::getFormatedErrorMessages() const
+{
+   if ( !failed_ )
+      return "";
+   std::ostringstream formatted;
+   formatted << "* Byte " << errorOffset_ << ": " << getErrorMessage( error_ ) << "\n";
+   return formatted.str();
+}
+
+
+CborReader::ErrorCode
+CborReader::errorCode() const
+{
+   return error_;
+}
+
+
+size_t
+CborReader::errorOffset() const
+{
+   return errorOffset_;
+}
+
+
+const char *
+CborReader::getErrorMessage( ErrorCode code )
+{
+   assert( code < errorCodeCount );
+   return errorMessages[code];
+}
+
+
+} // namespace Json
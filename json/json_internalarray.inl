@@ -275,6 +275,17 @@ ValueInternalArray::ValueInternalArray( const ValueInternalArray &other )
 }
 
 
+ValueInternalArray::ValueInternalArray( ValueInternalArray &&other ) noexcept
+   : pages_( other.pages_ )
+   , size_( other.size_ )
+   , pageCount_( other.pageCount_ )
+{
+   other.pages_ = 0;
+   other.size_ = 0;
+   other.pageCount_ = 0;
+}
+
+
 ValueInternalArray &
 ValueInternalArray::operator =( const ValueInternalArray &other )
 {
@@ -284,6 +295,15 @@ ValueInternalArray::operator =( const ValueInternalArray &other )
 }
 
 
+ValueInternalArray &
+ValueInternalArray::operator =( ValueInternalArray &&other ) noexcept
+{
+   ValueInternalArray temp( std::move( other ) );
+   swap( temp );
+   return *this;
+}
+
+
 ValueInternalArray::~ValueInternalArray()
 {
    // destroy all constructed items
@@ -189,6 +189,19 @@ ValueInternalMap::ValueInternalMap( const ValueInternalMap &other )
 }
 
 
+ValueInternalMap::ValueInternalMap( ValueInternalMap &&other ) noexcept
+   : buckets_( other.buckets_ )
+   , tailLink_( other.tailLink_ )
+   , bucketsSize_( other.bucketsSize_ )
+   , itemCount_( other.itemCount_ )
+{
+   other.buckets_ = 0;
+   other.tailLink_ = 0;
+   other.bucketsSize_ = 0;
+   other.itemCount_ = 0;
+}
+
+
 ValueInternalMap &
 ValueInternalMap::operator =( const ValueInternalMap &other )
 {
@@ -198,6 +211,15 @@ ValueInternalMap::operator =( const ValueInternalMap &other )
 }
 
 
+ValueInternalMap &
+ValueInternalMap::operator =( ValueInternalMap &&other ) noexcept
+{
+   ValueInternalMap dummy( std::move( other ) );
+   swap( dummy );
+   return *this;
+}
+
+
 ValueInternalMap::~ValueInternalMap()
 {
    if ( buckets_ )
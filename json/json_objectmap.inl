@@ -0,0 +1,353 @@
+// included by json_value.cpp
+// everything is within Json namespace
+
+// //////////////////////////////////////////////////////////////////
+// //////////////////////////////////////////////////////////////////
+// //////////////////////////////////////////////////////////////////
+// class Value::ObjectMap
+// //////////////////////////////////////////////////////////////////
+// //////////////////////////////////////////////////////////////////
+// //////////////////////////////////////////////////////////////////
+
+Value::ObjectMap::ObjectMap( std::pmr::memory_resource *resource )
+   : entries_( resource )
+   , slots_( resource )
+{
+}
+
+
+Value::ObjectMap &
+Value::ObjectMap::operator =( const ObjectMap &other )
+{
+   if ( this == &other )
+      return *this;
+   clear();
+   entries_.reserve( other.entries_.size() );
+   for ( const value_type *entry : other.entries_ )
+      entries_.push_back( newEntry( *entry ) );
+   slots_ = other.slots_;
+   return *this;
+}
+
+
+Value::ObjectMap::~ObjectMap()
+{
+   clear();
+}
+
+
+void
+Value::ObjectMap::clear()
+{
+   for ( value_type *entry : entries_ )
+      deleteEntry( entry );
+   entries_.clear();
+   slots_.clear();
+}
+
+
+Value::ObjectMap::iterator
+Value::ObjectMap::find( const CZString &key )
+{
+   return begin() + findPosition( key );
+}
+
+
+Value::ObjectMap::const_iterator
+Value::ObjectMap::find( const CZString &key ) const
+{
+   return begin() + findPosition( key );
+}
+
+
+Value::ObjectMap::const_iterator
+Value::ObjectMap::find( const StaticKey &key ) const
+{
+   return begin() + findMember( key.c_str(), key.hash() );
+}
+
+
+std::pair<Value::ObjectMap::iterator, bool>
+Value::ObjectMap::try_emplace( const CZString &key )
+{
+   return emplace( key );
+}
+
+
+std::pair<Value::ObjectMap::iterator, bool>
+Value::ObjectMap::try_emplace( CZString &&key )
+{
+   return emplace( std::move( key ) );
+}
+
+
+// The member name is not duplicated, as with a StaticString.
+std::pair<Value::ObjectMap::iterator, bool>
+Value::ObjectMap::try_emplace( const StaticKey &key )
+{
+   return emplaceMember( key.c_str(), key.hash(),
+                         CZString( key.c_str(), CZString::noDuplication ) );
+}
+
+
+Value::ObjectMap::iterator
+Value::ObjectMap::erase( const_iterator position )
+{
+   size_type erased = position - begin();
+   deleteEntry( entries_[erased] );
+   entries_.erase( position.position() );
+   if ( !slots_.empty() )
+      rebuildSlots();
+   return begin() + erased;
+}
+
+
+Value::ObjectMap::size_type
+Value::ObjectMap::erase( const CZString &key )
+{
+   const_iterator it = find( key );
+   if ( it == end() )
+      return 0;
+   erase( it );
+   return 1;
+}
+
+
+bool
+Value::ObjectMap::operator ==( const ObjectMap &other ) const
+{
+   if ( size() != other.size() )
+      return false;
+   for ( const_iterator it = begin(); it != end(); ++it )
+   {
+      const_iterator found = other.find( it->first );
+      if ( found == other.end()  ||  !( found->second == it->second ) )
+         return false;
+   }
+   return true;
+}
+
+
+// Compares entries in key order, as std::map does, whatever the order they
+// were inserted in.
+bool
+Value::ObjectMap::operator <( const ObjectMap &other ) const
+{
+   typedef std::vector<const value_type *> Sorted;
+   struct Less
+   {
+      bool operator()( const value_type *a, const value_type *b ) const
+      {
+         return *a < *b;
+      }
+      static bool byKey( const value_type *a, const value_type *b )
+      {
+         return a->first < b->first;
+      }
+   };
+   Sorted mine, others;
+   mine.reserve( size() );
+   others.reserve( other.size() );
+   for ( const_iterator it = begin(); it != end(); ++it )
+      mine.push_back( &*it );
+   for ( const_iterator it = other.begin(); it != other.end(); ++it )
+      others.push_back( &*it );
+   std::sort( mine.begin(), mine.end(), Less::byKey );
+   std::sort( others.begin(), others.end(), Less::byKey );
+   return std::lexicographical_compare( mine.begin(), mine.end(),
+                                        others.begin(), others.end(), Less() );
+}
+
+
+// Returns size() if key is not there.
+Value::ObjectMap::size_type
+Value::ObjectMap::findPosition( const CZString &key ) const
+{
+   if ( key.c_str() )
+      return findMember( key.c_str(), slots_.empty() ? 0 : StaticKey::hash( key.c_str() ) );
+   return findIndex( key.index() );
+}
+
+
+Value::ObjectMap::size_type
+Value::ObjectMap::findMember( const char *key, unsigned int hash ) const
+{
+   if ( slots_.empty() )
+   {
+      for ( size_type position = 0; position != entries_.size(); ++position )
+      {
+         const char *name = entries_[position]->first.c_str();
+         if ( name == key  ||  strcmp( name, key ) == 0 )
+            return position;
+      }
+      return entries_.size();
+   }
+   size_type mask = slots_.size() - 1;
+   for ( size_type slot = hash & mask; slots_[slot].position_; slot = ( slot + 1 ) & mask )
+   {
+      const Slot &candidate = slots_[slot];
+      if ( candidate.hash_ != hash )
+         continue;
+      const char *name = entries_[candidate.position_ - 1]->first.c_str();
+      if ( name == key  ||  strcmp( name, key ) == 0 )
+         return candidate.position_ - 1;
+   }
+   return entries_.size();
+}
+
+
+Value::ObjectMap::size_type
+Value::ObjectMap::findIndex( int index ) const
+{
+   size_type position = static_cast<unsigned int>( index );
+   if ( position < entries_.size()  &&  entries_[position]->first.index() == index )
+      return position;
+   Entries::const_iterator it = lowerBound( index );
+   if ( it != entries_.end()  &&  ( *it )->first.index() == index )
+      return it - entries_.begin();
+   return entries_.size();
+}
+
+
+Value::ObjectMap::Entries::const_iterator
+Value::ObjectMap::lowerBound( int index ) const
+{
+   return std::lower_bound( entries_.begin(), entries_.end(), index,
+                            []( const value_type *entry, int index )
+                            {
+                               return entry->first.index() < index;
+                            } );
+}
+
+
+template<typename Key>
+std::pair<Value::ObjectMap::iterator, bool>
+Value::ObjectMap::emplace( Key &&key )
+{
+   const char *name = key.c_str();
+   if ( !name )
+   {
+      int index = key.index();
+      Entries::const_iterator it = entries_.end();
+      if ( !entries_.empty()  &&  entries_.back()->first.index() >= index )
+      {
+         size_type position = findIndex( index );
+         if ( position != entries_.size() )
+            return std::make_pair( begin() + position, false );
+         it = lowerBound( index );
+      }
+      value_type *entry = newEntry( std::piecewise_construct,
+                                    std::forward_as_tuple( std::forward<Key>( key ) ),
+                                    std::forward_as_tuple() );
+      try
+      {
+         return std::make_pair( iterator( entries_.insert( it, entry ) ), true );
+      }
+      catch ( ... )
+      {
+         deleteEntry( entry );
+         throw;
+      }
+   }
+
+   unsigned int h = slots_.empty()  &&  entries_.size() < maxUnindexedSize
+                    ? 0 : StaticKey::hash( name );
+   return emplaceMember( name, h, std::forward<Key>( key ) );
+}
+
+
+// hash may be 0 if the members are not indexed yet and would not be once key
+// is added.
+template<typename Key>
+std::pair<Value::ObjectMap::iterator, bool>
+Value::ObjectMap::emplaceMember( const char *name, unsigned int h, Key &&key )
+{
+   size_type position = findMember( name, h );
+   if ( position != entries_.size() )
+      return std::make_pair( begin() + position, false );
+   value_type *entry = newEntry( std::piecewise_construct,
+                                 std::forward_as_tuple( std::forward<Key>( key ) ),
+                                 std::forward_as_tuple() );
+   try
+   {
+      entries_.push_back( entry );
+   }
+   catch ( ... )
+   {
+      deleteEntry( entry );
+      throw;
+   }
+   if ( !slots_.empty() )
+      addSlot( position, h );
+   else if ( entries_.size() > maxUnindexedSize )
+      rebuildSlots();
+   return std::make_pair( begin() + position, true );
+}
+
+
+// Entries come from the memory resource of the map, as its vectors do.
+template<typename... Args>
+Value::ObjectMap::value_type *
+Value::ObjectMap::newEntry( Args &&... args )
+{
+   std::pmr::polymorphic_allocator<value_type> allocator( entries_.get_allocator() );
+   value_type *entry = allocator.allocate( 1 );
+   try
+   {
+      ::new ( static_cast<void *>( entry ) ) value_type( std::forward<Args>( args )... );
+   }
+   catch ( ... )
+   {
+      allocator.deallocate( entry, 1 );
+      throw;
+   }
+   return entry;
+}
+
+
+void
+Value::ObjectMap::deleteEntry( value_type *entry )
+{
+   std::pmr::polymorphic_allocator<value_type> allocator( entries_.get_allocator() );
+   entry->~value_type();
+   allocator.deallocate( entry, 1 );
+}
+
+
+// Keeps at least half the slots free, so that probe sequences stay short.
+void
+Value::ObjectMap::addSlot( size_type position, unsigned int hash )
+{
+   if ( 2 * entries_.size() > slots_.size() )
+   {
+      rebuildSlots();
+      return;
+   }
+   size_type mask = slots_.size() - 1;
+   size_type slot = hash & mask;
+   while ( slots_[slot].position_ )
+      slot = ( slot + 1 ) & mask;
+   slots_[slot].position_ = static_cast<unsigned int>( position + 1 );
+   slots_[slot].hash_ = hash;
+}
+
+
+void
+Value::ObjectMap::rebuildSlots()
+{
+   size_type slotCount = 4 * maxUnindexedSize;
+   while ( slotCount < 2 * entries_.size() )
+      slotCount *= 2;
+   Slot freeSlot = { 0, 0 };
+   slots_.assign( slotCount, freeSlot );
+   size_type mask = slotCount - 1;
+   for ( size_type position = 0; position != entries_.size(); ++position )
+   {
+      unsigned int h = StaticKey::hash( entries_[position]->first.c_str() );
+      size_type slot = h & mask;
+      while ( slots_[slot].position_ )
+         slot = ( slot + 1 ) & mask;
+      slots_[slot].position_ = static_cast<unsigned int>( position + 1 );
+      slots_[slot].hash_ = h;
+   }
+}
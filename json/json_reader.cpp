@@ -1,11 +1,16 @@
 #include "reader.h"
 #include "value.h"
 #include <utility>
+#include <algorithm>
+#include <charconv>
+#include <cmath>
 #include <cstdio>
 #include <cassert>
 #include <cstring>
 #include <iostream>
 #include <stdexcept>
+#include <thread>
+#include "json_scan.inl"
 
 #if _MSC_VER >= 1400 // VC++ 8.0
 #pragma warning( disable : 4996 )   // disable warning about strdup being deprecated.
@@ -19,6 +24,7 @@ namespace Json {
 Features::Features()
    : allowComments_( true )
    , strictRoot_( false )
+   , failFast_( false )
 {
 }
 
@@ -36,6 +42,7 @@ Features::strictMode()
    Features features;
    features.allowComments_ = false;
    features.strictRoot_ = true;
+   features.failFast_ = true;
    return features;
 }
 
@@ -108,12 +115,20 @@ static std::string codePointToUTF8(unsigned int cp)
 
 Reader::Reader()
    : features_( Features::all() )
+   , arena_( 0 )
+   , grafts_( 0 )
+   , graftsEnd_( 0 )
+   , inSitu_( false )
 {
 }
 
 
 Reader::Reader( const Features &features )
    : features_( features )
+   , arena_( 0 )
+   , grafts_( 0 )
+   , graftsEnd_( 0 )
+   , inSitu_( false )
 {
 }
 
@@ -151,6 +166,43 @@ bool
 Reader::parse( const char *beginDoc, const char *endDoc, 
                Value &root,
                bool collectComments )
+{
+   arena_ = 0;
+   inSitu_ = false;
+   return readDocument( beginDoc, endDoc, root, collectComments );
+}
+
+
+bool 
+Reader::parse( const char *beginDoc, const char *endDoc, 
+               Value &root,
+               ValueArena &arena,
+               bool collectComments )
+{
+   arena_ = &arena;
+   inSitu_ = false;
+   return readDocument( beginDoc, endDoc, root, collectComments );
+}
+
+
+bool
+Reader::parse( std::string &&document, 
+               Value &root,
+               ValueArena &arena,
+               bool collectComments )
+{
+   size_t length = document.length();
+   const char *begin = arena.adopt( std::move( document ) );
+   arena_ = &arena;
+   inSitu_ = true;
+   return readDocument( begin, begin + length, root, collectComments );
+}
+
+
+bool 
+Reader::readDocument( const char *beginDoc, const char *endDoc, 
+                      Value &root,
+                      bool collectComments )
 {
    if ( !features_.allowComments_ )
    {
@@ -165,15 +217,24 @@ Reader::parse( const char *beginDoc, const char *endDoc,
    lastValue_ = 0;
    commentsBefore_ = "";
    errors_.clear();
-   while ( !nodes_.empty() )
-      nodes_.pop();
-   nodes_.push( &root );
-   
-   bool successful = readValue();
+
+   bool successful;
    Token token;
-   skipCommentTokens( token );
-   if ( collectComments_  &&  !commentsBefore_.empty() )
-      root.setComment( commentsBefore_, commentAfter );
+   if ( features_.allowComments_ )
+   {
+      while ( !nodes_.empty() )
+         nodes_.pop();
+      nodes_.push( &root );
+
+      successful = readValue();
+      skipCommentTokens( token );
+      if ( collectComments_  &&  !commentsBefore_.empty() )
+         root.setComment( commentsBefore_, commentAfter );
+   }
+   else
+   {
+      successful = readStrictDocument( root );
+   }
    if ( features_.strictRoot_ )
    {
       if ( !root.isArray()  &&  !root.isObject() )
@@ -182,8 +243,7 @@ Reader::parse( const char *beginDoc, const char *endDoc,
          token.type_ = tokenError;
          token.start_ = beginDoc;
          token.end_ = endDoc;
-         addError( "A valid JSON document must be either an array or an object value.",
-                   token );
+         addError( errorBadRoot, token );
          return false;
       }
    }
@@ -191,6 +251,192 @@ Reader::parse( const char *beginDoc, const char *endDoc,
 }
 
 
+// Strict JSON only.  Every value is read where it is found, in the innermost
+// open container, and the containers still open are kept on containers_.
+bool 
+Reader::readStrictDocument( Value &root )
+{
+   enum { initialDepth = 32 };
+   containers_.clear();
+   containers_.reserve( initialDepth );
+   Value *value = &root;
+   while ( true )
+   {
+      skipSpaces();
+      Location start = current_;
+      Char c = current_ != end_ ? *current_++ : 0;
+      switch ( c )
+      {
+      case '{':
+         *value = arena_ ? Value( objectValue, *arena_ ) : Value( objectValue );
+         skipSpaces();
+         if ( current_ != end_  &&  *current_ == '}' )
+         {
+            ++current_;
+            break;
+         }
+         containers_.push_back( value );
+         value = readStrictMember( *value );
+         if ( !value )
+            return false;
+         continue;
+      case '[':
+         if ( grafts_ != graftsEnd_  &&  start == grafts_->begin_ )
+         {
+            *value = std::move( *grafts_->value_ );
+            current_ = grafts_->end_;
+            ++grafts_;
+            break;
+         }
+         *value = arena_ ? Value( arrayValue, *arena_ ) : Value( arrayValue );
+         skipSpaces();
+         if ( current_ != end_  &&  *current_ == ']' )
+         {
+            ++current_;
+            break;
+         }
+         containers_.push_back( value );
+         value = &value->append( Value() );
+         continue;
+      case '"':
+         {
+            if ( !readString() )
+               return addStrictError( errorSyntax, start );
+            Token token = { tokenString, start, current_ };
+            if ( inSitu_ )
+            {
+               char *decoded;
+               if ( !decodeStringInPlace( token, decoded ) )
+                  return false;
+               *value = StaticString( decoded );
+            }
+            else
+            {
+               memberName_.clear();
+               if ( !decodeString( token, memberName_ ) )
+                  return false;
+               if ( arena_ )
+                  *value = StaticString( arena_->duplicate( memberName_.data(), memberName_.length() ) );
+               else
+                  *value = memberName_;
+            }
+         }
+         break;
+      case '0': case '1': case '2': case '3': case '4':
+      case '5': case '6': case '7': case '8': case '9':
+      case '-':
+         {
+            readNumber();
+            Token token = { tokenNumber, start, current_ };
+            if ( !decodeNumber( token, *value ) )
+               return false;
+         }
+         break;
+      case 't':
+         if ( !match( "rue", 3 ) )
+            return addStrictError( errorSyntax, start );
+         *value = true;
+         break;
+      case 'f':
+         if ( !match( "alse", 4 ) )
+            return addStrictError( errorSyntax, start );
+         *value = false;
+         break;
+      case 'n':
+         if ( !match( "ull", 3 ) )
+            return addStrictError( errorSyntax, start );
+         *value = Value();
+         break;
+      default:
+         return addStrictError( errorSyntax, start );
+      }
+
+      // A value is complete: close the containers it completes, and find the
+      // next value of the innermost one still open.
+      for ( value = 0; !value; )
+      {
+         if ( containers_.empty() )
+            return true;
+         Value &container = *containers_.back();
+         skipSpaces();
+         start = current_;
+         c = current_ != end_ ? *current_++ : 0;
+         if ( container.type() == objectValue )
+         {
+            if ( c == ',' )
+            {
+               value = readStrictMember( container );
+               if ( !value )
+                  return false;
+            }
+            else if ( c == '}' )
+               containers_.pop_back();
+            else
+               return addStrictError( errorMissingObjectSeparator, start );
+         }
+         else
+         {
+            if ( c == ',' )
+               value = &container.append( Value() );
+            else if ( c == ']' )
+               containers_.pop_back();
+            else
+               return addStrictError( errorMissingArraySeparator, start );
+         }
+      }
+   }
+}
+
+
+// Reads a member name and the colon after it.  Returns the member, or 0 on
+// error.
+Value *
+Reader::readStrictMember( Value &object )
+{
+   skipSpaces();
+   Location start = current_;
+   if ( current_ == end_  ||  *current_++ != '"'  ||  !readString() )
+   {
+      addStrictError( errorMissingMemberName, start );
+      return 0;
+   }
+   Token token = { tokenString, start, current_ };
+   const char *memberName = 0;
+   if ( inSitu_ )
+   {
+      char *inPlace;
+      if ( !decodeStringInPlace( token, inPlace ) )
+         return 0;
+      memberName = inPlace;
+   }
+   else
+   {
+      memberName_.clear();
+      if ( !decodeString( token, memberName_ ) )
+         return 0;
+      memberName = arena_ ? arena_->duplicate( memberName_.data(), memberName_.length() )
+                          : memberName_.c_str();
+   }
+   skipSpaces();
+   start = current_;
+   if ( current_ == end_  ||  *current_++ != ':' )
+   {
+      addStrictError( errorMissingColon, start );
+      return 0;
+   }
+   return arena_ ? &object.resolveArenaReference( memberName )
+                 : &object[ memberName ];
+}
+
+
+bool 
+Reader::addStrictError( ErrorCode code, Location start )
+{
+   Token token = { tokenError, start, current_ };
+   return addError( code, token );
+}
+
+
 bool
 Reader::readValue()
 {
@@ -229,7 +475,7 @@ Reader::readValue()
       currentValue() = Value();
       break;
    default:
-      return addError( "Syntax error: value, object or array expected.", token );
+      return addError( errorSyntax, token );
    }
 
    if ( collectComments_ )
@@ -261,11 +507,11 @@ Reader::skipCommentTokens( Token &token )
 
 
 bool 
-Reader::expectToken( TokenType type, Token &token, const char *message )
+Reader::expectToken( TokenType type, Token &token, ErrorCode code )
 {
    readToken( token );
    if ( token.type_ != type )
-      return addError( message, token );
+      return addError( code, token );
    return true;
 }
 
@@ -348,14 +594,12 @@ Reader::readToken( Token &token )
 void 
 Reader::skipSpaces()
 {
-   while ( current_ != end_ )
-   {
-      Char c = *current_;
-      if ( c == ' '  ||  c == '\t'  ||  c == '\r'  ||  c == '\n' )
-         ++current_;
-      else
-         break;
-   }
+   // Most runs are one character long, or empty: they are not worth a call.
+   if ( current_ == end_  ||  !isWhitespace( *current_ ) )
+      return;
+   ++current_;
+   if ( current_ != end_  &&  isWhitespace( *current_ ) )
+      current_ = scanKernels().skipWhitespace( current_ + 1, end_ );
 }
 
 
@@ -428,7 +672,7 @@ Reader::readCStyleComment()
    while ( current_ != end_ )
    {
       Char c = getNextChar();
-      if ( c == '*'  &&  *current_ == '/' )
+      if ( c == '*'  &&  current_ != end_  &&  *current_ == '/' )
          break;
    }
    return getNextChar() == '/';
@@ -463,16 +707,18 @@ Reader::readNumber()
 bool
 Reader::readString()
 {
-   Char c = 0;
-   while ( current_ != end_ )
+   ScanFunction scanString = scanKernels().scanString;
+   while ( true )
    {
-      c = getNextChar();
-      if ( c == '\\' )
-         getNextChar();
-      else if ( c == '"' )
-         break;
+      current_ = scanString( current_, end_ );
+      if ( current_ == end_ )
+         return false;
+      Char c = *current_++;
+      if ( c == '"' )
+         return true;
+      if ( c == '\\'  &&  current_ != end_ )
+         ++current_;
    }
-   return c == '"';
 }
 
 
@@ -481,7 +727,8 @@ Reader::readObject( Token &tokenStart )
 {
    Token tokenName;
    std::string name;
-   currentValue() = Value( objectValue );
+   const char *memberName = 0;
+   currentValue() = arena_ ? Value( objectValue, *arena_ ) : Value( objectValue );
    while ( readToken( tokenName ) )
    {
       bool initialTokenOk = true;
@@ -489,23 +736,36 @@ Reader::readObject( Token &tokenStart )
          initialTokenOk = readToken( tokenName );
       if  ( !initialTokenOk )
          break;
-      if ( tokenName.type_ == tokenObjectEnd  &&  name.empty() )  // empty object
+      if ( tokenName.type_ == tokenObjectEnd  &&  name.empty()  &&  !memberName )  // empty object
          return true;
       if ( tokenName.type_ != tokenString )
          break;
       
-      name = "";
-      if ( !decodeString( tokenName, name ) )
-         return recoverFromError( tokenObjectEnd );
+      if ( inSitu_ )
+      {
+         char *inPlace;
+         if ( !decodeStringInPlace( tokenName, inPlace ) )
+            return recoverFromError( tokenObjectEnd );
+         memberName = inPlace;
+      }
+      else
+      {
+         name = "";
+         if ( !decodeString( tokenName, name ) )
+            return recoverFromError( tokenObjectEnd );
+         if ( arena_ )
+            memberName = arena_->duplicate( name.data(), name.length() );
+      }
 
       Token colon;
       if ( !readToken( colon ) ||  colon.type_ != tokenMemberSeparator )
       {
-         return addErrorAndRecover( "Missing ':' after object member name", 
+         return addErrorAndRecover( errorMissingColon, 
                                     colon, 
                                     tokenObjectEnd );
       }
-      Value &value = currentValue()[ name ];
+      Value &value = arena_ ? currentValue().resolveArenaReference( memberName )
+                            : currentValue()[ name ];
       nodes_.push( &value );
       bool ok = readValue();
       nodes_.pop();
@@ -518,7 +778,7 @@ Reader::readObject( Token &tokenStart )
                   comma.type_ != tokenArraySeparator &&
 		  comma.type_ != tokenComment ) )
       {
-         return addErrorAndRecover( "Missing ',' or '}' in object declaration", 
+         return addErrorAndRecover( errorMissingObjectSeparator, 
                                     comma, 
                                     tokenObjectEnd );
       }
@@ -529,7 +789,7 @@ Reader::readObject( Token &tokenStart )
       if ( comma.type_ == tokenObjectEnd )
          return true;
    }
-   return addErrorAndRecover( "Missing '}' or object member name", 
+   return addErrorAndRecover( errorMissingMemberName, 
                               tokenName, 
                               tokenObjectEnd );
 }
@@ -538,7 +798,7 @@ Reader::readObject( Token &tokenStart )
 bool 
 Reader::readArray( Token &tokenStart )
 {
-   currentValue() = Value( arrayValue );
+   currentValue() = arena_ ? Value( arrayValue, *arena_ ) : Value( arrayValue );
    skipSpaces();
    if ( *current_ == ']' ) // empty array
    {
@@ -567,7 +827,7 @@ Reader::readArray( Token &tokenStart )
                             token.type_ == tokenArrayEnd );
       if ( !ok  ||  badTokenType )
       {
-         return addErrorAndRecover( "Missing ',' or ']' in array declaration", 
+         return addErrorAndRecover( errorMissingArraySeparator, 
                                     token, 
                                     tokenArrayEnd );
       }
@@ -580,65 +840,73 @@ Reader::readArray( Token &tokenStart )
 
 bool 
 Reader::decodeNumber( Token &token )
+{
+   return decodeNumber( token, currentValue() );
+}
+
+
+// Numbers are decoded with std::from_chars(), straight from the document and
+// independently of the locale.
+bool 
+Reader::decodeNumber( Token &token, Value &decoded )
 {
    bool isDouble = false;
    for ( Location inspect = token.start_; inspect != token.end_; ++inspect )
-   {
-      isDouble = isDouble  
-                 ||  in( *inspect, '.', 'e', 'E', '+' )  
-                 ||  ( *inspect == '-'  &&  inspect != token.start_ );
-   }
+      isDouble = isDouble  ||  in( *inspect, '.', 'e', 'E', '+' );
    if ( isDouble )
-      return decodeDouble( token );
-   Location current = token.start_;
-   bool isNegative = *current == '-';
-   if ( isNegative )
-      ++current;
-   Value::UInt threshold = (isNegative ? Value::UInt(-Value::minInt) 
-                                       : Value::maxUInt) / 10;
-   Value::UInt value = 0;
-   while ( current < token.end_ )
+      return decodeDouble( token, decoded );
+   std::from_chars_result result;
+   if ( *token.start_ == '-' )
    {
-      Char c = *current++;
-      if ( c < '0'  ||  c > '9' )
-         return addError( "'" + std::string( token.start_, token.end_ ) + "' is not a number.", token );
-      if ( value >= threshold )
-         return decodeDouble( token );
-      value = value * 10 + Value::UInt(c - '0');
-   }
-   if ( isNegative )
-      currentValue() = -Value::Int( value );
-   else if ( value <= Value::UInt(Value::maxInt) )
-      currentValue() = Value::Int( value );
+      Value::Int64 value;
+      result = std::from_chars( token.start_, token.end_, value );
+      if ( result.ec == std::errc()  &&  result.ptr == token.end_ )
+      {
+         if ( value >= Value::minInt )
+            decoded = Value::Int( value );
+         else
+            decoded = value;
+         return true;
+      }
+   }
    else
-      currentValue() = value;
-   return true;
+   {
+      Value::UInt64 value;
+      result = std::from_chars( token.start_, token.end_, value );
+      if ( result.ec == std::errc()  &&  result.ptr == token.end_ )
+      {
+         if ( value <= Value::UInt(Value::maxInt) )
+            decoded = Value::Int( value );
+         else
+            decoded = value;
+         return true;
+      }
+   }
+   if ( result.ec == std::errc::result_out_of_range )
+      return decodeDouble( token, decoded );
+   return addError( errorBadNumber, token );
 }
 
 
 bool 
-Reader::decodeDouble( Token &token )
+Reader::decodeDouble( Token &token, Value &decoded )
 {
    double value = 0;
-   const int bufferSize = 32;
-   int count;
-   int length = int(token.end_ - token.start_);
-   if ( length <= bufferSize )
-   {
-      Char buffer[bufferSize];
-      memcpy( buffer, token.start_, length );
-      buffer[length] = 0;
-      count = sscanf( buffer, "%lf", &value );
-   }
-   else
+   std::from_chars_result result = std::from_chars( token.start_, token.end_, value );
+   if ( result.ptr != token.end_  ||  
+        ( result.ec != std::errc()  &&  result.ec != std::errc::result_out_of_range ) )
+      return addError( errorBadNumber, token );
+   if ( result.ec == std::errc::result_out_of_range )
    {
-      std::string buffer( token.start_, token.end_ );
-      count = sscanf( buffer.c_str(), "%lf", &value );
+      // Saturate as strtod() does: to infinity, or to zero if the exponent is negative
+      const char *exponent = std::find_if( token.start_, token.end_, 
+                                           []( char c ) { return c == 'e'  ||  c == 'E'; } );
+      bool underflow = exponent != token.end_  &&  exponent + 1 != token.end_  &&  exponent[1] == '-';
+      value = underflow ? 0.0 : HUGE_VAL;
+      if ( *token.start_ == '-' )
+         value = -value;
    }
-
-   if ( count != 1 )
-      return addError( "'" + std::string( token.start_, token.end_ ) + "' is not a number.", token );
-   currentValue() = value;
+   decoded = value;
    return true;
 }
 
@@ -646,10 +914,43 @@ Reader::decodeDouble( Token &token )
 bool 
 Reader::decodeString( Token &token )
 {
+   if ( inSitu_ )
+   {
+      char *decoded;
+      if ( !decodeStringInPlace( token, decoded ) )
+         return false;
+      currentValue() = StaticString( decoded );
+      return true;
+   }
    std::string decoded;
    if ( !decodeString( token, decoded ) )
       return false;
-   currentValue() = decoded;
+   if ( arena_ )
+      currentValue() = StaticString( arena_->duplicate( decoded.data(), decoded.length() ) );
+   else
+      currentValue() = decoded;
+   return true;
+}
+
+
+// The document belongs to arena_, and may be written: terminate the string
+// over its closing quote, and decode escape sequences over the original text,
+// which is never shorter.
+bool 
+Reader::decodeStringInPlace( Token &token, char *&decoded )
+{
+   char *begin = const_cast<char *>( token.start_ + 1 );
+   char *end = const_cast<char *>( token.end_ - 1 );
+   if ( memchr( begin, '\\', end - begin ) )
+   {
+      std::string unescaped;
+      if ( !decodeString( token, unescaped ) )
+         return false;
+      memcpy( begin, unescaped.data(), unescaped.length() );
+      end = begin + unescaped.length();
+   }
+   *end = 0;
+   decoded = begin;
    return true;
 }
 
@@ -660,15 +961,21 @@ Reader::decodeString( Token &token, std::string &decoded )
    decoded.reserve( token.end_ - token.start_ - 2 );
    Location current = token.start_ + 1; // skip '"'
    Location end = token.end_ - 1;      // do not include '"'
+   ScanFunction scanString = scanKernels().scanString;
    while ( current != end )
    {
+      Location special = scanString( current, end );
+      decoded.append( current, special );
+      current = special;
+      if ( current == end )
+         break;
       Char c = *current++;
       if ( c == '"' )
          break;
       else if ( c == '\\' )
       {
          if ( current == end )
-            return addError( "Empty escape sequence in string", token, current );
+            return addError( errorEmptyEscape, token, current );
          Char escape = *current++;
          switch ( escape )
          {
@@ -689,7 +996,7 @@ Reader::decodeString( Token &token, std::string &decoded )
             }
             break;
          default:
-            return addError( "Bad escape sequence in string", token, current );
+            return addError( errorBadEscape, token, current );
          }
       }
       else
@@ -713,7 +1020,7 @@ Reader::decodeUnicodeCodePoint( Token &token,
    {
       // surrogate pairs
       if (end - current < 6)
-         return addError( "additional six characters expected to parse unicode surrogate pair.", token, current );
+         return addError( errorShortSurrogatePair, token, current );
       unsigned int surrogatePair;
       if (*(current++) == '\\' && *(current++)== 'u')
       {
@@ -725,7 +1032,7 @@ Reader::decodeUnicodeCodePoint( Token &token,
             return false;
       } 
       else
-         return addError( "expecting another \\u token to begin the second half of a unicode surrogate pair", token, current );
+         return addError( errorBadSurrogatePair, token, current );
    }
    return true;
 }
@@ -737,7 +1044,7 @@ Reader::decodeUnicodeEscapeSequence( Token &token,
                                      unsigned int &unicode )
 {
    if ( end - current < 4 )
-      return addError( "Bad unicode escape sequence in string: four digits expected.", token, current );
+      return addError( errorShortUnicodeEscape, token, current );
    unicode = 0;
    for ( int index =0; index < 4; ++index )
    {
@@ -750,20 +1057,20 @@ Reader::decodeUnicodeEscapeSequence( Token &token,
       else if ( c >= 'A'  &&  c <= 'F' )
          unicode += c - 'A' + 10;
       else
-         return addError( "Bad unicode escape sequence in string: hexadecimal digit expected.", token, current );
+         return addError( errorBadUnicodeDigit, token, current );
    }
    return true;
 }
 
 
 bool 
-Reader::addError( const std::string &message, 
+Reader::addError( ErrorCode code, 
                   Token &token,
                   Location extra )
 {
    ErrorInfo info;
    info.token_ = token;
-   info.message_ = message;
+   info.code_ = code;
    info.extra_ = extra;
    errors_.push_back( info );
    return false;
@@ -773,6 +1080,8 @@ Reader::addError( const std::string &message,
 bool 
 Reader::recoverFromError( TokenType skipUntilToken )
 {
+   if ( features_.failFast_ )
+      return false;
    int errorCount = int(errors_.size());
    Token skip;
    while ( true )
@@ -788,11 +1097,11 @@ Reader::recoverFromError( TokenType skipUntilToken )
 
 
 bool 
-Reader::addErrorAndRecover( const std::string &message, 
+Reader::addErrorAndRecover( ErrorCode code, 
                             Token &token,
                             TokenType skipUntilToken )
 {
-   addError( message, token );
+   addError( code, token );
    return recoverFromError( skipUntilToken );
 }
 
@@ -854,24 +1163,906 @@ Reader::getLocationLineAndColumn( Location location ) const
 }
 
 
+static const char *const errorMessages[Reader::errorCodeCount] =
+{
+   "Syntax error: value, object or array expected.",
+   "A valid JSON document must be either an array or an object value.",
+   "Missing ':' after object member name",
+   "Missing ',' or '}' in object declaration",
+   "Missing '}' or object member name",
+   "Missing ',' or ']' in array declaration",
+   "is not a number.",
+   "Empty escape sequence in string",
+   "Bad escape sequence in string",
+   "additional six characters expected to parse unicode surrogate pair.",
+   "expecting another \\u token to begin the second half of a unicode surrogate pair",
+   "Bad unicode escape sequence in string: four digits expected.",
+   "Bad unicode escape sequence in string: hexadecimal digit expected.",
+   "Unexpected end of document.",
+   "Extra text after the document."
+};
+
+
+const char *
+Reader::getErrorMessage( ErrorCode code )
+{
+   return errorMessages[code];
+}
+
+
+// The message of a number error quotes the number, [start, end).
+std::string 
+Reader::formatErrorMessage( ErrorCode code, 
+                            Location start, 
+                            Location end )
+{
+   if ( code == errorBadNumber )
+      return "'" + std::string( start, end ) + "' " + errorMessages[code];
+   return errorMessages[code];
+}
+
+
+// All the errors are located in a single pass over the document.
 std::string 
 Reader::getFormatedErrorMessages() const
 {
+   std::vector<Location> locations;
+   locations.reserve( 2 * errors_.size() );
+   for ( Errors::const_iterator itError = errors_.begin();
+         itError != errors_.end();
+         ++itError )
+   {
+      locations.push_back( itError->token_.start_ );
+      if ( itError->extra_ )
+         locations.push_back( itError->extra_ );
+   }
+   std::vector<size_t> order( locations.size() );
+   for ( size_t index = 0; index != order.size(); ++index )
+      order[index] = index;
+   std::sort( order.begin(), order.end(),
+              [&locations]( size_t a, size_t b ) { return locations[a] < locations[b]; } );
+
+   // Same walk as getLocationLineAndColumn(), resumed from one location to the next.
+   std::vector<std::string> located( locations.size() );
+   Location current = begin_;
+   Location lastLineStart = current;
+   int line = 0;
+   for ( size_t index = 0; index != order.size(); ++index )
+   {
+      Location location = locations[ order[index] ];
+      while ( current < location  &&  current != end_ )
+      {
+         Char c = *current++;
+         if ( c == '\r' )
+         {
+            if ( *current == '\n' )
+               ++current;
+            lastLineStart = current;
+            ++line;
+         }
+         else if ( c == '\n' )
+         {
+            lastLineStart = current;
+            ++line;
+         }
+      }
+      char buffer[18+16+16+1];
+      sprintf( buffer, "Line %d, Column %d", line + 1, int(location - lastLineStart) + 1 );
+      located[ order[index] ] = buffer;
+   }
+
    std::string formattedMessage;
+   size_t next = 0;
    for ( Errors::const_iterator itError = errors_.begin();
          itError != errors_.end();
          ++itError )
    {
       const ErrorInfo &error = *itError;
-      formattedMessage += "* " + getLocationLineAndColumn( error.token_.start_ ) + "\n";
-      formattedMessage += "  " + error.message_ + "\n";
+      formattedMessage += "* " + located[next++] + "\n";
+      formattedMessage += "  " + formatErrorMessage( error.code_, error.token_.start_, 
+                                                     error.token_.end_ ) + "\n";
       if ( error.extra_ )
-         formattedMessage += "See " + getLocationLineAndColumn( error.extra_ ) + " for detail.\n";
+         formattedMessage += "See " + located[next++] + " for detail.\n";
    }
    return formattedMessage;
 }
 
 
+Reader::ErrorRecords 
+Reader::getErrors() const
+{
+   ErrorRecords records;
+   records.reserve( errors_.size() );
+   for ( Errors::const_iterator itError = errors_.begin();
+         itError != errors_.end();
+         ++itError )
+   {
+      ErrorRecord record = { itError->code_, size_t( itError->token_.start_ - begin_ ) };
+      records.push_back( record );
+   }
+   return records;
+}
+
+
+// Class ParseHandler
+// //////////////////////////////////////////////////////////////////
+
+ParseHandler::~ParseHandler()
+{
+}
+
+
+bool 
+ParseHandler::startObject()
+{
+   return true;
+}
+
+
+bool 
+ParseHandler::endObject()
+{
+   return true;
+}
+
+
+bool 
+ParseHandler::startArray()
+{
+   return true;
+}
+
+
+bool 
+ParseHandler::endArray()
+{
+   return true;
+}
+
+
+bool 
+ParseHandler::key( const char *, const char * )
+{
+   return true;
+}
+
+
+bool 
+ParseHandler::string( const char *, const char * )
+{
+   return true;
+}
+
+
+bool 
+ParseHandler::number( const Value & )
+{
+   return true;
+}
+
+
+bool 
+ParseHandler::boolean( bool )
+{
+   return true;
+}
+
+
+bool 
+ParseHandler::null()
+{
+   return true;
+}
+
+
+// Class ValueBuilder
+// //////////////////////////////////////////////////////////////////
+
+ValueBuilder::ValueBuilder()
+{
+}
+
+
+Value &
+ValueBuilder::root()
+{
+   return root_;
+}
+
+
+void 
+ValueBuilder::reset()
+{
+   nodes_.clear();
+   root_ = Value();
+}
+
+
+// The value an event is about: the root, the next element of the current
+// array, or the member of the current object named by the last key.
+Value &
+ValueBuilder::nextValue()
+{
+   if ( nodes_.empty() )
+      return root_;
+   Value &container = *nodes_.back();
+   if ( container.isArray() )
+      return container.append( Value() );
+   return container[ key_ ];
+}
+
+
+bool 
+ValueBuilder::startContainer( ValueType type )
+{
+   Value &value = nextValue();
+   value = Value( type );
+   nodes_.push_back( &value );
+   return true;
+}
+
+
+bool 
+ValueBuilder::startObject()
+{
+   return startContainer( objectValue );
+}
+
+
+bool 
+ValueBuilder::endObject()
+{
+   nodes_.pop_back();
+   return true;
+}
+
+
+bool 
+ValueBuilder::startArray()
+{
+   return startContainer( arrayValue );
+}
+
+
+bool 
+ValueBuilder::endArray()
+{
+   nodes_.pop_back();
+   return true;
+}
+
+
+bool 
+ValueBuilder::key( const char *begin, const char *end )
+{
+   key_.assign( begin, end );
+   return true;
+}
+
+
+bool 
+ValueBuilder::string( const char *begin, const char *end )
+{
+   nextValue() = Value( begin, end );
+   return true;
+}
+
+
+bool 
+ValueBuilder::number( const Value &value )
+{
+   nextValue() = value;
+   return true;
+}
+
+
+bool 
+ValueBuilder::boolean( bool value )
+{
+   nextValue() = value;
+   return true;
+}
+
+
+bool 
+ValueBuilder::null()
+{
+   nextValue() = Value();
+   return true;
+}
+
+
+// Class StreamParser
+// //////////////////////////////////////////////////////////////////
+
+// The tokens are read by reader_, over the text of one chunk at a time.
+// A token running up to the end of a chunk may continue in the next one:
+// it is kept in pending_, and read again once more text is available.
+
+StreamParser::StreamParser( ParseHandler &handler, 
+                            const Features &features )
+   : handler_( handler )
+   , reader_( features )
+{
+   reader_.collectComments_ = false;
+   reset();
+}
+
+
+void 
+StreamParser::reset()
+{
+   pending_.clear();
+   errors_.clear();
+   errorText_.clear();
+   containers_.clear();
+   state_ = stateValue;
+   offset_ = 0;
+   stopped_ = false;
+}
+
+
+bool 
+StreamParser::feed( const char *begin, const char *end )
+{
+   if ( state_ == stateFailed )
+      return false;
+   if ( pending_.empty() )
+      return parse( begin, end, false );
+   pending_.append( begin, end );
+   std::string text;
+   text.swap( pending_ );
+   return parse( text.data(), text.data() + text.length(), false );
+}
+
+
+bool 
+StreamParser::finish()
+{
+   if ( state_ == stateFailed )
+      return false;
+   std::string text;
+   text.swap( pending_ );
+   if ( !parse( text.data(), text.data() + text.length(), true ) )
+      return false;
+   if ( state_ != stateDone )
+   {
+      Token token;
+      token.type_ = Reader::tokenEndOfStream;
+      token.start_ = token.end_ = reader_.begin_;  // offset_ already counts all the text
+      return addError( Reader::errorUnexpectedEnd, token );
+   }
+   return true;
+}
+
+
+bool 
+StreamParser::stopped() const
+{
+   return stopped_;
+}
+
+
+std::string 
+StreamParser::getFormatedErrorMessages() const
+{
+   std::string formattedMessage;
+   for ( Reader::ErrorRecords::const_iterator itError = errors_.begin();
+         itError != errors_.end();
+         ++itError )
+   {
+      char buffer[32];
+      sprintf( buffer, "%lu", (unsigned long)itError->offset_ );
+      formattedMessage += "* Offset " + std::string( buffer ) + "\n";
+      formattedMessage += "  " + Reader::formatErrorMessage( itError->code_, errorText_.data(), 
+                                                             errorText_.data() + errorText_.length() )
+                          + "\n";
+   }
+   return formattedMessage;
+}
+
+
+Reader::ErrorRecords 
+StreamParser::getErrors() const
+{
+   return errors_;
+}
+
+
+bool 
+StreamParser::parse( const char *begin, const char *end, bool final )
+{
+   reader_.begin_ = begin;
+   reader_.end_ = end;
+   reader_.current_ = begin;
+   Token token;
+   bool ok = true;
+   while ( ok )
+   {
+      reader_.readToken( token );
+      if ( token.type_ == Reader::tokenEndOfStream  &&  token.start_ == end )
+         break;
+      if ( !final  &&  mayContinue( token ) )
+      {
+         reader_.current_ = token.start_;
+         break;
+      }
+      ok = handleToken( token );
+   }
+   if ( ok )
+      pending_.assign( reader_.current_, end );
+   offset_ += reader_.current_ - begin;
+   return ok;
+}
+
+
+// Whether token, at the end of the text received so far, may be incomplete:
+// a number, an unterminated string or comment, or a truncated literal.
+bool 
+StreamParser::mayContinue( const Token &token ) const
+{
+   switch ( token.type_ )
+   {
+   case Reader::tokenNumber:
+   case Reader::tokenComment:
+      return token.end_ == reader_.end_;
+   case Reader::tokenError:
+      return token.end_ == reader_.end_  ||  reader_.end_ - token.start_ < 5;
+   default:
+      return false;
+   }
+}
+
+
+bool 
+StreamParser::handleToken( Token &token )
+{
+   if ( token.type_ == Reader::tokenComment  &&  reader_.features_.allowComments_ )
+      return true;
+   switch ( state_ )
+   {
+   case stateFirstElement:
+      if ( token.type_ == Reader::tokenArrayEnd )
+         return endContainer();
+      return handleValue( token );
+   case stateValue:
+      return handleValue( token );
+   case stateFirstMember:
+      if ( token.type_ == Reader::tokenObjectEnd )
+         return endContainer();
+      // fall through
+   case stateMember:
+      if ( token.type_ != Reader::tokenString )
+         return addError( Reader::errorMissingMemberName, token );
+      if ( !decodeString( token ) )
+         return false;
+      state_ = stateColon;
+      return notify( handler_.key( decoded_.data(), decoded_.data() + decoded_.length() ) );
+   case stateColon:
+      if ( token.type_ != Reader::tokenMemberSeparator )
+         return addError( Reader::errorMissingColon, token );
+      state_ = stateValue;
+      return true;
+   case stateNext:
+      if ( containers_.back() == '{' )
+      {
+         if ( token.type_ == Reader::tokenObjectEnd )
+            return endContainer();
+         if ( token.type_ != Reader::tokenArraySeparator )
+            return addError( Reader::errorMissingObjectSeparator, token );
+         state_ = stateMember;
+      }
+      else
+      {
+         if ( token.type_ == Reader::tokenArrayEnd )
+            return endContainer();
+         if ( token.type_ != Reader::tokenArraySeparator )
+            return addError( Reader::errorMissingArraySeparator, token );
+         state_ = stateValue;
+      }
+      return true;
+   case stateDone:
+      return addError( Reader::errorExtraText, token );
+   default:
+      return false;
+   }
+}
+
+
+bool 
+StreamParser::handleValue( Token &token )
+{
+   if ( containers_.empty()  &&  reader_.features_.strictRoot_  &&
+        token.type_ != Reader::tokenObjectBegin  &&  token.type_ != Reader::tokenArrayBegin )
+      return addError( Reader::errorBadRoot, token );
+   switch ( token.type_ )
+   {
+   case Reader::tokenObjectBegin:
+      containers_.push_back( '{' );
+      state_ = stateFirstMember;
+      return notify( handler_.startObject() );
+   case Reader::tokenArrayBegin:
+      containers_.push_back( '[' );
+      state_ = stateFirstElement;
+      return notify( handler_.startArray() );
+   case Reader::tokenNumber:
+      {
+         Value number;
+         if ( !reader_.decodeNumber( token, number ) )
+            return addError( reader_.errors_.back().code_, token );
+         return notify( handler_.number( number ) )  &&  endValue();
+      }
+   case Reader::tokenString:
+      if ( !decodeString( token ) )
+         return false;
+      return notify( handler_.string( decoded_.data(), decoded_.data() + decoded_.length() ) )
+             &&  endValue();
+   case Reader::tokenTrue:
+      return notify( handler_.boolean( true ) )  &&  endValue();
+   case Reader::tokenFalse:
+      return notify( handler_.boolean( false ) )  &&  endValue();
+   case Reader::tokenNull:
+      return notify( handler_.null() )  &&  endValue();
+   default:
+      return addError( Reader::errorSyntax, token );
+   }
+}
+
+
+bool 
+StreamParser::endContainer()
+{
+   bool isObject = containers_.back() == '{';
+   containers_.pop_back();
+   return notify( isObject ? handler_.endObject() : handler_.endArray() )  &&  endValue();
+}
+
+
+bool 
+StreamParser::endValue()
+{
+   state_ = containers_.empty() ? stateDone : stateNext;
+   return true;
+}
+
+
+bool 
+StreamParser::decodeString( Token &token )
+{
+   decoded_.clear();
+   if ( reader_.decodeString( token, decoded_ ) )
+      return true;
+   return addError( reader_.errors_.back().code_, token );
+}
+
+
+bool 
+StreamParser::addError( Reader::ErrorCode code, const Token &token )
+{
+   Reader::ErrorRecord error = { code, offset_ + size_t( token.start_ - reader_.begin_ ) };
+   errors_.push_back( error );
+   if ( code == Reader::errorBadNumber )
+      errorText_.assign( token.start_, token.end_ );
+   reader_.errors_.clear();
+   state_ = stateFailed;
+   return false;
+}
+
+
+bool 
+StreamParser::notify( bool handled )
+{
+   if ( !handled )
+   {
+      stopped_ = true;
+      state_ = stateFailed;
+   }
+   return handled;
+}
+
+
+// Class ParallelReader
+// //////////////////////////////////////////////////////////////////
+
+// Elements are read in tasks of about taskSize bytes: large enough for a
+// task to be worth taking, small enough for the threads to finish together.
+enum { defaultMinArraySize = 256 * 1024, taskSize = 64 * 1024 };
+
+
+// Asking for the number of cores reads a file on some systems.
+static unsigned int
+defaultThreads()
+{
+   static const unsigned int threads = std::max( std::thread::hardware_concurrency(), 1u );
+   return threads;
+}
+
+
+ParallelReader::ParallelReader( const Features &features, 
+                                unsigned int threads )
+   : reader_( features )
+   , elementFeatures_( features )
+   , threads_( threads ? threads : defaultThreads() )
+   , minArraySize_( defaultMinArraySize )
+   , nextTask_( 0 )
+   , failed_( false )
+{
+   // An element may be any value
+   elementFeatures_.strictRoot_ = false;
+}
+
+
+void 
+ParallelReader::setMinArraySize( size_t bytes )
+{
+   minArraySize_ = bytes;
+}
+
+
+size_t 
+ParallelReader::minArraySize() const
+{
+   return minArraySize_;
+}
+
+
+bool 
+ParallelReader::parse( const char *beginDoc, const char *endDoc, 
+                       Value &root )
+{
+   return parse( beginDoc, endDoc, root, 0 );
+}
+
+
+bool 
+ParallelReader::parse( const char *beginDoc, const char *endDoc, 
+                       Value &root,
+                       ValueArena &arena )
+{
+   return parse( beginDoc, endDoc, root, &arena );
+}
+
+
+bool 
+ParallelReader::parse( const char *beginDoc, const char *endDoc, 
+                       Value &root,
+                       ValueArena *arena )
+{
+   bool split = !reader_.features_.allowComments_  &&  threads_ > 1
+                &&  size_t( endDoc - beginDoc ) >= minArraySize_
+                &&  scan( beginDoc, endDoc )  &&  readSplits( arena );
+   std::vector<Reader::Graft> grafts;
+   if ( split )
+   {
+      grafts.reserve( splits_.size() );
+      for ( std::vector<Split>::iterator it = splits_.begin(); it != splits_.end(); ++it )
+      {
+         Reader::Graft graft = { it->begin_, it->end_, &it->value_ };
+         grafts.push_back( graft );
+      }
+   }
+   reader_.grafts_ = grafts.empty() ? 0 : &grafts[0];
+   reader_.graftsEnd_ = reader_.grafts_ + grafts.size();
+   bool ok = arena ? reader_.parse( beginDoc, endDoc, root, *arena, false )
+                   : reader_.parse( beginDoc, endDoc, root, false );
+   reader_.grafts_ = reader_.graftsEnd_ = 0;
+   splits_.clear();
+   tasks_.clear();
+   return ok;
+}
+
+
+// Finds the outermost arrays worth splitting, and the separators of their
+// elements.  The document is read 64 characters at a time, from masks of
+// its quotes, backslashes and brackets, braces and commas: the quotes that
+// are not escaped delimit the strings, and the rest of the characters
+// flagged, outside of the strings, give the structure.
+// The separators of the arrays still open are kept on separators_, those of
+// the innermost one last.  Returns false if the document is not made of
+// well nested containers: it is then left to reader_, to find its errors.
+bool 
+ParallelReader::scan( const char *beginDoc, const char *endDoc )
+{
+   struct Open
+   {
+      Location begin_;
+      size_t separators_;   // index of the first separator of an array
+      bool isArray_;
+   };
+   std::vector<Open> open;
+   splits_.clear();
+   separators_.clear();
+   MaskFunction structureMasks = scanKernels().structureMasks;
+   UInt64 inString = 0;     // all ones if the last block ended in a string
+   UInt64 escaped = 0;      // bit 0 set if the last block ended with an escape
+   char padded[structureBlockSize];
+   size_t size = endDoc - beginDoc;
+   for ( size_t offset = 0; offset < size; offset += structureBlockSize )
+   {
+      Location block = beginDoc + offset;
+      StructureMasks masks;
+      if ( endDoc - block >= structureBlockSize )
+         structureMasks( block, masks );
+      else
+      {
+         memset( padded, ' ', structureBlockSize );
+         memcpy( padded, block, endDoc - block );
+         structureMasks( padded, masks );
+      }
+
+      // A backslash escapes the next character, unless it is escaped itself
+      if ( masks.backslashes_  ||  escaped )
+      {
+         UInt64 escapes = escaped;
+         escaped = 0;
+         for ( UInt64 backslashes = masks.backslashes_; backslashes; backslashes &= backslashes - 1 )
+         {
+            int index = lowestBit( backslashes );
+            if ( escapes & ( UInt64( 1 ) << index ) )
+               continue;
+            if ( index == structureBlockSize - 1 )
+               escaped = 1;
+            else
+               escapes |= UInt64( 1 ) << ( index + 1 );
+         }
+         masks.quotes_ &= ~escapes;
+      }
+
+      // Bit i of strings is set if an odd number of quotes are up to i
+      UInt64 strings = masks.quotes_;
+      for ( int shift = 1; shift < structureBlockSize; shift *= 2 )
+         strings ^= strings << shift;
+      strings ^= inString;
+      inString = UInt64( 0 ) - ( strings >> ( structureBlockSize - 1 ) );
+
+      UInt64 structurals = masks.structurals_ & ~strings;
+      for ( ; structurals; structurals &= structurals - 1 )
+      {
+         Location current = block + lowestBit( structurals );
+         switch ( *current )
+         {
+         case '[':
+            {
+               Open array = { current, separators_.size(), true };
+               open.push_back( array );
+               separators_.push_back( current );
+            }
+            break;
+         case '{':
+            {
+               Open object = { current, 0, false };
+               open.push_back( object );
+            }
+            break;
+         case ',':
+            if ( !open.empty()  &&  open.back().isArray_ )
+               separators_.push_back( current );
+            break;
+         case ']':
+            {
+               if ( open.empty()  ||  !open.back().isArray_ )
+                  return false;
+               Open array = open.back();
+               open.pop_back();
+               size_t elements = separators_.size() - array.separators_;
+               if ( size_t( current + 1 - array.begin_ ) >= minArraySize_  &&  elements >= 2 )
+               {
+                  // Splits inside this one were found before it
+                  while ( !splits_.empty()  &&  splits_.back().begin_ > array.begin_ )
+                     splits_.pop_back();
+                  splits_.push_back( Split() );
+                  Split &split = splits_.back();
+                  split.begin_ = array.begin_;
+                  split.end_ = current + 1;
+                  split.separators_.assign( separators_.begin() + array.separators_, separators_.end() );
+                  split.separators_.push_back( current );
+               }
+               separators_.resize( array.separators_ );
+            }
+            break;
+         case '}':
+            if ( open.empty()  ||  open.back().isArray_ )
+               return false;
+            open.pop_back();
+            break;
+         default: // a form feed
+            break;
+         }
+      }
+   }
+   return open.empty()  &&  !inString  &&  !splits_.empty();
+}
+
+
+// Reads the elements of splits_ into their arrays, on up to threads_
+// threads.  Returns false if any of them does not read.
+bool 
+ParallelReader::readSplits( ValueArena *arena )
+{
+   tasks_.clear();
+   for ( size_t index = 0; index < splits_.size(); ++index )
+   {
+      Split &split = splits_[index];
+      split.value_ = arena ? Value( arrayValue, *arena ) : Value( arrayValue );
+      size_t elements = split.separators_.size() - 1;
+      for ( size_t element = 0; element < elements; ++element )
+         split.value_.append( Value() );
+      for ( size_t first = 0; first < elements; )
+      {
+         size_t last = first + 1;
+         Location start = split.separators_[first];
+         while ( last < elements  &&  size_t( split.separators_[last] - start ) < taskSize )
+            ++last;
+         Task task = { index, first, last };
+         tasks_.push_back( task );
+         first = last;
+      }
+   }
+   nextTask_ = 0;
+   failed_ = false;
+   size_t threads = std::min( size_t( threads_ ), tasks_.size() );
+   std::vector<std::thread> workers;
+   workers.reserve( threads - 1 );
+   for ( size_t thread = 1; thread < threads; ++thread )
+   {
+      ValueArena *subArena = arena ? &arena->subArena() : 0;
+      workers.push_back( std::thread( [this, subArena]
+      {
+         Reader reader( elementFeatures_ );
+         readTasks( reader, subArena );
+      } ) );
+   }
+   Reader reader( elementFeatures_ );
+   readTasks( reader, arena );
+   for ( std::vector<std::thread>::iterator it = workers.begin(); it != workers.end(); ++it )
+      it->join();
+   return !failed_;
+}
+
+
+// The elements of an array are set up before the threads start, so that
+// reading one does not move the others.
+void 
+ParallelReader::readTasks( Reader &reader, ValueArena *arena )
+{
+   while ( !failed_ )
+   {
+      size_t next = nextTask_++;
+      if ( next >= tasks_.size() )
+         return;
+      const Task &task = tasks_[next];
+      Split &split = splits_[task.split_];
+      for ( size_t index = task.first_; index < task.last_; ++index )
+      {
+         Location begin = split.separators_[index] + 1;
+         Location end = split.separators_[index + 1];
+         Value &element = split.value_[ Value::UInt( index ) ];
+         bool ok = arena ? reader.parse( begin, end, element, *arena, false )
+                         : reader.parse( begin, end, element, false );
+         if ( !ok  ||  scanKernels().skipWhitespace( reader.current_, end ) != end )
+         {
+            failed_ = true;
+            return;
+         }
+      }
+   }
+}
+
+
+std::string 
+ParallelReader::getFormatedErrorMessages() const
+{
+   return reader_.getFormatedErrorMessages();
+}
+
+
+Reader::ErrorRecords 
+ParallelReader::getErrors() const
+{
+   return reader_.getErrors();
+}
+
+
 std::istream& operator>>( std::istream &sin, Value &root )
 {
     Json::Reader reader;
@@ -0,0 +1,351 @@
+// included by json_reader.cpp
+
+// Character scanning kernels used by Reader.
+//
+// Each kernel returns the first character of [current, end) that it stops at,
+// or end:
+// - scanString() stops at a quote, a backslash or a control character, the
+//   only characters of a string that are not simply copied;
+// - skipWhitespace() stops at anything but a space, tab, carriage return or
+//   line feed.
+// structureMasks() is not a scan but works alike: it flags, in 64-bit masks,
+// the quotes, the backslashes and the brackets, braces and commas of a block
+// of 64 characters, bit i for character i.
+// The vectorized versions test 16 (SSE2, NEON) or 32 (AVX2) characters at a
+// time and finish with the scalar version.  The widest one supported by the
+// CPU is chosen on first use.
+
+#if defined(__GNUC__)  &&  ( defined(__x86_64__)  ||  defined(__i386__) )
+# define JSON_SCAN_X86 1
+# include <immintrin.h>
+#elif defined(__GNUC__)  &&  defined(__aarch64__)  &&  defined(__ARM_NEON)
+# define JSON_SCAN_NEON 1
+# include <arm_neon.h>
+#endif
+
+namespace Json {
+
+typedef const char *(*ScanFunction)( const char *current, const char *end );
+
+struct StructureMasks
+{
+   UInt64 quotes_;
+   UInt64 backslashes_;
+   UInt64 structurals_;
+};
+
+enum { structureBlockSize = 64 };
+
+typedef void (*MaskFunction)( const char *block, StructureMasks &masks );
+
+struct ScanKernels
+{
+   ScanFunction scanString;
+   ScanFunction skipWhitespace;
+   MaskFunction structureMasks;
+};
+
+
+static inline bool
+isStringSpecial( char c )
+{
+   return c == '"'  ||  c == '\\'  ||  static_cast<unsigned char>( c ) < 0x20;
+}
+
+
+static inline bool
+isWhitespace( char c )
+{
+   return c == ' '  ||  c == '\t'  ||  c == '\r'  ||  c == '\n';
+}
+
+
+// Setting bit 5 maps '[' and ']' onto '{' and '}' and leaves ',' as it is,
+// so that three comparisons find the five characters.  It also maps a form
+// feed onto ',': callers check the character.
+static inline bool
+isStructural( char c )
+{
+   char folded = static_cast<char>( c | 0x20 );
+   return folded == '{'  ||  folded == '}'  ||  folded == ',';
+}
+
+
+// The index of the lowest bit set in mask, which is not 0.
+static inline int
+lowestBit( UInt64 mask )
+{
+#if defined(__GNUC__)
+   return __builtin_ctzll( mask );
+#else
+   int index = 0;
+   for ( ; !( mask & 1 ); mask >>= 1 )
+      ++index;
+   return index;
+#endif
+}
+
+
+static const char *
+scanStringScalar( const char *current, const char *end )
+{
+   while ( current != end  &&  !isStringSpecial( *current ) )
+      ++current;
+   return current;
+}
+
+
+static const char *
+skipWhitespaceScalar( const char *current, const char *end )
+{
+   while ( current != end  &&  isWhitespace( *current ) )
+      ++current;
+   return current;
+}
+
+
+static void
+structureMasksScalar( const char *block, StructureMasks &masks )
+{
+   masks.quotes_ = masks.backslashes_ = masks.structurals_ = 0;
+   for ( int index = 0; index < structureBlockSize; ++index )
+   {
+      UInt64 bit = UInt64( 1 ) << index;
+      char c = block[index];
+      if ( c == '"' )
+         masks.quotes_ |= bit;
+      else if ( c == '\\' )
+         masks.backslashes_ |= bit;
+      else if ( isStructural( c ) )
+         masks.structurals_ |= bit;
+   }
+}
+
+
+#ifdef JSON_SCAN_X86
+
+__attribute__(( target( "sse2" ) ))
+static const char *
+scanStringSSE2( const char *current, const char *end )
+{
+   const __m128i quote = _mm_set1_epi8( '"' );
+   const __m128i backslash = _mm_set1_epi8( '\\' );
+   const __m128i lastControl = _mm_set1_epi8( 0x1f );
+   for ( ; end - current >= 16; current += 16 )
+   {
+      __m128i chunk = _mm_loadu_si128( reinterpret_cast<const __m128i *>( current ) );
+      __m128i special = _mm_or_si128( _mm_cmpeq_epi8( chunk, quote ),
+                                      _mm_cmpeq_epi8( chunk, backslash ) );
+      special = _mm_or_si128( special,
+                              _mm_cmpeq_epi8( _mm_min_epu8( chunk, lastControl ), chunk ) );
+      unsigned int mask = static_cast<unsigned int>( _mm_movemask_epi8( special ) );
+      if ( mask )
+         return current + __builtin_ctz( mask );
+   }
+   return scanStringScalar( current, end );
+}
+
+
+__attribute__(( target( "sse2" ) ))
+static const char *
+skipWhitespaceSSE2( const char *current, const char *end )
+{
+   const __m128i space = _mm_set1_epi8( ' ' );
+   const __m128i tab = _mm_set1_epi8( '\t' );
+   const __m128i cr = _mm_set1_epi8( '\r' );
+   const __m128i lf = _mm_set1_epi8( '\n' );
+   for ( ; end - current >= 16; current += 16 )
+   {
+      __m128i chunk = _mm_loadu_si128( reinterpret_cast<const __m128i *>( current ) );
+      __m128i blank = _mm_or_si128( _mm_or_si128( _mm_cmpeq_epi8( chunk, space ),
+                                                  _mm_cmpeq_epi8( chunk, tab ) ),
+                                    _mm_or_si128( _mm_cmpeq_epi8( chunk, cr ),
+                                                  _mm_cmpeq_epi8( chunk, lf ) ) );
+      unsigned int mask = static_cast<unsigned int>( _mm_movemask_epi8( blank ) ) ^ 0xffffu;
+      if ( mask )
+         return current + __builtin_ctz( mask );
+   }
+   return skipWhitespaceScalar( current, end );
+}
+
+
+__attribute__(( target( "avx2" ) ))
+static const char *
+scanStringAVX2( const char *current, const char *end )
+{
+   const __m256i quote = _mm256_set1_epi8( '"' );
+   const __m256i backslash = _mm256_set1_epi8( '\\' );
+   const __m256i lastControl = _mm256_set1_epi8( 0x1f );
+   for ( ; end - current >= 32; current += 32 )
+   {
+      __m256i chunk = _mm256_loadu_si256( reinterpret_cast<const __m256i *>( current ) );
+      __m256i special = _mm256_or_si256( _mm256_cmpeq_epi8( chunk, quote ),
+                                         _mm256_cmpeq_epi8( chunk, backslash ) );
+      special = _mm256_or_si256( special,
+                                 _mm256_cmpeq_epi8( _mm256_min_epu8( chunk, lastControl ), chunk ) );
+      unsigned int mask = static_cast<unsigned int>( _mm256_movemask_epi8( special ) );
+      if ( mask )
+         return current + __builtin_ctz( mask );
+   }
+   return scanStringSSE2( current, end );
+}
+
+
+__attribute__(( target( "avx2" ) ))
+static const char *
+skipWhitespaceAVX2( const char *current, const char *end )
+{
+   const __m256i space = _mm256_set1_epi8( ' ' );
+   const __m256i tab = _mm256_set1_epi8( '\t' );
+   const __m256i cr = _mm256_set1_epi8( '\r' );
+   const __m256i lf = _mm256_set1_epi8( '\n' );
+   for ( ; end - current >= 32; current += 32 )
+   {
+      __m256i chunk = _mm256_loadu_si256( reinterpret_cast<const __m256i *>( current ) );
+      __m256i blank = _mm256_or_si256( _mm256_or_si256( _mm256_cmpeq_epi8( chunk, space ),
+                                                        _mm256_cmpeq_epi8( chunk, tab ) ),
+                                       _mm256_or_si256( _mm256_cmpeq_epi8( chunk, cr ),
+                                                        _mm256_cmpeq_epi8( chunk, lf ) ) );
+      unsigned int mask = ~static_cast<unsigned int>( _mm256_movemask_epi8( blank ) );
+      if ( mask )
+         return current + __builtin_ctz( mask );
+   }
+   return skipWhitespaceSSE2( current, end );
+}
+
+
+__attribute__(( target( "sse2" ) ))
+static void
+structureMasksSSE2( const char *block, StructureMasks &masks )
+{
+   const __m128i quote = _mm_set1_epi8( '"' );
+   const __m128i backslash = _mm_set1_epi8( '\\' );
+   const __m128i bit5 = _mm_set1_epi8( 0x20 );
+   const __m128i openBrace = _mm_set1_epi8( '{' );
+   const __m128i closeBrace = _mm_set1_epi8( '}' );
+   const __m128i comma = _mm_set1_epi8( ',' );
+   masks.quotes_ = masks.backslashes_ = masks.structurals_ = 0;
+   for ( int offset = 0; offset < structureBlockSize; offset += 16 )
+   {
+      __m128i chunk = _mm_loadu_si128( reinterpret_cast<const __m128i *>( block + offset ) );
+      __m128i folded = _mm_or_si128( chunk, bit5 );
+      __m128i structural = _mm_or_si128( _mm_or_si128( _mm_cmpeq_epi8( folded, openBrace ),
+                                                       _mm_cmpeq_epi8( folded, closeBrace ) ),
+                                         _mm_cmpeq_epi8( folded, comma ) );
+      unsigned int quotes = _mm_movemask_epi8( _mm_cmpeq_epi8( chunk, quote ) );
+      unsigned int backslashes = _mm_movemask_epi8( _mm_cmpeq_epi8( chunk, backslash ) );
+      masks.quotes_ |= UInt64( quotes ) << offset;
+      masks.backslashes_ |= UInt64( backslashes ) << offset;
+      masks.structurals_ |= UInt64( unsigned( _mm_movemask_epi8( structural ) ) ) << offset;
+   }
+}
+
+
+__attribute__(( target( "avx2" ) ))
+static void
+structureMasksAVX2( const char *block, StructureMasks &masks )
+{
+   const __m256i quote = _mm256_set1_epi8( '"' );
+   const __m256i backslash = _mm256_set1_epi8( '\\' );
+   const __m256i bit5 = _mm256_set1_epi8( 0x20 );
+   const __m256i openBrace = _mm256_set1_epi8( '{' );
+   const __m256i closeBrace = _mm256_set1_epi8( '}' );
+   const __m256i comma = _mm256_set1_epi8( ',' );
+   masks.quotes_ = masks.backslashes_ = masks.structurals_ = 0;
+   for ( int offset = 0; offset < structureBlockSize; offset += 32 )
+   {
+      __m256i chunk = _mm256_loadu_si256( reinterpret_cast<const __m256i *>( block + offset ) );
+      __m256i folded = _mm256_or_si256( chunk, bit5 );
+      __m256i structural = _mm256_or_si256( _mm256_or_si256( _mm256_cmpeq_epi8( folded, openBrace ),
+                                                             _mm256_cmpeq_epi8( folded, closeBrace ) ),
+                                            _mm256_cmpeq_epi8( folded, comma ) );
+      unsigned int quotes = _mm256_movemask_epi8( _mm256_cmpeq_epi8( chunk, quote ) );
+      unsigned int backslashes = _mm256_movemask_epi8( _mm256_cmpeq_epi8( chunk, backslash ) );
+      masks.quotes_ |= UInt64( quotes ) << offset;
+      masks.backslashes_ |= UInt64( backslashes ) << offset;
+      masks.structurals_ |= UInt64( unsigned( _mm256_movemask_epi8( structural ) ) ) << offset;
+   }
+}
+
+#endif // ifdef JSON_SCAN_X86
+
+
+#ifdef JSON_SCAN_NEON
+
+// NEON has no movemask: a block with a hit is finished by the scalar version.
+
+static const char *
+scanStringNEON( const char *current, const char *end )
+{
+   const uint8x16_t quote = vdupq_n_u8( '"' );
+   const uint8x16_t backslash = vdupq_n_u8( '\\' );
+   const uint8x16_t lastControl = vdupq_n_u8( 0x1f );
+   for ( ; end - current >= 16; current += 16 )
+   {
+      uint8x16_t chunk = vld1q_u8( reinterpret_cast<const uint8_t *>( current ) );
+      uint8x16_t special = vorrq_u8( vorrq_u8( vceqq_u8( chunk, quote ),
+                                               vceqq_u8( chunk, backslash ) ),
+                                     vcleq_u8( chunk, lastControl ) );
+      if ( vmaxvq_u8( special ) )
+         return scanStringScalar( current, current + 16 );
+   }
+   return scanStringScalar( current, end );
+}
+
+
+static const char *
+skipWhitespaceNEON( const char *current, const char *end )
+{
+   const uint8x16_t space = vdupq_n_u8( ' ' );
+   const uint8x16_t tab = vdupq_n_u8( '\t' );
+   const uint8x16_t cr = vdupq_n_u8( '\r' );
+   const uint8x16_t lf = vdupq_n_u8( '\n' );
+   for ( ; end - current >= 16; current += 16 )
+   {
+      uint8x16_t chunk = vld1q_u8( reinterpret_cast<const uint8_t *>( current ) );
+      uint8x16_t blank = vorrq_u8( vorrq_u8( vceqq_u8( chunk, space ), vceqq_u8( chunk, tab ) ),
+                                   vorrq_u8( vceqq_u8( chunk, cr ), vceqq_u8( chunk, lf ) ) );
+      if ( vminvq_u8( blank ) == 0 )
+         return skipWhitespaceScalar( current, current + 16 );
+   }
+   return skipWhitespaceScalar( current, end );
+}
+
+#endif // ifdef JSON_SCAN_NEON
+
+
+static ScanKernels
+selectScanKernels()
+{
+   // NEON has no movemask either: the masks are built by the scalar version.
+   ScanKernels kernels = { scanStringScalar, skipWhitespaceScalar, structureMasksScalar };
+#if defined(JSON_SCAN_X86)
+   __builtin_cpu_init();
+   if ( __builtin_cpu_supports( "avx2" ) )
+   {
+      kernels.scanString = scanStringAVX2;
+      kernels.skipWhitespace = skipWhitespaceAVX2;
+      kernels.structureMasks = structureMasksAVX2;
+   }
+   else if ( __builtin_cpu_supports( "sse2" ) )
+   {
+      kernels.scanString = scanStringSSE2;
+      kernels.skipWhitespace = skipWhitespaceSSE2;
+      kernels.structureMasks = structureMasksSSE2;
+   }
+#elif defined(JSON_SCAN_NEON)
+   kernels.scanString = scanStringNEON;
+   kernels.skipWhitespace = skipWhitespaceNEON;
+#endif
+   return kernels;
+}
+
+
+static const ScanKernels &
+scanKernels()
+{
+   static const ScanKernels kernels = selectScanKernels();
+   return kernels;
+}
+
+} // namespace Json
@@ -5,6 +5,13 @@
 #include <stdexcept>
 #include <cstring>
 #include <cassert>
+#include <algorithm>
+#include <tuple>
+#include <mutex>
+#include <unordered_map>
+#ifdef JSON_COUNT_ALLOCATIONS
+# include <atomic>
+#endif
 #ifdef JSON_USE_CPPTL
 # include <cpptl/conststring.h>
 #endif
@@ -26,6 +33,9 @@ const Value Value::null;
 const Int Value::minInt = Int( ~(UInt(-1)/2) );
 const Int Value::maxInt = Int( UInt(-1)/2 );
 const UInt Value::maxUInt = UInt(-1);
+const Int64 Value::minInt64 = Int64( ~(UInt64(-1)/2) );
+const Int64 Value::maxInt64 = Int64( UInt64(-1)/2 );
+const UInt64 Value::maxUInt64 = UInt64(-1);
 
 // A "safe" implementation of strdup. Allow null pointer to be passed. 
 // Also avoid warning on msvc80.
@@ -55,6 +65,71 @@ const UInt Value::maxUInt = UInt(-1);
 //   return 0;
 //}
 
+#ifdef JSON_COUNT_ALLOCATIONS
+// Relaxed: the counts are only summed, never used to order anything.
+static std::atomic<UInt64> allocatedStrings;
+static std::atomic<UInt64> allocatedStringBytes;
+static std::atomic<UInt64> allocatedContainers;
+static std::atomic<UInt64> allocatedBlocks;
+static std::atomic<UInt64> allocatedBlockBytes;
+
+static void countAllocation( std::atomic<UInt64> &count, std::atomic<UInt64> *bytes, size_t size )
+{
+   count.fetch_add( 1, std::memory_order_relaxed );
+   if ( bytes )
+      bytes->fetch_add( size, std::memory_order_relaxed );
+}
+
+// Counts what is allocated from the default resource through it.
+class CountingResource : public std::pmr::memory_resource
+{
+private:
+   virtual void *do_allocate( size_t bytes, size_t alignment )
+   {
+      countAllocation( allocatedBlocks, &allocatedBlockBytes, bytes );
+      return std::pmr::get_default_resource()->allocate( bytes, alignment );
+   }
+
+   virtual void do_deallocate( void *p, size_t bytes, size_t alignment )
+   {
+      std::pmr::get_default_resource()->deallocate( p, bytes, alignment );
+   }
+
+   virtual bool do_is_equal( const std::pmr::memory_resource &other ) const noexcept
+   {
+      return this == &other;
+   }
+};
+
+AllocationStats 
+allocationStats()
+{
+   AllocationStats stats;
+   stats.strings_ = allocatedStrings.load( std::memory_order_relaxed );
+   stats.stringBytes_ = allocatedStringBytes.load( std::memory_order_relaxed );
+   stats.containers_ = allocatedContainers.load( std::memory_order_relaxed );
+   stats.blocks_ = allocatedBlocks.load( std::memory_order_relaxed );
+   stats.blockBytes_ = allocatedBlockBytes.load( std::memory_order_relaxed );
+   return stats;
+}
+
+# define JSON_COUNT_ALLOCATION( count, bytes, size ) countAllocation( count, bytes, size )
+#else
+# define JSON_COUNT_ALLOCATION( count, bytes, size )
+#endif // JSON_COUNT_ALLOCATIONS
+
+// The resource the heap allocated containers and the arenas draw from.
+static std::pmr::memory_resource *heapResource()
+{
+#ifdef JSON_COUNT_ALLOCATIONS
+   static CountingResource resource;
+   return &resource;
+#else
+   return std::pmr::get_default_resource();
+#endif
+}
+
+
 ValueAllocator::~ValueAllocator()
 {
 }
@@ -85,6 +160,7 @@ public:
 
       if ( length == unknown )
          length = (unsigned int)strlen(value);
+      JSON_COUNT_ALLOCATION( allocatedStrings, &allocatedStringBytes, length + 1 );
       char *newString = static_cast<char *>( malloc( length + 1 ) );
       memcpy( newString, value, length );
       newString[length] = 0;
@@ -113,6 +189,69 @@ static struct DummyValueAllocatorInitializer {
 } dummyValueAllocatorInitializer;
 
 
+// //////////////////////////////////////////////////////////////////
+// //////////////////////////////////////////////////////////////////
+// //////////////////////////////////////////////////////////////////
+// class ValueArena
+// //////////////////////////////////////////////////////////////////
+// //////////////////////////////////////////////////////////////////
+// //////////////////////////////////////////////////////////////////
+
+ValueArena::ValueArena( size_t initialSize )
+   : resource_( initialSize, heapResource() )
+{
+}
+
+
+std::pmr::memory_resource *
+ValueArena::resource()
+{
+   return &resource_;
+}
+
+
+void *
+ValueArena::allocate( size_t size, size_t alignment )
+{
+   return resource_.allocate( size, alignment );
+}
+
+
+char *
+ValueArena::duplicate( const char *value, size_t length )
+{
+   char *newString = static_cast<char *>( resource_.allocate( length + 1, 1 ) );
+   memcpy( newString, value, length );
+   newString[length] = 0;
+   return newString;
+}
+
+
+char *
+ValueArena::adopt( std::string &&document )
+{
+   documents_.push_back( std::move( document ) );
+   return &documents_.back()[0];
+}
+
+
+void 
+ValueArena::release()
+{
+   subArenas_.clear();
+   documents_.clear();
+   resource_.release();
+}
+
+
+ValueArena &
+ValueArena::subArena()
+{
+   subArenas_.emplace_back();
+   return subArenas_.back();
+}
+
+
 
 // //////////////////////////////////////////////////////////////////
 // //////////////////////////////////////////////////////////////////
@@ -162,6 +301,83 @@ Value::CommentInfo::setComment( const char *text )
 }
 
 
+// //////////////////////////////////////////////////////////////////
+// //////////////////////////////////////////////////////////////////
+// //////////////////////////////////////////////////////////////////
+// class Value::CommentTable
+// //////////////////////////////////////////////////////////////////
+// //////////////////////////////////////////////////////////////////
+// //////////////////////////////////////////////////////////////////
+
+/*! \internal Comments of all the values that have some, by address.
+ * Only values with commented_ set have an entry, so that values without
+ * comments, nearly all of them, never look the table up.  An entry follows its
+ * value when the value is moved.
+ */
+struct Value::CommentTable
+{
+   static CommentTable &instance()
+   {
+      // Never destroyed: static values may be destroyed after it would be.
+      static CommentTable *table = new CommentTable;
+      return *table;
+   }
+
+   std::mutex mutex_;
+   std::unordered_map<const Value *, CommentInfo *> comments_;
+};
+
+
+Value::CommentInfo *
+Value::comments() const
+{
+   CommentTable &table = CommentTable::instance();
+   std::lock_guard<std::mutex> lock( table.mutex_ );
+   return table.comments_.find( this )->second;
+}
+
+
+void 
+Value::swapComments( Value &other )
+{
+   CommentTable &table = CommentTable::instance();
+   std::lock_guard<std::mutex> lock( table.mutex_ );
+   CommentInfo *mine = 0;
+   CommentInfo *others = 0;
+   if ( commented_ )
+   {
+      mine = table.comments_[this];
+      table.comments_.erase( this );
+   }
+   if ( other.commented_ )
+   {
+      others = table.comments_[&other];
+      table.comments_.erase( &other );
+   }
+   if ( others )
+      table.comments_[this] = others;
+   if ( mine )
+      table.comments_[&other] = mine;
+   commented_ = others != 0;
+   other.commented_ = mine != 0;
+}
+
+
+void 
+Value::releaseComments()
+{
+   CommentTable &table = CommentTable::instance();
+   CommentInfo *comments;
+   {
+      std::lock_guard<std::mutex> lock( table.mutex_ );
+      comments = table.comments_[this];
+      table.comments_.erase( this );
+   }
+   delete[] comments;
+   commented_ = 0;
+}
+
+
 // //////////////////////////////////////////////////////////////////
 // //////////////////////////////////////////////////////////////////
 // //////////////////////////////////////////////////////////////////
@@ -196,6 +412,13 @@ Value::CZString::CZString( const CZString &other )
 {
 }
 
+Value::CZString::CZString( CZString &&other ) noexcept
+   : cstr_( other.cstr_ )
+   , index_( other.index_ )
+{
+   other.cstr_ = 0;
+}
+
 Value::CZString::~CZString()
 {
    if ( cstr_  &&  index_ == duplicate )
@@ -217,6 +440,14 @@ Value::CZString::operator =( const CZString &other )
    return *this;
 }
 
+Value::CZString &
+Value::CZString::operator =( CZString &&other ) noexcept
+{
+   CZString temp( std::move( other ) );
+   swap( temp );
+   return *this;
+}
+
 bool 
 Value::CZString::operator<( const CZString &other ) const 
 {
@@ -253,6 +484,10 @@ Value::CZString::isStaticString() const
    return index_ == noDuplication;
 }
 
+# if !defined(JSON_USE_CPPTL_SMALLMAP)  &&  !defined(JSON_VALUE_USE_STD_MAP)
+#  include "json_objectmap.inl"
+# endif
+
 #endif // ifndef JSON_VALUE_USE_INTERNAL_MAP
 
 
@@ -271,7 +506,9 @@ Value::CZString::isStaticString() const
 Value::Value( ValueType type )
    : type_( type )
    , allocated_( 0 )
-   , comments_( 0 )
+   , arena_( 0 )
+   , short_( 0 )
+   , commented_( 0 )
 # ifdef JSON_VALUE_USE_INTERNAL_MAP
    , itemIsUsed_( 0 )
 #endif
@@ -293,7 +530,8 @@ Value::Value( ValueType type )
 #ifndef JSON_VALUE_USE_INTERNAL_MAP
    case arrayValue:
    case objectValue:
-      value_.map_ = new ObjectValues();
+      JSON_COUNT_ALLOCATION( allocatedContainers, 0, 0 );
+      value_.map_ = new ObjectValues( heapResource() );
       break;
 #else
    case arrayValue:
@@ -314,7 +552,10 @@ Value::Value( ValueType type )
 
 Value::Value( Int value )
    : type_( intValue )
-   , comments_( 0 )
+   , allocated_( 0 )
+   , arena_( 0 )
+   , short_( 0 )
+   , commented_( 0 )
 # ifdef JSON_VALUE_USE_INTERNAL_MAP
    , itemIsUsed_( 0 )
 #endif
@@ -325,7 +566,38 @@ Value::Value( Int value )
 
 Value::Value( UInt value )
    : type_( uintValue )
-   , comments_( 0 )
+   , allocated_( 0 )
+   , arena_( 0 )
+   , short_( 0 )
+   , commented_( 0 )
+# ifdef JSON_VALUE_USE_INTERNAL_MAP
+   , itemIsUsed_( 0 )
+#endif
+{
+   value_.uint_ = value;
+}
+
+
+Value::Value( Int64 value )
+   : type_( intValue )
+   , allocated_( 0 )
+   , arena_( 0 )
+   , short_( 0 )
+   , commented_( 0 )
+# ifdef JSON_VALUE_USE_INTERNAL_MAP
+   , itemIsUsed_( 0 )
+#endif
+{
+   value_.int_ = value;
+}
+
+
+Value::Value( UInt64 value )
+   : type_( uintValue )
+   , allocated_( 0 )
+   , arena_( 0 )
+   , short_( 0 )
+   , commented_( 0 )
 # ifdef JSON_VALUE_USE_INTERNAL_MAP
    , itemIsUsed_( 0 )
 #endif
@@ -335,7 +607,10 @@ Value::Value( UInt value )
 
 Value::Value( double value )
    : type_( realValue )
-   , comments_( 0 )
+   , allocated_( 0 )
+   , arena_( 0 )
+   , short_( 0 )
+   , commented_( 0 )
 # ifdef JSON_VALUE_USE_INTERNAL_MAP
    , itemIsUsed_( 0 )
 #endif
@@ -345,47 +620,46 @@ Value::Value( double value )
 
 Value::Value( const char *value )
    : type_( stringValue )
-   , allocated_( true )
-   , comments_( 0 )
+   , arena_( 0 )
+   , commented_( 0 )
 # ifdef JSON_VALUE_USE_INTERNAL_MAP
    , itemIsUsed_( 0 )
 #endif
 {
-   value_.string_ = valueAllocator()->duplicateStringValue( value );
+   setString( value, (unsigned int)strlen( value ) );
 }
 
 
 Value::Value( const char *beginValue, 
               const char *endValue )
    : type_( stringValue )
-   , allocated_( true )
-   , comments_( 0 )
+   , arena_( 0 )
+   , commented_( 0 )
 # ifdef JSON_VALUE_USE_INTERNAL_MAP
    , itemIsUsed_( 0 )
 #endif
 {
-   value_.string_ = valueAllocator()->duplicateStringValue( beginValue, 
-                                                            UInt(endValue - beginValue) );
+   setString( beginValue, UInt(endValue - beginValue) );
 }
 
 
 Value::Value( const std::string &value )
    : type_( stringValue )
-   , allocated_( true )
-   , comments_( 0 )
+   , arena_( 0 )
+   , commented_( 0 )
 # ifdef JSON_VALUE_USE_INTERNAL_MAP
    , itemIsUsed_( 0 )
 #endif
 {
-   value_.string_ = valueAllocator()->duplicateStringValue( value.c_str(), 
-                                                            (unsigned int)value.length() );
-
+   setString( value.c_str(), (unsigned int)value.length() );
 }
 
 Value::Value( const StaticString &value )
    : type_( stringValue )
    , allocated_( false )
-   , comments_( 0 )
+   , arena_( 0 )
+   , short_( 0 )
+   , commented_( 0 )
 # ifdef JSON_VALUE_USE_INTERNAL_MAP
    , itemIsUsed_( 0 )
 #endif
@@ -397,19 +671,22 @@ Value::Value( const StaticString &value )
 # ifdef JSON_USE_CPPTL
 Value::Value( const CppTL::ConstString &value )
    : type_( stringValue )
-   , allocated_( true )
-   , comments_( 0 )
+   , arena_( 0 )
+   , commented_( 0 )
 # ifdef JSON_VALUE_USE_INTERNAL_MAP
    , itemIsUsed_( 0 )
 #endif
 {
-   value_.string_ = valueAllocator()->duplicateStringValue( value, value.length() );
+   setString( value, value.length() );
 }
 # endif
 
 Value::Value( bool value )
    : type_( booleanValue )
-   , comments_( 0 )
+   , allocated_( 0 )
+   , arena_( 0 )
+   , short_( 0 )
+   , commented_( 0 )
 # ifdef JSON_VALUE_USE_INTERNAL_MAP
    , itemIsUsed_( 0 )
 #endif
@@ -418,9 +695,36 @@ Value::Value( bool value )
 }
 
 
+Value::Value( ValueType type, ValueArena &arena )
+   : type_( nullValue )
+   , allocated_( 0 )
+   , arena_( 0 )
+   , short_( 0 )
+   , commented_( 0 )
+# ifdef JSON_VALUE_USE_INTERNAL_MAP
+   , itemIsUsed_( 0 )
+#endif
+{
+#ifndef JSON_VALUE_USE_INTERNAL_MAP
+   if ( type == arrayValue  ||  type == objectValue )
+   {
+      void *map = arena.allocate( sizeof(ObjectValues), alignof(ObjectValues) );
+      value_.map_ = new (map) ObjectValues( arena.resource() );
+      type_ = type;
+      arena_ = 1;
+      return;
+   }
+#endif
+   Value( type ).swap( *this );
+}
+
+
 Value::Value( const Value &other )
    : type_( other.type_ )
-   , comments_( 0 )
+   , allocated_( 0 )
+   , arena_( 0 )
+   , short_( 0 )
+   , commented_( 0 )
 # ifdef JSON_VALUE_USE_INTERNAL_MAP
    , itemIsUsed_( 0 )
 #endif
@@ -435,18 +739,23 @@ Value::Value( const Value &other )
       value_ = other.value_;
       break;
    case stringValue:
-      if ( other.value_.string_ )
+      if ( other.short_ )
       {
-         value_.string_ = valueAllocator()->duplicateStringValue( other.value_.string_ );
-         allocated_ = true;
+         copyPayload( other );
+         short_ = 1;
       }
+      else if ( other.value_.string_ )
+         setString( other.value_.string_, (unsigned int)strlen( other.value_.string_ ) );
       else
          value_.string_ = 0;
       break;
 #ifndef JSON_VALUE_USE_INTERNAL_MAP
    case arrayValue:
    case objectValue:
-      value_.map_ = new ObjectValues( *other.value_.map_ );
+      JSON_COUNT_ALLOCATION( allocatedContainers, 0, 0 );
+      // Assigned rather than copy constructed, which would take the default resource.
+      value_.map_ = new ObjectValues( heapResource() );
+      *value_.map_ = *other.value_.map_;
       break;
 #else
    case arrayValue:
@@ -459,19 +768,39 @@ Value::Value( const Value &other )
    default:
       JSON_ASSERT_UNREACHABLE;
    }
-   if ( other.comments_ )
+   if ( other.commented_ )
    {
-      comments_ = new CommentInfo[numberOfCommentPlacement];
+      const CommentInfo *otherComments = other.comments();
       for ( int comment =0; comment < numberOfCommentPlacement; ++comment )
       {
-         const CommentInfo &otherComment = other.comments_[comment];
-         if ( otherComment.comment_ )
-            comments_[comment].setComment( otherComment.comment_ );
+         if ( otherComments[comment].comment_ )
+            setComment( otherComments[comment].comment_, CommentPlacement( comment ) );
       }
    }
 }
 
 
+Value::Value( Value &&other ) noexcept
+   : type_( other.type_ )
+   , allocated_( other.allocated_ )
+   , arena_( other.arena_ )
+   , short_( other.short_ )
+   , commented_( 0 )
+# ifdef JSON_VALUE_USE_INTERNAL_MAP
+   , itemIsUsed_( 0 )
+   , memberNameIsStatic_( 0 )
+#endif
+{
+   copyPayload( other );
+   if ( other.commented_ )
+      swapComments( other );
+   other.type_ = nullValue;
+   other.allocated_ = 0;
+   other.arena_ = 0;
+   other.short_ = 0;
+}
+
+
 Value::~Value()
 {
    switch ( type_ )
@@ -489,7 +818,10 @@ Value::~Value()
 #ifndef JSON_VALUE_USE_INTERNAL_MAP
    case arrayValue:
    case objectValue:
-      delete value_.map_;
+      if ( arena_ )
+         value_.map_->~ObjectValues();
+      else
+         delete value_.map_;
       break;
 #else
    case arrayValue:
@@ -503,8 +835,8 @@ Value::~Value()
       JSON_ASSERT_UNREACHABLE;
    }
 
-   if ( comments_ )
-      delete[] comments_;
+   if ( commented_ )
+      releaseComments();
 }
 
 Value &
@@ -515,16 +847,71 @@ Value::operator=( const Value &other )
    return *this;
 }
 
+Value &
+Value::operator=( Value &&other ) noexcept
+{
+   // As with a copy, the value keeps its own comments: the Reader sets the
+   // comment before a value, then assigns the value.
+   Value temp( std::move( other ) );
+   swap( temp );
+   return *this;
+}
+
 void 
 Value::swap( Value &other )
 {
    ValueType temp = type_;
    type_ = other.type_;
    other.type_ = temp;
-   std::swap( value_, other.value_ );
+   char payload[shortStringSize];
+   memcpy( payload, shortString_, shortStringSize );
+   copyPayload( other );
+   memcpy( other.shortString_, payload, shortStringSize );
    int temp2 = allocated_;
    allocated_ = other.allocated_;
    other.allocated_ = temp2;
+   unsigned int temp3 = arena_;
+   arena_ = other.arena_;
+   other.arena_ = temp3;
+   temp3 = short_;
+   short_ = other.short_;
+   other.short_ = temp3;
+}
+
+
+// Strings shorter than shortStringSize are held in place.  Hex encoded hashes,
+// 64 characters, are not: holding them would make every value 72 bytes.
+void 
+Value::setString( const char *value, unsigned int length )
+{
+   if ( length < shortStringSize )
+   {
+      memcpy( shortString_, value, length );
+      shortString_[length] = 0;
+      allocated_ = 0;
+      short_ = 1;
+   }
+   else
+   {
+      value_.string_ = valueAllocator()->duplicateStringValue( value, length );
+      allocated_ = 1;
+      short_ = 0;
+   }
+}
+
+
+// Copies the value however it is held: scalar, pointer or short string.
+void 
+Value::copyPayload( const Value &other )
+{
+   memcpy( shortString_, other.shortString_, shortStringSize );
+}
+
+
+const char *
+Value::stringData() const
+{
+   return short_ ? shortString_ : value_.string_;
 }
 
 ValueType 
@@ -583,10 +970,10 @@ Value::operator <( const Value &other ) const
    case booleanValue:
       return value_.bool_ < other.value_.bool_;
    case stringValue:
-      return ( value_.string_ == 0  &&  other.value_.string_ )
-             || ( other.value_.string_  
-                  &&  value_.string_  
-                  && strcmp( value_.string_, other.value_.string_ ) < 0 );
+      return ( stringData() == 0  &&  other.stringData() )
+             || ( other.stringData()  
+                  &&  stringData()  
+                  && strcmp( stringData(), other.stringData() ) < 0 );
 #ifndef JSON_VALUE_USE_INTERNAL_MAP
    case arrayValue:
    case objectValue:
@@ -649,10 +1036,10 @@ Value::operator ==( const Value &other ) const
    case booleanValue:
       return value_.bool_ == other.value_.bool_;
    case stringValue:
-      return ( value_.string_ == other.value_.string_ )
-             || ( other.value_.string_  
-                  &&  value_.string_  
-                  && strcmp( value_.string_, other.value_.string_ ) == 0 );
+      return ( stringData() == other.stringData() )
+             || ( other.stringData()  
+                  &&  stringData()  
+                  && strcmp( stringData(), other.stringData() ) == 0 );
 #ifndef JSON_VALUE_USE_INTERNAL_MAP
    case arrayValue:
    case objectValue:
@@ -680,7 +1067,7 @@ const char *
 Value::asCString() const
 {
    JSON_ASSERT( type_ == stringValue );
-   return value_.string_;
+   return stringData();
 }
 
 
@@ -692,7 +1079,7 @@ Value::asString() const
    case nullValue:
       return "";
    case stringValue:
-      return value_.string_ ? value_.string_ : "";
+      return stringData() ? stringData() : "";
    case booleanValue:
       return value_.bool_ ? "true" : "false";
    case intValue:
@@ -724,17 +1111,18 @@ Value::asInt() const
    case nullValue:
       return 0;
    case intValue:
-      return value_.int_;
+      JSON_ASSERT_MESSAGE( value_.int_ >= minInt  &&  value_.int_ <= maxInt, "integer out of signed integer range" );
+      return Int( value_.int_ );
    case uintValue:
       JSON_ASSERT_MESSAGE( value_.uint_ < (unsigned)maxInt, "integer out of signed integer range" );
-      return value_.uint_;
+      return Int( value_.uint_ );
    case realValue:
       JSON_ASSERT_MESSAGE( value_.real_ >= minInt  &&  value_.real_ <= maxInt, "Real out of signed integer range" );
       return Int( value_.real_ );
    case booleanValue:
       return value_.bool_ ? 1 : 0;
    case stringValue:
-	    return boost::lexical_cast<int>(value_.string_);
+	    return boost::lexical_cast<int>(stringData());
    case arrayValue:
    case objectValue:
       JSON_ASSERT_MESSAGE( false, "Type is not convertible to int" );
@@ -753,16 +1141,74 @@ Value::asUInt() const
       return 0;
    case intValue:
       JSON_ASSERT_MESSAGE( value_.int_ >= 0, "Negative integer can not be converted to unsigned integer" );
-      return value_.int_;
+      JSON_ASSERT_MESSAGE( value_.int_ <= maxUInt, "integer out of unsigned integer range" );
+      return UInt( value_.int_ );
    case uintValue:
-      return value_.uint_;
+      JSON_ASSERT_MESSAGE( value_.uint_ <= maxUInt, "integer out of unsigned integer range" );
+      return UInt( value_.uint_ );
    case realValue:
       JSON_ASSERT_MESSAGE( value_.real_ >= 0  &&  value_.real_ <= maxUInt,  "Real out of unsigned integer range" );
       return UInt( value_.real_ );
    case booleanValue:
       return value_.bool_ ? 1 : 0;
    case stringValue:
-	   return boost::lexical_cast<unsigned int>(value_.string_);
+	   return boost::lexical_cast<unsigned int>(stringData());
+   case arrayValue:
+   case objectValue:
+      JSON_ASSERT_MESSAGE( false, "Type is not convertible to uint" );
+   default:
+      JSON_ASSERT_UNREACHABLE;
+   }
+   return 0; // unreachable;
+}
+
+Value::Int64 
+Value::asInt64() const
+{
+   switch ( type_ )
+   {
+   case nullValue:
+      return 0;
+   case intValue:
+      return value_.int_;
+   case uintValue:
+      JSON_ASSERT_MESSAGE( value_.uint_ <= UInt64(maxInt64), "integer out of signed integer range" );
+      return Int64( value_.uint_ );
+   case realValue:
+      JSON_ASSERT_MESSAGE( value_.real_ >= double(minInt64)  &&  value_.real_ < double(maxInt64), "Real out of signed integer range" );
+      return Int64( value_.real_ );
+   case booleanValue:
+      return value_.bool_ ? 1 : 0;
+   case stringValue:
+	    return boost::lexical_cast<Int64>(stringData());
+   case arrayValue:
+   case objectValue:
+      JSON_ASSERT_MESSAGE( false, "Type is not convertible to int" );
+   default:
+      JSON_ASSERT_UNREACHABLE;
+   }
+   return 0; // unreachable;
+}
+
+Value::UInt64 
+Value::asUInt64() const
+{
+   switch ( type_ )
+   {
+   case nullValue:
+      return 0;
+   case intValue:
+      JSON_ASSERT_MESSAGE( value_.int_ >= 0, "Negative integer can not be converted to unsigned integer" );
+      return UInt64( value_.int_ );
+   case uintValue:
+      return value_.uint_;
+   case realValue:
+      JSON_ASSERT_MESSAGE( value_.real_ >= 0  &&  value_.real_ < double(maxUInt64), "Real out of unsigned integer range" );
+      return UInt64( value_.real_ );
+   case booleanValue:
+      return value_.bool_ ? 1 : 0;
+   case stringValue:
+	   return boost::lexical_cast<UInt64>(stringData());
    case arrayValue:
    case objectValue:
       JSON_ASSERT_MESSAGE( false, "Type is not convertible to uint" );
@@ -812,7 +1258,7 @@ Value::asBool() const
    case booleanValue:
       return value_.bool_;
    case stringValue:
-      return value_.string_  &&  value_.string_[0] != 0;
+      return stringData()  &&  stringData()[0] != 0;
    case arrayValue:
    case objectValue:
       return value_.map_->size() != 0;
@@ -832,15 +1278,15 @@ Value::isConvertibleTo( ValueType other ) const
       return true;
    case intValue:
       return ( other == nullValue  &&  value_.int_ == 0 )
-             || other == intValue
-             || ( other == uintValue  && value_.int_ >= 0 )
+             || ( other == intValue  &&  value_.int_ >= minInt  &&  value_.int_ <= maxInt )
+             || ( other == uintValue  &&  value_.int_ >= 0  &&  value_.int_ <= maxUInt )
              || other == realValue
              || other == stringValue
              || other == booleanValue;
    case uintValue:
       return ( other == nullValue  &&  value_.uint_ == 0 )
              || ( other == intValue  && value_.uint_ <= (unsigned)maxInt )
-             || other == uintValue
+             || ( other == uintValue  &&  value_.uint_ <= maxUInt )
              || other == realValue
              || other == stringValue
              || other == booleanValue;
@@ -860,7 +1306,7 @@ Value::isConvertibleTo( ValueType other ) const
              || other == booleanValue;
    case stringValue:
       return other == stringValue
-             || ( other == nullValue  &&  (!value_.string_  ||  value_.string_[0] == 0) );
+             || ( other == nullValue  &&  (!stringData()  ||  stringData()[0] == 0) );
    case arrayValue:
       return other == arrayValue
              ||  ( other == nullValue  &&  value_.map_->size() == 0 );
@@ -985,13 +1431,7 @@ Value::operator[]( UInt index )
       *this = Value( arrayValue );
 #ifndef JSON_VALUE_USE_INTERNAL_MAP
    CZString key( index );
-   ObjectValues::iterator it = value_.map_->lower_bound( key );
-   if ( it != value_.map_->end()  &&  (*it).first == key )
-      return (*it).second;
-
-   ObjectValues::value_type defaultValue( key, null );
-   it = value_.map_->insert( it, defaultValue );
-   return (*it).second;
+   return (*value_.map_->try_emplace( key ).first).second;
 #else
    return value_.array_->resolveReference( index );
 #endif
@@ -1034,20 +1474,29 @@ Value::resolveReference( const char *key,
 #ifndef JSON_VALUE_USE_INTERNAL_MAP
    CZString actualKey( key, isStatic ? CZString::noDuplication 
                                      : CZString::duplicateOnCopy );
-   ObjectValues::iterator it = value_.map_->lower_bound( actualKey );
-   if ( it != value_.map_->end()  &&  (*it).first == actualKey )
-      return (*it).second;
-
-   ObjectValues::value_type defaultValue( actualKey, null );
-   it = value_.map_->insert( it, defaultValue );
-   Value &value = (*it).second;
-   return value;
+   return (*value_.map_->try_emplace( actualKey ).first).second;
 #else
    return value_.map_->resolveReference( key, isStatic );
 #endif
 }
 
 
+Value &
+Value::resolveArenaReference( const char *key )
+{
+#ifndef JSON_VALUE_USE_INTERNAL_MAP
+   JSON_ASSERT( type_ == nullValue  ||  type_ == objectValue );
+   if ( type_ == nullValue )
+      *this = Value( objectValue );
+   CZString actualKey( key, CZString::duplicateOnCopy );
+   // Moving the key keeps it pointing into the arena: only its copies own a string.
+   return (*value_.map_->try_emplace( std::move( actualKey ) ).first).second;
+#else
+   return resolveReference( key, false );
+#endif
+}
+
+
 Value 
 Value::get( UInt index, 
             const Value &defaultValue ) const
@@ -1104,6 +1553,37 @@ Value::operator[]( const StaticString &key )
 }
 
 
+Value &
+Value::operator[]( const StaticKey &key )
+{
+#ifdef JSON_VALUE_USE_OBJECT_MAP
+   JSON_ASSERT( type_ == nullValue  ||  type_ == objectValue );
+   if ( type_ == nullValue )
+      *this = Value( objectValue );
+   return (*value_.map_->try_emplace( key ).first).second;
+#else
+   return resolveReference( key.c_str(), true );
+#endif
+}
+
+
+const Value &
+Value::operator[]( const StaticKey &key ) const
+{
+#ifdef JSON_VALUE_USE_OBJECT_MAP
+   JSON_ASSERT( type_ == nullValue  ||  type_ == objectValue );
+   if ( type_ == nullValue )
+      return null;
+   ObjectValues::const_iterator it = value_.map_->find( key );
+   if ( it == value_.map_->end() )
+      return null;
+   return (*it).second;
+#else
+   return (*this)[ key.c_str() ];
+#endif
+}
+
+
 # ifdef JSON_USE_CPPTL
 Value &
 Value::operator[]( const CppTL::ConstString &key )
@@ -1143,6 +1623,15 @@ Value::get( const std::string &key,
    return get( key.c_str(), defaultValue );
 }
 
+
+Value 
+Value::get( const StaticKey &key,
+            const Value &defaultValue ) const
+{
+   const Value *value = &((*this)[key]);
+   return value == &null ? defaultValue : *value;
+}
+
 Value
 Value::removeMember( const char* key )
 {
@@ -1199,6 +1688,14 @@ Value::isMember( const std::string &key ) const
 }
 
 
+bool 
+Value::isMember( const StaticKey &key ) const
+{
+   const Value *value = &((*this)[key]);
+   return value != &null;
+}
+
+
 # ifdef JSON_USE_CPPTL
 bool 
 Value::isMember( const CppTL::ConstString &key ) const
@@ -1333,9 +1830,14 @@ void
 Value::setComment( const char *comment,
                    CommentPlacement placement )
 {
-   if ( !comments_ )
-      comments_ = new CommentInfo[numberOfCommentPlacement];
-   comments_[placement].setComment( comment );
+   if ( !commented_ )
+   {
+      CommentTable &table = CommentTable::instance();
+      std::lock_guard<std::mutex> lock( table.mutex_ );
+      table.comments_[this] = new CommentInfo[numberOfCommentPlacement];
+      commented_ = 1;
+   }
+   comments()[placement].setComment( comment );
 }
 
 
@@ -1350,14 +1852,14 @@ Value::setComment( const std::string &comment,
 bool 
 Value::hasComment( CommentPlacement placement ) const
 {
-   return comments_ != 0  &&  comments_[placement].comment_ != 0;
+   return commented_  &&  comments()[placement].comment_ != 0;
 }
 
 std::string 
 Value::getComment( CommentPlacement placement ) const
 {
    if ( hasComment(placement) )
-      return comments_[placement].comment_;
+      return comments()[placement].comment_;
    return "";
 }
 
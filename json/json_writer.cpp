@@ -3,6 +3,7 @@
 #include <assert.h>
 #include <stdio.h>
 #include <string.h>
+#include <charconv>
 #include <iostream>
 #include <sstream>
 #include <iomanip>
@@ -27,7 +28,7 @@ static bool containsControlCharacter( const char* str )
    }
    return false;
 }
-static void uintToString( unsigned int value, 
+static void uintToString( UInt64 value, 
                           char *&current )
 {
    *--current = 0;
@@ -40,13 +41,24 @@ static void uintToString( unsigned int value,
 }
 
 std::string valueToString( Int value )
+{
+   return valueToString( Int64( value ) );
+}
+
+
+std::string valueToString( UInt value )
+{
+   return valueToString( UInt64( value ) );
+}
+
+
+std::string valueToString( Int64 value )
 {
    char buffer[32];
    char *current = buffer + sizeof(buffer);
    bool isNegative = value < 0;
-   if ( isNegative )
-      value = -value;
-   uintToString( UInt(value), current );
+   // Negated as unsigned, so that minInt64 works too
+   uintToString( isNegative ? UInt64(0) - UInt64(value) : UInt64(value), current );
    if ( isNegative )
       *--current = '-';
    assert( current >= buffer );
@@ -54,7 +66,7 @@ std::string valueToString( Int value )
 }
 
 
-std::string valueToString( UInt value )
+std::string valueToString( UInt64 value )
 {
    char buffer[32];
    char *current = buffer + sizeof(buffer);
@@ -63,43 +75,34 @@ std::string valueToString( UInt value )
    return current;
 }
 
+// Longest "%f" output: 309 integer digits, with a sign, a point and 6 decimals
+enum { doubleBufferSize = 320 };
+
+// Format value as sprintf( "%#f" ) does, then truncate the trailing zeroes
+// to save bytes in output, but keep one.  Returns the end of the text.
+static char *formatDouble( char *buffer, double value )
+{
+   std::to_chars_result result = std::to_chars( buffer, buffer + doubleBufferSize, value, 
+                                                std::chars_format::fixed, 6 );
+   char *end = result.ptr;
+   if ( end[-1] != '0' )
+      return end;
+   char *lastNonZero = end - 1;
+   while ( lastNonZero > buffer  &&  *lastNonZero == '0' )
+      --lastNonZero;
+   char *digits = lastNonZero + 1;
+   while ( digits != buffer  &&  digits[-1] >= '0'  &&  digits[-1] <= '9' )
+      --digits;
+   if ( digits != buffer  &&  digits[-1] == '.' )
+      return lastNonZero + 2;
+   return end;
+}
+
+
 std::string valueToString( double value )
 {
-   char buffer[32];
-#if defined(_MSC_VER) && defined(__STDC_SECURE_LIB__) // Use secure version with visual studio 2005 to avoid warning. 
-   sprintf_s(buffer, sizeof(buffer), "%#f", value);
-#else	
-   sprintf(buffer, "%#f", value);
-#endif
-   char* ch = buffer + strlen(buffer) - 1;
-   if (*ch != '0') return buffer; // nothing to truncate, so save time
-   while(ch > buffer && *ch == '0'){
-     --ch;
-   }
-   char* last_nonzero = ch;
-   while(ch >= buffer){
-     switch(*ch){
-     case '0':
-     case '1':
-     case '2':
-     case '3':
-     case '4':
-     case '5':
-     case '6':
-     case '7':
-     case '8':
-     case '9':
-       --ch;
-       continue;
-     case '.':
-       // Truncate zeroes to save bytes in output, but keep one.
-       *(last_nonzero+2) = '\0';
-       return buffer;
-     default:
-       return buffer;
-     }
-   }
-   return buffer;
+   char buffer[doubleBufferSize];
+   return std::string( buffer, formatDouble( buffer, value ) );
 }
 
 
@@ -171,6 +174,49 @@ std::string valueToQuotedString( const char *value )
    return result;
 }
 
+static void appendQuotedString( std::string &document, const char *value )
+{
+   static const char hexDigits[] = "0123456789ABCDEF";
+   document += '"';
+   const char *run = value;
+   for ( const char *c = value; ; ++c )
+   {
+      if ( *c != 0  &&  *c != '"'  &&  *c != '\\'  &&  !isControlCharacter( *c ) )
+         continue;
+      document.append( run, c );
+      run = c + 1;
+      switch ( *c )
+      {
+      case 0:
+         document += '"';
+         return;
+      case '"':  document += "\\\""; break;
+      case '\\': document += "\\\\"; break;
+      case '\b': document += "\\b"; break;
+      case '\f': document += "\\f"; break;
+      case '\n': document += "\\n"; break;
+      case '\r': document += "\\r"; break;
+      case '\t': document += "\\t"; break;
+      default:
+         {
+            char escape[] = { '\\', 'u', '0', '0', hexDigits[(*c >> 4) & 0xf], hexDigits[*c & 0xf] };
+            document.append( escape, sizeof(escape) );
+         }
+         break;
+      }
+   }
+}
+
+
+template<typename Integer>
+static void appendInteger( std::string &document, Integer value )
+{
+   char buffer[24];
+   std::to_chars_result result = std::to_chars( buffer, buffer + sizeof(buffer), value );
+   document.append( buffer, result.ptr );
+}
+
+
 // Class Writer
 // //////////////////////////////////////////////////////////////////
 Writer::~Writer()
@@ -197,66 +243,79 @@ FastWriter::enableYAMLCompatibility()
 std::string 
 FastWriter::write( const Value &root )
 {
-   document_ = "";
-   writeValue( root );
-   document_ += "\n";
-   return document_;
+   std::string document;
+   write( root, document );
+   return document;
 }
 
 
 void 
-FastWriter::writeValue( const Value &value )
+FastWriter::write( const Value &root, std::string &document )
+{
+   writeValue( root, document );
+   document += '\n';
+}
+
+
+// Numbers and strings are formatted straight into document, and containers
+// are walked with iterators rather than by looking their elements up.
+void 
+FastWriter::writeValue( const Value &value, std::string &document )
 {
    switch ( value.type() )
    {
    case nullValue:
-      document_ += "null";
+      document += "null";
       break;
    case intValue:
-      document_ += valueToString( value.asInt() );
+      appendInteger( document, value.asInt64() );
       break;
    case uintValue:
-      document_ += valueToString( value.asUInt() );
+      appendInteger( document, value.asUInt64() );
       break;
    case realValue:
-      document_ += valueToString( value.asDouble() );
+      {
+         char buffer[doubleBufferSize];
+         document.append( buffer, formatDouble( buffer, value.asDouble() ) );
+      }
       break;
    case stringValue:
-      document_ += valueToQuotedString( value.asCString() );
+      appendQuotedString( document, value.asCString() );
       break;
    case booleanValue:
-      document_ += valueToString( value.asBool() );
+      document += value.asBool() ? "true" : "false";
       break;
    case arrayValue:
       {
-         document_ += "[";
-         int size = value.size();
-         for ( int index =0; index < size; ++index )
+         document += '[';
+         // Elements never assigned are not stored, and are written as null
+         Value::UInt index = 0;
+         for ( Value::const_iterator it = value.begin(); it != value.end(); ++it, ++index )
          {
+            for ( ; index < it.index(); ++index )
+               document += index > 0 ? ",null" : "null";
             if ( index > 0 )
-               document_ += ",";
-            writeValue( value[index] );
+               document += ',';
+            writeValue( *it, document );
          }
-         document_ += "]";
+         for ( Value::UInt size = value.size(); index < size; ++index )
+            document += index > 0 ? ",null" : "null";
+         document += ']';
       }
       break;
    case objectValue:
       {
-         Value::Members members( value.getMemberNames() );
-         document_ += "{";
-         for ( Value::Members::iterator it = members.begin(); 
-               it != members.end(); 
-               ++it )
+         document += '{';
+         for ( Value::const_iterator it = value.begin(); it != value.end(); ++it )
          {
-            const std::string &name = *it;
-            if ( it != members.begin() )
-               document_ += ",";
-            document_ += valueToQuotedString( name.c_str() );
-            document_ += yamlCompatiblityEnabled_ ? ": " 
-                                                  : ":";
-            writeValue( value[name] );
+            if ( it != value.begin() )
+               document += ',';
+            appendQuotedString( document, it.memberName() );
+            document += yamlCompatiblityEnabled_ ? ": " 
+                                                 : ":";
+            writeValue( *it, document );
          }
-         document_ += "}";
+         document += '}';
       }
       break;
    }
@@ -296,10 +355,10 @@ StyledWriter::writeValue( const Value &value )
       pushValue( "null" );
       break;
    case intValue:
-      pushValue( valueToString( value.asInt() ) );
+      pushValue( valueToString( value.asInt64() ) );
       break;
    case uintValue:
-      pushValue( valueToString( value.asUInt() ) );
+      pushValue( valueToString( value.asUInt64() ) );
       break;
    case realValue:
       pushValue( valueToString( value.asDouble() ) );
@@ -572,10 +631,10 @@ StyledStreamWriter::writeValue( const Value &value )
       pushValue( "null" );
       break;
    case intValue:
-      pushValue( valueToString( value.asInt() ) );
+      pushValue( valueToString( value.asInt64() ) );
       break;
    case uintValue:
-      pushValue( valueToString( value.asUInt() ) );
+      pushValue( valueToString( value.asUInt64() ) );
       break;
    case realValue:
       pushValue( valueToString( value.asDouble() ) );
@@ -818,6 +877,133 @@ StyledStreamWriter::normalizeEOL( const std::string &text )
 }
 
 
+// Class StreamingWriter
+// //////////////////////////////////////////////////////////////////
+
+StreamingWriter::StreamingWriter( std::ostream &out, bool compact, std::string indentation )
+   : out_( &out )
+   , compact_( compact )
+   , styledWriter_( indentation )
+{
+   styledWriter_.document_ = &out;
+   styledWriter_.addChildValues_ = false;
+}
+
+
+void 
+StreamingWriter::beginObject()
+{
+   begin( false );
+}
+
+
+void 
+StreamingWriter::beginArray()
+{
+   begin( true );
+}
+
+
+void 
+StreamingWriter::name( const std::string &name )
+{
+   assert( !containers_.empty()  &&  !containers_.back().isArray_ );
+   name_ = name;
+}
+
+
+void 
+StreamingWriter::value( const Value &value )
+{
+   beginValue();
+   if ( compact_ )
+   {
+      buffer_.clear();
+      fastWriter_.write( value, buffer_ );
+      buffer_.resize( buffer_.size() - 1 ); // the new line ending a document
+      *out_ << buffer_;
+   }
+   else
+      styledWriter_.writeValue( value );
+   if ( containers_.empty() )
+      *out_ << "\n";
+}
+
+
+void 
+StreamingWriter::end()
+{
+   assert( !containers_.empty() );
+   Container container = containers_.back();
+   containers_.pop_back();
+   const char *close = container.isArray_ ? "]" : "}";
+   if ( compact_ )
+      *out_ << close;
+   else if ( container.empty_ )
+      *out_ << ( container.isArray_ ? "[]" : "{}" );
+   else
+   {
+      styledWriter_.unindent();
+      styledWriter_.writeWithIndent( close );
+   }
+   if ( containers_.empty() )
+      *out_ << "\n";
+}
+
+
+// In styled output a container is opened with its first element, as
+// StyledStreamWriter writes an empty one on the line of its name.
+void 
+StreamingWriter::begin( bool isArray )
+{
+   beginValue();
+   Container container = { isArray, true };
+   containers_.push_back( container );
+   if ( compact_ )
+      *out_ << ( isArray ? '[' : '{' );
+}
+
+
+// Writes what comes before the next value of the innermost container.
+void 
+StreamingWriter::beginValue()
+{
+   if ( containers_.empty() )
+      return;
+   Container &container = containers_.back();
+   if ( compact_ )
+   {
+      buffer_.clear();
+      if ( !container.empty_ )
+         buffer_ += ',';
+      if ( !container.isArray_ )
+      {
+         appendQuotedString( buffer_, name_.c_str() );
+         buffer_ += ':';
+      }
+      *out_ << buffer_;
+   }
+   else
+   {
+      if ( container.empty_ )
+      {
+         styledWriter_.writeWithIndent( container.isArray_ ? "[" : "{" );
+         styledWriter_.indent();
+      }
+      else
+         *out_ << ",";
+      if ( container.isArray_ )
+         styledWriter_.writeIndent();
+      else
+      {
+         styledWriter_.writeWithIndent( valueToQuotedString( name_.c_str() ) );
+         *out_ << " : ";
+      }
+   }
+   container.empty_ = false;
+}
+
+
 std::ostream& operator<<( std::ostream &sout, const Value &root )
 {
    Json::StyledStreamWriter writer;
@@ -3,9 +3,11 @@
 
 # include "features.h"
 # include "value.h"
+# include <atomic>
 # include <deque>
 # include <stack>
 # include <string>
+# include <vector>
 # include <iostream>
 
 namespace Json {
@@ -15,10 +17,49 @@ namespace Json {
     */
    class JSON_API Reader
    {
+      friend class StreamParser;
+      friend class ParallelReader;
    public:
       typedef char Char;
       typedef const Char *Location;
 
+      /// What an error found while parsing is about.
+      /// \see getErrorMessage()
+      enum ErrorCode
+      {
+         errorSyntax = 0,              ///< No value where one is expected.
+         errorBadRoot,                 ///< Root is neither an array nor an object (Features::strictRoot_).
+         errorMissingColon,            ///< No ':' after a member name.
+         errorMissingObjectSeparator,  ///< No ',' or '}' after a member.
+         errorMissingMemberName,       ///< No member name or '}' in an object.
+         errorMissingArraySeparator,   ///< No ',' or ']' after an element.
+         errorBadNumber,               ///< A number that does not parse.
+         errorEmptyEscape,             ///< A string ending with a backslash.
+         errorBadEscape,               ///< An unknown escape sequence.
+         errorShortSurrogatePair,      ///< A high surrogate too close to the end of the string.
+         errorBadSurrogatePair,        ///< A high surrogate not followed by a \\u escape.
+         errorShortUnicodeEscape,      ///< Less than four digits after \\u.
+         errorBadUnicodeDigit,         ///< Something else than an hexadecimal digit after \\u.
+         errorUnexpectedEnd,           ///< The document ends in the middle of a value (StreamParser).
+         errorExtraText,               ///< Something else than comments after the document (StreamParser).
+         errorCodeCount
+      };
+
+      /** \brief An error found while parsing: nothing but what and where.
+       * Errors are recorded this way, and only turned into text by
+       * getFormatedErrorMessages().
+       */
+      struct ErrorRecord
+      {
+         ErrorCode code_;
+         /// Of the token in error, from the beginning of the document.
+         size_t offset_;
+      };
+      typedef std::vector<ErrorRecord> ErrorRecords;
+
+      /// The message getFormatedErrorMessages() gives for an error code.
+      static const char *getErrorMessage( ErrorCode code );
+
       /** \brief Constructs a Reader allowing all features
        * for parsing.
        */
@@ -26,6 +67,11 @@ namespace Json {
 
       /** \brief Constructs a Reader allowing the specified feature set
        * for parsing.
+       *
+       * If comments are not allowed (see Features::strictMode()), documents are
+       * read by a separate parser that only knows strict JSON: it never looks
+       * for comments, keeps the containers it is in on an explicit stack rather
+       * than recursing, and stops at the first error.
        */
       Reader( const Features &features );
 
@@ -57,6 +103,30 @@ namespace Json {
                   Value &root,
                   bool collectComments = true );
 
+      /** \brief Read a Value from a <a HREF="http://www.json.org">JSON</a> document,
+       * allocating its strings, member names and containers from arena.
+       * root must be destroyed or reassigned before arena is.
+       * \see parse( const char *, const char *, Value &, bool ), ValueArena
+       */
+      bool parse( const char *beginDoc, const char *endDoc, 
+                  Value &root,
+                  ValueArena &arena,
+                  bool collectComments = true );
+
+      /** \brief Read a Value from a <a HREF="http://www.json.org">JSON</a> document
+       * in place, without copying it or its strings.
+       *
+       * arena takes ownership of document, and the strings and member names of
+       * root point into it: each one is terminated over its closing quote, and
+       * only those holding escape sequences are rewritten, also in place.
+       * Containers are allocated from arena.
+       * root must be destroyed or reassigned before arena is.
+       */
+      bool parse( std::string &&document,
+                  Value &root,
+                  ValueArena &arena,
+                  bool collectComments = true );
+
       /// \brief Parse from input stream.
       /// \see Json::operator>>(std::istream&, Json::Value&).
       bool parse( std::istream &is,
@@ -70,6 +140,9 @@ namespace Json {
        */
       std::string getFormatedErrorMessages() const;
 
+      /// The errors found in the parsed document, in the order they were found.
+      ErrorRecords getErrors() const;
+
    private:
       enum TokenType
       {
@@ -101,13 +174,22 @@ namespace Json {
       {
       public:
          Token token_;
-         std::string message_;
+         ErrorCode code_;
          Location extra_;
       };
 
       typedef std::deque<ErrorInfo> Errors;
 
-      bool expectToken( TokenType type, Token &token, const char *message );
+      /// An array read ahead of the document, and moved in as the strict
+      /// parser reaches it (see ParallelReader).
+      struct Graft
+      {
+         Location begin_;     ///< The opening bracket.
+         Location end_;       ///< After the closing bracket.
+         Value *value_;
+      };
+
+      bool expectToken( TokenType type, Token &token, ErrorCode code );
       bool readToken( Token &token );
       void skipSpaces();
       bool match( Location pattern, 
@@ -120,10 +202,18 @@ namespace Json {
       bool readValue();
       bool readObject( Token &token );
       bool readArray( Token &token );
+      bool readDocument( const char *beginDoc, const char *endDoc, 
+                         Value &root,
+                         bool collectComments );
+      bool readStrictDocument( Value &root );
+      Value *readStrictMember( Value &object );
+      bool addStrictError( ErrorCode code, Location start );
       bool decodeNumber( Token &token );
+      bool decodeNumber( Token &token, Value &decoded );
       bool decodeString( Token &token );
       bool decodeString( Token &token, std::string &decoded );
-      bool decodeDouble( Token &token );
+      bool decodeStringInPlace( Token &token, char *&decoded );
+      bool decodeDouble( Token &token, Value &decoded );
       bool decodeUnicodeCodePoint( Token &token, 
                                    Location &current, 
                                    Location end, 
@@ -132,11 +222,11 @@ namespace Json {
                                         Location &current, 
                                         Location end, 
                                         unsigned int &unicode );
-      bool addError( const std::string &message, 
+      bool addError( ErrorCode code, 
                      Token &token,
                      Location extra = 0 );
       bool recoverFromError( TokenType skipUntilToken );
-      bool addErrorAndRecover( const std::string &message, 
+      bool addErrorAndRecover( ErrorCode code, 
                                Token &token,
                                TokenType skipUntilToken );
       void skipUntilSpace();
@@ -146,6 +236,9 @@ namespace Json {
                                      int &line,
                                      int &column ) const;
       std::string getLocationLineAndColumn( Location location ) const;
+      static std::string formatErrorMessage( ErrorCode code, 
+                                             Location start, 
+                                             Location end );
       void addComment( Location begin, 
                        Location end, 
                        CommentPlacement placement );
@@ -153,6 +246,9 @@ namespace Json {
    
       typedef std::stack<Value *> Nodes;
       Nodes nodes_;
+      typedef std::vector<Value *> Containers;
+      Containers containers_;
+      std::string memberName_;
       Errors errors_;
       std::string document_;
       Location begin_;
@@ -162,9 +258,239 @@ namespace Json {
       Value *lastValue_;
       std::string commentsBefore_;
       Features features_;
+      ValueArena *arena_;
+      const Graft *grafts_;     ///< The next graft, in document order.
+      const Graft *graftsEnd_;
+      bool inSitu_;
       bool collectComments_;
    };
 
+   /** \brief Receives the events of a streamed parse.
+    *
+    * Each handler returns \c false to stop the parse.
+    * The default handlers ignore their event.
+    * \see StreamParser
+    */
+   class JSON_API ParseHandler
+   {
+   public:
+      virtual ~ParseHandler();
+
+      virtual bool startObject();
+      virtual bool endObject();
+      virtual bool startArray();
+      virtual bool endArray();
+      /// Decoded member name, only valid during the call.
+      virtual bool key( const char *begin, const char *end );
+      /// Decoded string value, only valid during the call.
+      virtual bool string( const char *begin, const char *end );
+      /// \c value is an #intValue, #uintValue or #realValue.
+      virtual bool number( const Value &value );
+      virtual bool boolean( bool value );
+      virtual bool null();
+   };
+
+   /** \brief ParseHandler building the Value of the document, as Reader does.
+    *
+    * Comments are not collected.
+    */
+   class JSON_API ValueBuilder : public ParseHandler
+   {
+   public:
+      ValueBuilder();
+
+      /// The document read so far.
+      Value &root();
+
+      /// Forget the document, to build a new one.
+      void reset();
+
+      virtual bool startObject();
+      virtual bool endObject();
+      virtual bool startArray();
+      virtual bool endArray();
+      virtual bool key( const char *begin, const char *end );
+      virtual bool string( const char *begin, const char *end );
+      virtual bool number( const Value &value );
+      virtual bool boolean( bool value );
+      virtual bool null();
+
+   private:
+      Value &nextValue();
+      bool startContainer( ValueType type );
+
+      std::vector<Value *> nodes_;
+      std::string key_;
+      Value root_;
+   };
+
+   /** \brief Event-driven <a HREF="http://www.json.org">JSON</a> parser.
+    *
+    * Reports the content of a document to a ParseHandler as it is read, without
+    * building a Value tree.  The document can be fed in chunks of any size, as
+    * they arrive: a token split across chunks is kept until it is complete,
+    * so only the tail of the last chunk is ever buffered.
+    * \code
+    * Json::StreamParser parser( handler );
+    * while ( ... )
+    *    if ( !parser.feed( chunk, chunk + size ) )
+    *       break;
+    * bool ok = parser.finish();
+    * \endcode
+    */
+   class JSON_API StreamParser
+   {
+   public:
+      StreamParser( ParseHandler &handler, 
+                    const Features &features = Features::all() );
+
+      /** \brief Parse the next chunk of the document.
+       * \return \c false if an error was found or the handler stopped the parse.
+       *         No further chunk should be fed then.
+       */
+      bool feed( const char *begin, const char *end );
+
+      /** \brief Signal the end of the document.
+       * \return \c true if a whole document was parsed without error.
+       */
+      bool finish();
+
+      /// Forget any parse in progress, to start a new document.
+      void reset();
+
+      /// \c true once the handler returned \c false.
+      bool stopped() const;
+
+      /// Like Reader::getFormatedErrorMessages(), but errors are located
+      /// by their offset in the document.
+      std::string getFormatedErrorMessages() const;
+
+      /// The error that failed the parse, if any.
+      Reader::ErrorRecords getErrors() const;
+
+   private:
+      typedef Reader::Token Token;
+
+      enum State
+      {
+         stateValue = 0,      // a value
+         stateFirstElement,   // a value or ']'
+         stateFirstMember,    // a member name or '}'
+         stateMember,         // a member name
+         stateColon,          // ':'
+         stateNext,           // ',' or the end of the current container
+         stateDone,           // nothing but comments
+         stateFailed
+      };
+
+      bool parse( const char *begin, const char *end, bool final );
+      bool mayContinue( const Token &token ) const;
+      bool handleToken( Token &token );
+      bool handleValue( Token &token );
+      bool endContainer();
+      bool endValue();
+      bool decodeString( Token &token );
+      bool addError( Reader::ErrorCode code, const Token &token );
+      bool notify( bool handled );
+
+      ParseHandler &handler_;
+      Reader reader_;
+      std::string pending_;
+      std::string decoded_;
+      Reader::ErrorRecords errors_;
+      std::string errorText_;  // of the number in error, gone with its chunk
+      std::vector<char> containers_;
+      State state_;
+      size_t offset_;          // of the text being parsed in the document
+      bool stopped_;
+   };
+
+   /** \brief Reads a <a HREF="http://www.json.org">JSON</a> document on several threads.
+    *
+    * The document is first scanned for its structure alone: brackets, braces, commas and
+    * the ends of strings.  The elements of each array of at least minArraySize() bytes, the
+    * outermost ones, are then read on worker threads by Readers of their own, and the rest
+    * of the document is read as Reader reads it, with those arrays moved into their place.
+    * When the document is read into an arena, each thread allocates from a sub-arena of it
+    * (see ValueArena::subArena()).
+    *
+    * The Value read is the one Reader reads, with the same errors: if an element does not
+    * read, the document is read again by a single Reader, to find them in order.
+    * Documents are only split when comments are not allowed: with Features::all(), a
+    * ParallelReader is a Reader.
+    * \code
+    * Json::ParallelReader reader;
+    * if ( !reader.parse( document.data(), document.data() + document.size(), root, arena ) )
+    *    std::cerr << reader.getFormatedErrorMessages();
+    * \endcode
+    * \sa Reader
+    */
+   class JSON_API ParallelReader
+   {
+   public:
+      /** \param threads Number of threads reading the elements, the calling one included,
+       *                 or 0 for one per core.
+       */
+      ParallelReader( const Features &features = Features::strictMode(),
+                      unsigned int threads = 0 );
+
+      /// Split the arrays of at least bytes bytes (default 256 KiB).
+      void setMinArraySize( size_t bytes );
+      size_t minArraySize() const;
+
+      /// \see Reader::parse( const char *, const char *, Value &, bool )
+      bool parse( const char *beginDoc, const char *endDoc,
+                  Value &root );
+
+      /// \see Reader::parse( const char *, const char *, Value &, ValueArena &, bool )
+      bool parse( const char *beginDoc, const char *endDoc,
+                  Value &root,
+                  ValueArena &arena );
+
+      /// \see Reader::getFormatedErrorMessages()
+      std::string getFormatedErrorMessages() const;
+
+      /// \see Reader::getErrors()
+      Reader::ErrorRecords getErrors() const;
+
+   private:
+      typedef Reader::Location Location;
+
+      /// An array read on the worker threads.
+      struct Split
+      {
+         Location begin_;                     ///< The opening bracket.
+         Location end_;                       ///< After the closing bracket.
+         std::vector<Location> separators_;   ///< The bracket, the commas and the bracket.
+         Value value_;
+      };
+
+      /// Consecutive elements read by one thread in one go.
+      struct Task
+      {
+         size_t split_;
+         size_t first_;
+         size_t last_;
+      };
+
+      bool parse( const char *beginDoc, const char *endDoc,
+                  Value &root,
+                  ValueArena *arena );
+      bool scan( const char *beginDoc, const char *endDoc );
+      bool readSplits( ValueArena *arena );
+      void readTasks( Reader &reader, ValueArena *arena );
+
+      Reader reader_;
+      Features elementFeatures_;
+      unsigned int threads_;
+      size_t minArraySize_;
+      std::vector<Split> splits_;
+      std::vector<Task> tasks_;
+      std::vector<Location> separators_;
+      std::atomic<size_t> nextTask_;
+      std::atomic<bool> failed_;
+   };
+
    /** \brief Read from 'sin' into 'root'.
 
     Always keep comments from the input JSON.
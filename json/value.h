@@ -2,7 +2,10 @@
 # define CPPTL_JSON_H_INCLUDED
 
 # include "forwards.h"
+# include <list>
+# include <memory_resource>
 # include <string>
+# include <utility>
 # include <vector>
 
 # ifndef JSON_USE_CPPTL_SMALLMAP
@@ -81,11 +84,113 @@ namespace Json {
       const char *str_;
    };
 
+   /** \brief A StaticString used as a member name, with its hash computed once.
+    *
+    * Looking a member up with a StaticKey skips hashing the name. A member added
+    * with a StaticKey keeps a pointer to the name instead of a copy of it, and
+    * later lookups with the same StaticKey find it by comparing pointers.
+    * The string must outlive the values it names members of.
+    *
+    * Example of usage:
+    * \code
+    * static const StaticKey result("result");
+    * static const StaticKey statusKey("status");
+    * const Value &status = reply[result][statusKey];
+    * \endcode
+    */
+   class JSON_API StaticKey : public StaticString
+   {
+   public:
+      explicit StaticKey( const char *czstring )
+         : StaticString( czstring )
+         , hash_( hash( czstring ) )
+      {
+      }
+
+      unsigned int hash() const
+      {
+         return hash_;
+      }
+
+      /// FNV-1a, the hash Value uses for member names.
+      static unsigned int hash( const char *czstring )
+      {
+         unsigned int h = 2166136261u;
+         for ( ; *czstring; ++czstring )
+            h = ( h ^ static_cast<unsigned char>( *czstring ) ) * 16777619u;
+         return h;
+      }
+
+   private:
+      unsigned int hash_;
+   };
+
+   /** \brief Memory region for the strings, member names and containers of
+    * parsed documents.
+    *
+    * Reader::parse() can allocate a whole document from an arena: everything
+    * then comes from a few large blocks that are released at once when the
+    * arena is destroyed, instead of one heap allocation per string and per node.
+    * Values parsed into an arena must be destroyed or reassigned before it.
+    * Copies of such values are ordinary values and may outlive it.
+    * \code
+    * Json::ValueArena arena;
+    * Json::Value root;
+    * reader.parse( document, root, arena );
+    * \endcode
+    */
+   class JSON_API ValueArena
+   {
+   public:
+      explicit ValueArena( size_t initialSize = 4096 );
+      ValueArena( const ValueArena & ) = delete;
+      ValueArena &operator =( const ValueArena & ) = delete;
+
+      std::pmr::memory_resource *resource();
+      void *allocate( size_t size, size_t alignment );
+      /// Copy length bytes from value, and add a terminating zero.
+      char *duplicate( const char *value, size_t length );
+      /// Take ownership of document.  Its characters remain valid, and may
+      /// be written, until the arena is released.
+      char *adopt( std::string &&document );
+      /// Release all the memory allocated so far.
+      /// Any value still using it must have been destroyed.
+      void release();
+      /// A new arena, released with this one.  An arena is used by one thread
+      /// at a time: another thread can allocate from a sub-arena while this
+      /// one is in use.
+      ValueArena &subArena();
+
+   private:
+      std::pmr::monotonic_buffer_resource resource_;
+      std::list<std::string> documents_;
+      std::list<ValueArena> subArenas_;
+   };
+
+#ifdef JSON_COUNT_ALLOCATIONS
+   /** \brief The allocations made for values since the program started, by all threads.
+    *
+    * Arrays and objects allocated from a ValueArena are not counted one by one: the blocks
+    * of the arena are.
+    * \sa JSON_COUNT_ALLOCATIONS
+    */
+   struct AllocationStats
+   {
+      UInt64 strings_;        ///< Strings, member names and comments copied to the heap.
+      UInt64 stringBytes_;
+      UInt64 containers_;     ///< Arrays and objects allocated on the heap.
+      UInt64 blocks_;         ///< Storage for their elements, and the blocks of arenas.
+      UInt64 blockBytes_;
+   };
+
+   JSON_API AllocationStats allocationStats();
+#endif
+
    /** \brief Represents a <a HREF="http://www.json.org">JSON</a> value.
     *
     * This class is a discriminated union wrapper that can represents a:
-    * - signed integer [range: Value::minInt - Value::maxInt]
-    * - unsigned integer (range: 0 - Value::maxUInt)
+    * - signed integer [range: Value::minInt64 - Value::maxInt64]
+    * - unsigned integer (range: 0 - Value::maxUInt64)
     * - double
     * - UTF-8 string
     * - boolean
@@ -102,6 +207,9 @@ namespace Json {
     * The sequence of an #arrayValue will be automatically resize and initialized 
     * with #nullValue. resize() can be used to enlarge or truncate an #arrayValue.
     *
+    * As with std::map, a reference to an element or member stays valid until it is
+    * removed, whatever is added to or removed from the same array or object meanwhile.
+    *
     * The get() methods can be used to obtanis default value in the case the required element
     * does not exist.
     *
@@ -111,6 +219,8 @@ namespace Json {
    class JSON_API Value 
    {
       friend class ValueIteratorBase;
+      friend class Reader;
+      friend class CborReader;
 # ifdef JSON_VALUE_USE_INTERNAL_MAP
       friend class ValueInternalLink;
       friend class ValueInternalMap;
@@ -121,12 +231,17 @@ namespace Json {
       typedef ValueConstIterator const_iterator;
       typedef Json::UInt UInt;
       typedef Json::Int Int;
+      typedef Json::UInt64 UInt64;
+      typedef Json::Int64 Int64;
       typedef UInt ArrayIndex;
 
       static const Value null;
       static const Int minInt;
       static const Int maxInt;
       static const UInt maxUInt;
+      static const Int64 minInt64;
+      static const Int64 maxInt64;
+      static const UInt64 maxUInt64;
 
    private:
 #ifndef JSONCPP_DOC_EXCLUDE_IMPLEMENTATION
@@ -143,8 +258,10 @@ namespace Json {
          CZString( int index );
          CZString( const char *cstr, DuplicationPolicy allocate );
          CZString( const CZString &other );
+         CZString( CZString &&other ) noexcept;
          ~CZString();
          CZString &operator =( const CZString &other );
+         CZString &operator =( CZString &&other ) noexcept;
          bool operator<( const CZString &other ) const;
          bool operator==( const CZString &other ) const;
          int index() const;
@@ -157,11 +274,15 @@ namespace Json {
       };
 
    public:
-#  ifndef JSON_USE_CPPTL_SMALLMAP
-      typedef std::map<CZString, Value> ObjectValues;
-#  else
+#  if defined(JSON_USE_CPPTL_SMALLMAP)
       typedef CppTL::SmallMap<CZString, Value> ObjectValues;
-#  endif // ifndef JSON_USE_CPPTL_SMALLMAP
+#  elif defined(JSON_VALUE_USE_STD_MAP)
+      typedef std::pmr::map<CZString, Value> ObjectValues;
+#  else
+#   define JSON_VALUE_USE_OBJECT_MAP 1
+      class ObjectMap;
+      typedef ObjectMap ObjectValues;
+#  endif // if defined(JSON_USE_CPPTL_SMALLMAP)
 # endif // ifndef JSON_VALUE_USE_INTERNAL_MAP
 #endif // ifndef JSONCPP_DOC_EXCLUDE_IMPLEMENTATION
 
@@ -184,6 +305,8 @@ namespace Json {
       Value( ValueType type = nullValue );
       Value( Int value );
       Value( UInt value );
+      Value( Int64 value );
+      Value( UInt64 value );
       Value( double value );
       Value( const char *value );
       Value( const char *beginValue, const char *endValue );
@@ -203,10 +326,21 @@ namespace Json {
       Value( const CppTL::ConstString &value );
 # endif
       Value( bool value );
+      /** \brief Create a default Value of the given type allocated from arena.
+
+       * The nodes of an array or object, as well as the container itself, come
+       * from arena.  Other types are constructed as by Value( type ).
+       * \see ValueArena
+       */
+      Value( ValueType type, ValueArena &arena );
       Value( const Value &other );
+      /// Take over the content and comments of other, leaving it null.
+      /// No string or container is copied.
+      Value( Value &&other ) noexcept;
       ~Value();
 
       Value &operator=( const Value &other );
+      Value &operator=( Value &&other ) noexcept;
       /// Swap values.
       /// \note Currently, comments are intentionally not swapped, for
       /// both logic and efficiency.
@@ -231,6 +365,8 @@ namespace Json {
 # endif
       Int asInt() const;
       UInt asUInt() const;
+      Int64 asInt64() const;
+      UInt64 asUInt64() const;
       double asDouble() const;
       bool asBool() const;
 
@@ -310,6 +446,10 @@ namespace Json {
        * \endcode
        */
       Value &operator[]( const StaticString &key );
+      /// Same as operator[]( const StaticString & ), without hashing the name.
+      Value &operator[]( const StaticKey &key );
+      /// Access an object value by name, returns null if there is no member with that name.
+      const Value &operator[]( const StaticKey &key ) const;
 # ifdef JSON_USE_CPPTL
       /// Access an object value by name, create a null member if it does not exist.
       Value &operator[]( const CppTL::ConstString &key );
@@ -322,6 +462,9 @@ namespace Json {
       /// Return the member named key if it exist, defaultValue otherwise.
       Value get( const std::string &key,
                  const Value &defaultValue ) const;
+      /// Return the member named key if it exist, defaultValue otherwise.
+      Value get( const StaticKey &key,
+                 const Value &defaultValue ) const;
 # ifdef JSON_USE_CPPTL
       /// Return the member named key if it exist, defaultValue otherwise.
       Value get( const CppTL::ConstString &key,
@@ -341,6 +484,8 @@ namespace Json {
       bool isMember( const char *key ) const;
       /// Return true if the object has a member named key.
       bool isMember( const std::string &key ) const;
+      /// Return true if the object has a member named key.
+      bool isMember( const StaticKey &key ) const;
 # ifdef JSON_USE_CPPTL
       /// Return true if the object has a member named key.
       bool isMember( const CppTL::ConstString &key ) const;
@@ -379,6 +524,9 @@ namespace Json {
    private:
       Value &resolveReference( const char *key, 
                                bool isStatic );
+      /// Member key must remain valid for the lifetime of the value,
+      /// and is duplicated by copies.
+      Value &resolveArenaReference( const char *key );
 
 # ifdef JSON_VALUE_USE_INTERNAL_MAP
       inline bool isItemAvailable() const
@@ -422,10 +570,20 @@ namespace Json {
       //   }
       //};
 
+      struct CommentTable;
+
+      CommentInfo *comments() const;
+      void swapComments( Value &other );
+      void releaseComments();
+
+      const char *stringData() const;
+      void setString( const char *value, unsigned int length );
+      void copyPayload( const Value &other );
+
       union ValueHolder
       {
-         Int int_;
-         UInt uint_;
+         Int64 int_;
+         UInt64 uint_;
          double real_;
          bool bool_;
          char *string_;
@@ -435,17 +593,144 @@ namespace Json {
 #else
          ObjectValues *map_;
 # endif
-      } value_;
-      ValueType type_ : 8;
-      int allocated_ : 1;     // Notes: if declared as bool, bitfield is useless.
+      };
+
+      enum { shortStringSize = 14 };
+
+      // A Value is 16 bytes.  A string shorter than shortStringSize is held in
+      // shortString_, which overlays value_ and shortTail_, instead of being
+      // allocated.  Comments are kept in a side table (see CommentTable), so
+      // that values without any do not pay for a pointer to them.
+      union
+      {
+         struct
+         {
+            ValueHolder value_;
+            char shortTail_[shortStringSize - sizeof(ValueHolder)];
+            ValueType type_ : 8;
+            int allocated_ : 1;     // Notes: if declared as bool, bitfield is useless.
+            unsigned int arena_ : 1;           // container allocated from a ValueArena.
+            unsigned int short_ : 1;           // string held in shortString_.
+            unsigned int commented_ : 1;       // has an entry in the CommentTable.
 # ifdef JSON_VALUE_USE_INTERNAL_MAP
-      unsigned int itemIsUsed_ : 1;      // used by the ValueInternalMap container.
-      int memberNameIsStatic_ : 1;       // used by the ValueInternalMap container.
+            unsigned int itemIsUsed_ : 1;      // used by the ValueInternalMap container.
+            int memberNameIsStatic_ : 1;       // used by the ValueInternalMap container.
 # endif
-      CommentInfo *comments_;
+         };
+         char shortString_[shortStringSize];
+      };
    };
 
 
+#ifdef JSON_VALUE_USE_OBJECT_MAP
+   /** \brief Insertion ordered hash map used internally by Value to hold the
+    * members of an object or the elements of an array.
+    * \internal Each entry is a node of its own, as in a std::map, and a vector
+    * of pointers to them keeps them in insertion order. Once an object has more
+    * than a few members, an open addressing table of the positions of its
+    * members, probed linearly, makes lookups O(1); a small object is simply
+    * scanned. The elements of an array are kept sorted by index instead: they
+    * are nearly always appended, and element i is looked for at position i
+    * before falling back to a binary search.
+    *
+    * As with std::map, adding or removing an entry leaves the others where they
+    * are: a reference to a member stays valid until that member is removed.
+    *
+    * The interface is the part of std::map's that Value uses, so that
+    * JSON_VALUE_USE_STD_MAP can select std::map instead.
+    */
+   class JSON_API Value::ObjectMap
+   {
+   public:
+      typedef CZString key_type;
+      typedef Value mapped_type;
+      typedef std::pair<CZString, Value> value_type;
+      typedef std::pmr::vector<value_type *> Entries;
+      typedef Entries::size_type size_type;
+
+      /// Iterates over the entries, through the pointers of Entries.
+      template<typename Entry, typename Position>
+      class Iterator
+      {
+      public:
+         typedef std::ptrdiff_t difference_type;
+
+         Iterator() {}
+         explicit Iterator( Position position ) : position_( position ) {}
+         /// An iterator converts to a const_iterator.
+         template<typename OtherEntry, typename OtherPosition>
+         Iterator( const Iterator<OtherEntry, OtherPosition> &other ) : position_( other.position() ) {}
+
+         Entry &operator *() const { return **position_; }
+         Entry *operator ->() const { return *position_; }
+         Iterator &operator ++() { ++position_; return *this; }
+         Iterator &operator --() { --position_; return *this; }
+         Iterator operator +( difference_type n ) const { return Iterator( position_ + n ); }
+         difference_type operator -( const Iterator &other ) const { return position_ - other.position_; }
+         bool operator ==( const Iterator &other ) const { return position_ == other.position_; }
+         bool operator !=( const Iterator &other ) const { return position_ != other.position_; }
+
+         Position position() const { return position_; }
+
+      private:
+         Position position_;
+      };
+      typedef Iterator<value_type, Entries::iterator> iterator;
+      typedef Iterator<const value_type, Entries::const_iterator> const_iterator;
+
+      explicit ObjectMap( std::pmr::memory_resource *resource = std::pmr::get_default_resource() );
+      ObjectMap( const ObjectMap &other ) = delete;
+      ObjectMap &operator =( const ObjectMap &other );
+      ~ObjectMap();
+
+      iterator begin() { return iterator( entries_.begin() ); }
+      const_iterator begin() const { return const_iterator( entries_.begin() ); }
+      iterator end() { return iterator( entries_.end() ); }
+      const_iterator end() const { return const_iterator( entries_.end() ); }
+      size_type size() const { return entries_.size(); }
+      bool empty() const { return entries_.empty(); }
+
+      void clear();
+      iterator find( const CZString &key );
+      const_iterator find( const CZString &key ) const;
+      const_iterator find( const StaticKey &key ) const;
+      std::pair<iterator, bool> try_emplace( const CZString &key );
+      std::pair<iterator, bool> try_emplace( CZString &&key );
+      std::pair<iterator, bool> try_emplace( const StaticKey &key );
+      iterator erase( const_iterator position );
+      size_type erase( const CZString &key );
+
+      bool operator ==( const ObjectMap &other ) const;
+      bool operator <( const ObjectMap &other ) const;
+
+   private:
+      struct Slot
+      {
+         unsigned int position_;   // position + 1 in entries_, 0 if the slot is free.
+         unsigned int hash_;
+      };
+      enum { maxUnindexedSize = 8 };
+
+      size_type findPosition( const CZString &key ) const;
+      size_type findMember( const char *key, unsigned int hash ) const;
+      size_type findIndex( int index ) const;
+      Entries::const_iterator lowerBound( int index ) const;
+      template<typename Key>
+      std::pair<iterator, bool> emplace( Key &&key );
+      template<typename Key>
+      std::pair<iterator, bool> emplaceMember( const char *name, unsigned int hash, Key &&key );
+      template<typename... Args>
+      value_type *newEntry( Args &&... args );
+      void deleteEntry( value_type *entry );
+      void addSlot( size_type position, unsigned int hash );
+      void rebuildSlots();
+
+      Entries entries_;
+      std::pmr::vector<Slot> slots_;
+   };
+#endif
+
+
    /** \brief Experimental and untested: represents an element of the "path" to access a node.
     */
    class PathArgument
@@ -654,7 +939,9 @@ namespace Json {
 
       ValueInternalMap();
       ValueInternalMap( const ValueInternalMap &other );
+      ValueInternalMap( ValueInternalMap &&other ) noexcept;
       ValueInternalMap &operator =( const ValueInternalMap &other );
+      ValueInternalMap &operator =( ValueInternalMap &&other ) noexcept;
       ~ValueInternalMap();
 
       void swap( ValueInternalMap &other );
@@ -751,7 +1038,9 @@ namespace Json {
 
       ValueInternalArray();
       ValueInternalArray( const ValueInternalArray &other );
+      ValueInternalArray( ValueInternalArray &&other ) noexcept;
       ValueInternalArray &operator =( const ValueInternalArray &other );
+      ValueInternalArray &operator =( ValueInternalArray &&other ) noexcept;
       ~ValueInternalArray();
       void swap( ValueInternalArray &other );
 
@@ -34,13 +34,20 @@ namespace Json {
 
       void enableYAMLCompatibility();
 
+      /** \brief Append the serialization of root to document.
+       *
+       * Writes the same text as write(), but into a buffer owned by the caller,
+       * which can be reused from one document to the next: once it has grown
+       * to the size of the documents, writing one allocates nothing.
+       */
+      void write( const Value &root, std::string &document );
+
    public: // overridden from Writer
       virtual std::string write( const Value &root );
 
    private:
-      void writeValue( const Value &value );
+      void writeValue( const Value &value, std::string &document );
 
-      std::string document_;
       bool yamlCompatiblityEnabled_;
    };
 
@@ -121,6 +128,7 @@ namespace Json {
     */
    class JSON_API StyledStreamWriter
    {
+      friend class StreamingWriter;
    public:
       StyledStreamWriter( std::string indentation="\t" );
       ~StyledStreamWriter(){}
@@ -157,8 +165,66 @@ namespace Json {
       bool addChildValues_;
    };
 
+   /** \brief Writes a <a HREF="http://www.json.org">JSON</a> document to a stream a piece at a time.
+    *
+    * The document is written in order: beginObject() and beginArray() open a container, name()
+    * names the next member of an object, value() writes a whole value, and end() closes the
+    * innermost container.  Only the value being written is held, so that a document of any size,
+    * such as one record after the other of a download, can be written as its pieces arrive.
+    *
+    * Compact output is that of FastWriter, and styled output that of StyledStreamWriter, except
+    * that the comments of the values given to value() are left out, and that an array opened
+    * with beginArray() has one element per line.
+    *
+    * \code
+    * Json::StreamingWriter writer( std::cout, true );
+    * writer.beginObject();
+    * writer.name( "records" );
+    * writer.beginArray();
+    * while ( next( record ) )
+    *    writer.value( record );
+    * writer.end();
+    * writer.end();
+    * \endcode
+    * \sa FastWriter, StyledStreamWriter
+    */
+   class JSON_API StreamingWriter
+   {
+   public:
+      /** \param compact Write as FastWriter does, else as StyledStreamWriter( indentation ).
+       */
+      StreamingWriter( std::ostream &out, bool compact, std::string indentation="\t" );
+
+      void beginObject();
+      void beginArray();
+      /// The name of the next member of the innermost container, an object.
+      void name( const std::string &name );
+      void value( const Value &value );
+      void end();
+
+   private:
+      struct Container
+      {
+         bool isArray_;
+         bool empty_;
+      };
+
+      void begin( bool isArray );
+      void beginValue();
+
+      std::ostream *out_;
+      bool compact_;
+      FastWriter fastWriter_;
+      StyledStreamWriter styledWriter_;
+      std::vector<Container> containers_;
+      std::string name_;
+      std::string buffer_;
+   };
+
    std::string JSON_API valueToString( Int value );
    std::string JSON_API valueToString( UInt value );
+   std::string JSON_API valueToString( Int64 value );
+   std::string JSON_API valueToString( UInt64 value );
    std::string JSON_API valueToString( double value );
    std::string JSON_API valueToString( bool value );
    std::string JSON_API valueToQuotedString( const char *value );
@@ -1,164 +1,491 @@
 #include "../date/include/date/date.h"
-#include <cmath>
-#include <memory>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <list>
+#include <numeric>
+#include <sstream>
 #include <string>
-#include <curl/curl.h>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
 #include <json/json.h>
+#include "getledger.h"
+#include "ledger_search.h"
 
-// CURL tools
+// The build makes ledger.compact with COMPACT defined, and ledger.pretty
+// without.
+#ifdef COMPACT
+static constexpr bool compact_output = true;
+#else
+static constexpr bool compact_output = false;
+#endif
 
+namespace
+{
+
+struct options
+{
+    std::string cache_path;
+    std::string batch_path;
+    std::vector<std::string> endpoints;
+    std::string download_path;
+    std::string stats_path;
+    std::string serve_path;
+    unsigned probes = 1;
+    unsigned ranges = 8;
+    bool cbor = false;
+};
+
+// Turns the run stats on if opts asks for them, and writes their report when
+// main returns
+class stats_report
+{
+    std::string path_;
+
+public:
+    explicit stats_report(options const& opts);
+    stats_report(stats_report const&) = delete;
+    stats_report& operator=(stats_report const&) = delete;
+    ~stats_report();
+};
+
+}  // unnamed namespace
+
+stats_report::stats_report(options const& opts)
+    : path_{opts.stats_path}
+{
+    if (!path_.empty())
+        enable_run_stats();
+}
+
+stats_report::~stats_report()
+{
+    if (path_.empty())
+        return;
+    std::ofstream out{path_};
+    out << Json::StyledWriter{}.write(run_stats_report());
+    if (!out.flush())
+        std::cerr << "Unable to write " << path_ << '\n';
+}
+
+// Read a "YYYY-MM-DD HH:MM:SS" UTC time
 static
-int
-curl_global()
+bool
+parse_target(std::string const& line, date::sys_seconds& target)
 {
-    if (::curl_global_init(CURL_GLOBAL_DEFAULT) != 0)
-        throw std::runtime_error("CURL global initialization failed");
-    return 0;
+    std::istringstream is{line};
+    is >> date::parse("%F %T", target);
+    return !is.fail();
 }
 
-namespace
+// Print a resolved target, as {target, seq, close_time, UTC close time}
+static
+void
+print_result(std::ostream& os, date::sys_seconds target, std::pair<int, int> found)
 {
+    using namespace date;
+    auto [l, t] = found;
+    os << '{' << target << ", " << l << ", " << t << ", "
+       << std::chrono::seconds{t}+epoch << "}\n";
+}
 
-struct curl_deleter
+// Resolve every close time listed in the file at path ("-" for stdin), one
+// "YYYY-MM-DD HH:MM:SS" UTC time per line.  The targets are resolved in sorted
+// order so that each search is bracketed by the samples fetched for the
+// previous ones.  Results are printed in input order.
+static
+int
+resolve_batch(options const& opts, ledger_resolver& resolver)
 {
-    void operator()(CURL* p) const
+    auto const& path = opts.batch_path;
+    using namespace std::chrono;
+    using namespace date;
+    std::ifstream file;
+    if (path != "-")
     {
-        ::curl_easy_cleanup(p);
+        file.open(path);
+        if (!file)
+        {
+            std::cerr << "Unable to open " << path << '\n';
+            return 1;
+        }
     }
-};
+    std::istream& in = path == "-" ? std::cin : file;
 
-}  // unnamed namespace
+    std::vector<date::sys_seconds> targets;
+    std::string line;
+    for (unsigned line_no = 1; std::getline(in, line); ++line_no)
+    {
+        if (line.find_first_not_of(" \t\r") == std::string::npos)
+            continue;
+        date::sys_seconds tp;
+        if (!parse_target(line, tp))
+        {
+            std::cerr << path << ':' << line_no << ": unable to parse '" << line << "'\n";
+            continue;
+        }
+        targets.push_back(tp);
+    }
+
+    std::vector<std::size_t> order(targets.size());
+    std::iota(order.begin(), order.end(), std::size_t{0});
+    std::sort(order.begin(), order.end(),
+              [&targets](auto x, auto y) {return targets[x] < targets[y];});
+
+    auto [l2, t2] = get_last_validated_close_time();
+    if (l2 == 0)
+    {
+        std::cerr << "Unable to get the last validated ledger\n";
+        return 1;
+    }
+    resolver.insert(l2, t2);
+
+    std::vector<std::pair<int, int>> found(targets.size());
+    for (auto i : order)
+        found[i] = resolver.find_ledger_by_close_time(targets[i]);
+
+    std::cout << std::fixed;
+    for (std::size_t i = 0; i < targets.size(); ++i)
+        print_result(std::cout, targets[i], found[i]);
+    std::cerr << targets.size() << " targets resolved with "
+              << resolver.size() << " ledger samples\n";
+    return 0;
+}
+
+// Set when the daemon is asked to stop
+static volatile std::sig_atomic_t stop_serving = 0;
 
 static
-std::unique_ptr<CURL, curl_deleter>
-curl_init()
+void
+on_stop_signal(int)
 {
-    static const auto curl_is_now_initiailized = curl_global();
-    (void)curl_is_now_initiailized;
-    return std::unique_ptr<CURL, curl_deleter>{::curl_easy_init()};
+    stop_serving = 1;
 }
 
+// Send all of text to the socket fd.  Returns false if the client is gone.
 static
 bool
-post_and_download_to_string(const std::string& url, std::string const& post,
-                            std::string& reply)
+send_all(int fd, std::string const& text)
 {
-    reply.clear();
-    auto curl = curl_init();
-    if (!curl)
-        return false;
-    std::string version;
-    curl_easy_setopt(curl.get(), CURLOPT_USERAGENT, "curl");
-    curl_easy_setopt(curl.get(), CURLOPT_URL, url.c_str());
-    curl_write_callback write_cb = [](char* contents, std::size_t size, std::size_t nmemb,
-                                      void* userp) -> std::size_t
+    std::size_t offset = 0;
+    while (offset < text.size())
     {
-        auto& userstr = *static_cast<std::string*>(userp);
-        auto realsize = size * nmemb;
-        userstr.append(contents, realsize);
-        return realsize;
-    };
-    curl_easy_setopt(curl.get(), CURLOPT_WRITEFUNCTION, write_cb);
-    curl_easy_setopt (curl.get(), CURLOPT_POSTFIELDSIZE, post.size());
-    curl_easy_setopt (curl.get(), CURLOPT_POSTFIELDS, post.c_str());
-    curl_easy_setopt(curl.get(), CURLOPT_WRITEDATA, &reply);
-    curl_easy_setopt(curl.get(), CURLOPT_SSL_VERIFYPEER, false);
-    auto res = curl_easy_perform(curl.get());
-    return (res == CURLE_OK);
+        auto n = ::send(fd, text.data() + offset, text.size() - offset, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        offset += static_cast<std::size_t>(n);
+    }
+    return true;
 }
 
-// Execute a query against the S2 cluster of full history XRP Ledger notes.
-// Note that this is a best-effort service that does not guarantee
-// any particular level of reliability.
-bool
-do_query(std::string const& method, Json::Value const& params, Json::Value& reply)
+// The longest line a client may send, far more than a time needs
+static constexpr std::size_t max_line_length = 1024;
+
+// The clients the daemon serves at the same time, each on a thread of its own.
+// One more is told so and disconnected.
+static constexpr std::size_t max_clients = 64;
+
+// The searches the daemon makes at the same time, on the threads of the resolver
+static constexpr unsigned serve_threads = 8;
+
+// The reply to a line, made once the search for its target, if any, is done
+struct reply
 {
-    std::string q;
+    std::string text;
+    date::sys_seconds target;
+    std::future<ledger_resolver::result> found;
+};
 
+// Answer each line the client on fd sends, until it closes the connection.
+// The lines that came together are searched for at the same time, on the
+// threads of the resolver, and answered in order.  A client that sends a
+// longer line than max_line_length is told so, and disconnected if no end of
+// it came yet.
+static
+void
+serve_client(int fd, ledger_resolver& resolver)
+{
+    std::string pending;
+    char buf[4096];
+    for (;;)
     {
-        Json::Value query = Json::objectValue;
-        query["method"] = method;
-        Json::Value& p = (query["params"] = Json::arrayValue);
-        p.append(params);
-
-        Json::FastWriter w;
-        q = w.write (query);
+        auto n = ::read(fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        pending.append(buf, static_cast<std::size_t>(n));
+        std::vector<reply> lines;
+        std::string::size_type first = 0;
+        for (auto eol = pending.find('\n'); eol != std::string::npos;
+                  eol = pending.find('\n', first))
+        {
+            auto line = pending.substr(first, eol - first);
+            first = eol + 1;
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            if (line.find_first_not_of(" \t") == std::string::npos)
+                continue;
+            reply r;
+            if (line.size() > max_line_length)
+                r.text = "line too long\n";
+            else if (parse_target(line, r.target))
+                r.found = resolver.async_find_ledger_by_close_time(r.target);
+            else
+                r.text = "unable to parse '" + line + "'\n";
+            lines.push_back(std::move(r));
+        }
+        pending.erase(0, first);
+        std::ostringstream replies;
+        for (auto& r : lines)
+        {
+            if (r.found.valid())
+                print_result(replies, r.target, r.found.get());
+            else
+                replies << r.text;
+        }
+        bool overlong = pending.size() > max_line_length;
+        if (overlong)
+            replies << "line too long\n";
+        if (!send_all(fd, replies.str()) || overlong)
+            return;
     }
+}
 
-    std::string out;
-    if (!post_and_download_to_string("http://s2.ripple.com:51234", q, out))
-        return false;
+namespace
+{
 
-    Json::Reader reader;
-    Json::Value root;
-    if (!reader.parse(out.c_str(), root))
+// A connection to the daemon, served on a thread of its own, which waits for
+// the searches it starts on the threads of the resolver
+struct client
+{
+    int fd;
+    std::atomic<bool> done{false};
+    std::thread thread;
+
+    explicit client(int f)
+        : fd{f}
     {
-        std::cerr << reader.getFormatedErrorMessages() << '\n';
-        return false;
     }
-    Json::Value& result = root["result"];
-    if (! result.isObject())
+};
+
+}  // unnamed namespace
+
+// Remove the socket at addr if a daemon that did not stop cleanly left it:
+// only a socket that nothing listens on any more is removed.  Returns false,
+// with a message, if path is something else or a daemon still serves on it.
+static
+bool
+remove_stale_socket(std::string const& path, sockaddr_un const& addr)
+{
+    struct stat st;
+    if (::lstat(path.c_str(), &st) != 0)
+        return errno == ENOENT;
+    if (!S_ISSOCK(st.st_mode))
     {
-        std::cerr << "Result is not object\n";
+        std::cerr << path << " exists and is not a socket\n";
         return false;
     }
-    Json::Value& status = result["status"];
-    if (!status.isString() || (status.asString() != "success"))
+    int probe = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe < 0)
+        return false;
+    bool stale = ::connect(probe, reinterpret_cast<sockaddr const*>(&addr), sizeof(addr)) != 0 &&
+                 errno == ECONNREFUSED;
+    ::close(probe);
+    if (!stale)
     {
-        std::cerr << "Result is '" << status.asString() << "', not success\n";
-        reply = std::move(result);
+        std::cerr << "A daemon already serves on " << path << '\n';
         return false;
     }
-
-    reply = std::move(root);
-    return true;
+    return ::unlink(path.c_str()) == 0;
 }
 
-// Get the header of a ledger given its sequence number
-bool getHeader (unsigned ledger_seq, Json::Value& header)
+// Answer queries on the Unix domain socket at opts.serve_path until SIGINT or
+// SIGTERM.  Each line a client sends is a "YYYY-MM-DD HH:MM:SS" UTC time,
+// answered with a line as resolve_batch prints them.  The samples stay in
+// memory from one query to the next, and the validated ledgers are followed
+// meanwhile, so that a recent time resolves from memory.  At most max_clients
+// clients are served at the same time.
+static
+int
+serve(options const& opts, ledger_resolver& resolver)
 {
-    Json::Value reply;
-    Json::Value params = Json::objectValue;
-    if (ledger_seq == 0)
-        params["ledger_index"] = "validated";
-    else
-        params["ledger_index"] = ledger_seq;
-    if (!do_query("ledger", params, reply))
+    auto const& path = opts.serve_path;
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
     {
-        header = std::move(reply);
-        return false;
+        std::cerr << "Socket path too long: " << path << '\n';
+        return 1;
+    }
+    std::copy(path.begin(), path.end(), addr.sun_path);
+    int listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0)
+    {
+        std::cerr << "Unable to create a socket\n";
+        return 1;
+    }
+    if (!remove_stale_socket(path, addr) ||
+        ::bind(listener, reinterpret_cast<sockaddr const*>(&addr), sizeof(addr)) != 0 ||
+        ::listen(listener, 64) != 0)
+    {
+        std::cerr << "Unable to listen on " << path << '\n';
+        ::close(listener);
+        return 1;
     }
-    header = reply["result"]["ledger"];
-    if (header.isObject() && !header.isNull())
-        return true;
-    header = std::move(reply);
-    return false;
-}
 
-std::pair<int, int>
-get_last_validated_close_time()
-{
-    Json::Value reply;
-    if (getHeader(0, reply))
-        return {reply["ledger_index"].asInt(), reply["close_time"].asInt()};
-    return {0, 0};
+    struct sigaction stop{};
+    stop.sa_handler = on_stop_signal;  // without SA_RESTART, so that poll returns
+    ::sigaction(SIGINT, &stop, nullptr);
+    ::sigaction(SIGTERM, &stop, nullptr);
+
+    resolver.follow_validated_ledgers();
+    std::cerr << "Serving on " << path << '\n';
+    std::list<client> clients;
+    auto reap = [&clients](bool all)
+    {
+        for (auto c = clients.begin(); c != clients.end();)
+        {
+            if (!all && !c->done)
+            {
+                ++c;
+                continue;
+            }
+            ::shutdown(c->fd, SHUT_RDWR);  // ends the read of a client still connected
+            c->thread.join();
+            ::close(c->fd);
+            c = clients.erase(c);
+        }
+    };
+    while (!stop_serving)
+    {
+        pollfd fd{listener, POLLIN, 0};
+        if (::poll(&fd, 1, 1000) > 0)
+        {
+            int conn = ::accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+            if (conn >= 0 && clients.size() >= max_clients)
+                reap(false);
+            if (conn >= 0 && clients.size() >= max_clients)
+            {
+                send_all(conn, "too many clients\n");
+                ::close(conn);
+            }
+            else if (conn >= 0)
+            {
+                auto& c = clients.emplace_back(conn);
+                c.thread = std::thread{[&c, &resolver]
+                {
+                    serve_client(c.fd, resolver);
+                    c.done = true;
+                }};
+            }
+        }
+        reap(false);
+    }
+    reap(true);
+    ::close(listener);
+    ::unlink(path.c_str());
+    std::cerr << "Stopped serving on " << path << '\n';
+    return 0;
 }
 
-int
-get_close_time(unsigned ledger_seq)
+static
+void
+usage(char const* argv0)
 {
-    Json::Value reply;
-    if (getHeader(ledger_seq, reply))
-        return reply["close_time"].asInt();
-    return 0;
+    std::cerr << "Usage: " << argv0 << " [--cache FILE] [--download FILE [--ranges K] [--cbor]]"
+                 " [--endpoint URL]... [--probes K] [--stats FILE] [--serve SOCKET | TARGETS_FILE | -]\n"
+                 "  --cache FILE    keep ledger close time samples in FILE across runs, and\n"
+                 "                  lock FILE.lock while adding to it\n"
+                 "  --download FILE write the ledger found to FILE, with its state\n"
+                 "  --ranges K      download K ranges of the state at the same time\n"
+                 "  --cbor          write the download in CBOR instead of JSON\n"
+                 "  --endpoint URL  query the server at URL; with several, each query goes\n"
+                 "                  to the fastest, and is hedged on another one when slow;\n"
+                 "                  queries to a ws:// or wss:// URL are pipelined on one\n"
+                 "                  WebSocket connection\n"
+                 "                  (default: " << s2_url << ")\n"
+                 "  --probes K      probe K ledgers, at most 8, at the same time in each\n"
+                 "                  search round\n"
+                 "  --stats FILE    write to FILE, in JSON, the time taken by each query and\n"
+                 "                  each of its phases, by parsing and serializing, and the\n"
+                 "                  probes made by each search\n"
+                 "  --serve SOCKET  run as a daemon answering, on the Unix domain socket\n"
+                 "                  SOCKET, each \"YYYY-MM-DD HH:MM:SS\" UTC line a client\n"
+                 "                  sends, with the samples kept in memory and the\n"
+                 "                  validated ledgers followed\n"
+                 "  TARGETS_FILE    resolve each \"YYYY-MM-DD HH:MM:SS\" UTC line of the file\n"
+                 "                  (- for stdin) instead of the built-in target\n";
 }
 
 int
-main()
+main(int argc, char* argv[])
 {
     using namespace std::chrono;
     using namespace date;
-    constexpr sys_seconds epoch = sys_days{2000_y/1/1};
+
+    options opts;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--cache" && i + 1 < argc)
+            opts.cache_path = argv[++i];
+        else if (arg == "--download" && i + 1 < argc)
+            opts.download_path = argv[++i];
+        else if (arg == "--serve" && i + 1 < argc)
+            opts.serve_path = argv[++i];
+        else if (arg == "--stats" && i + 1 < argc)
+            opts.stats_path = argv[++i];
+        else if (arg == "--cbor")
+            opts.cbor = true;
+        else if (arg == "--endpoint" && i + 1 < argc)
+            opts.endpoints.push_back(argv[++i]);
+        else if (arg == "--probes" && i + 1 < argc)
+            opts.probes = static_cast<unsigned>(std::max(1, std::atoi(argv[++i])));
+        else if (arg == "--ranges" && i + 1 < argc)
+            opts.ranges = static_cast<unsigned>(std::max(1, std::atoi(argv[++i])));
+        else if (opts.batch_path.empty() && (arg == "-" || arg.compare(0, 1, "-") != 0))
+            opts.batch_path = arg;
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if ((!opts.download_path.empty() && !opts.batch_path.empty()) ||
+        (!opts.serve_path.empty() && (!opts.download_path.empty() || !opts.batch_path.empty())))
+    {   // Only the ledger of a single target is downloaded, and the daemon does neither
+        usage(argv[0]);
+        return 1;
+    }
+    stats_report report{opts};
+    if (!opts.endpoints.empty())
+        set_endpoints(opts.endpoints);
+    resolver_options ropts;
+    ropts.cache_path = opts.cache_path;
+    ropts.probes = opts.probes;
+    // A batch searches on this thread, the daemon on the threads of the resolver
+    ropts.threads = opts.serve_path.empty() ? 1 : serve_threads;
+    ledger_resolver resolver{ropts};
+
+    if (!opts.batch_path.empty())
+        return resolve_batch(opts, resolver);
+    if (!opts.serve_path.empty())
+        return serve(opts, resolver);
 
     auto target = sys_days{2020_y/1/1} - 1s -  epoch;
     std::cout << std::fixed;
@@ -168,75 +495,13 @@ main()
     std::cout << '{' << l2 << ", " << t2 << ", " << seconds{t2}+epoch << "}\n";
     if (seconds{t2} == target)
         return 0;
-    auto l1 = l2 - 10;
-    int t1;
-    auto nl = l1;
-    int* pnt = &t1;  // pointer to new guess' timestamp
-
-    while (true)
-    {
-        *pnt = get_close_time(nl);
-        std::cout << '{' << nl << ", " << *pnt << ", " << seconds{*pnt}+epoch << "}\n";
-        // invariant: l1 < l2, t1 < t2
-        if (seconds{*pnt} == target)
-        {
-            l1 = nl;
-            t1 = *pnt;
-            break;
-        }
-
-        auto m = double(l2-l1)/(t2-t1);
-        auto b = l1 - m*t1;
-        nl = static_cast<int>(std::round(m*(target/1s) + b));
-
-        if (nl < l1)
-        {   // If the guess is extrapolated below, chase it with our worst previous guess
-            l2 = l1;
-            t2 = t1;
-            l1 = nl;
-            pnt = &t1;
-        }
-        else if (nl > l2)
-        {   // If the guess is extrapolated above, chase it with our worst previous guess
-            l1 = l2;
-            t1 = t2;
-            l2 = nl;
-            pnt = &t2;
-        }
-        else if (nl == l1)
-        {   // If the guess is the lower bound and the upper bound is one away
-            if (l2 - l1 == 1)
-                break;  // The answer is the lower bound
-            // Else set the upper bound to one above the lower bound and try again
-            l2 = nl = l1 + 1;
-            pnt = &t2;
-        }
-        else if (nl == l2)
-        {   // If the guess is the upper bound and the lower bound is one away
-            if (l1 == l2-1)
-            {   // The answer is the upper bound
-                l1 = l2;
-                t1 = t2;
-                break;
-            }
-            // Else set the lower bound to one below the upper bound and try again
-            l1 = nl = l2 - 1;
-            pnt = &t1;
-        }
-        else  // Else the guess is interpolated between the lower and upper bounds
-        {   // Move the worst guess to the new guess and try again
-            if (nl - l1 <= l2 - nl)
-            {
-                l2 = nl;
-                pnt = &t2;
-            }
-            else
-            {
-                l1 = nl;
-                pnt = &t1;
-            }
-        }
-    }
+    if (l2 != 0)
+        resolver.insert(l2, t2);
+    auto [l1, t1] = resolver.find_ledger_by_close_time(target + epoch, true);
     std::cout << "---\n"
               << '{' << l1 << ", " << t1 << ", " << seconds{t1}+epoch << "}\n";
+    if (!opts.download_path.empty() &&
+        (l1 <= 0 || !download_ledger(static_cast<unsigned>(l1), opts.download_path,
+                                     opts.ranges, opts.cbor, compact_output)))
+        return 1;
 }
@@ -0,0 +1,472 @@
+#ifndef LEDGER_SEARCH_H
+#define LEDGER_SEARCH_H
+
+// The search for the ledger closed at a given time, apart from where the close
+// times it probes come from.
+//
+// Samples is any source of ledger close times that provides:
+//   std::pair<std::optional<sample>, std::optional<sample>> bracket(int target) const;
+//       the last sample known to close at or before target, and the first one
+//       known to close after it;
+//   int get_close_time(int ledger_seq);
+//   std::vector<int> get_close_times(std::vector<int> const& ledger_seqs);
+//       the close times of ledgers, 0 on failure, each of them becoming known.
+// ledger.cpp gets them from the network, bench/ from a recorded table.
+
+#include "../date/include/date/date.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <utility>
+#include <vector>
+
+struct sample
+{
+    int seq;
+    int close_time;
+};
+
+inline constexpr date::sys_seconds epoch = date::sys_days{date::year{2000}/1/1};
+
+// Print a probe of the search, as {seq, close_time, UTC close time}
+inline
+void
+trace_probe(int seq, int close_time)
+{
+    using namespace date;
+    std::cout << '{' << seq << ", " << close_time << ", "
+              << std::chrono::seconds{close_time}+epoch << "}\n";
+}
+
+// Find the ledger that closed at target (seconds since the XRP Ledger epoch),
+// or the closest one the interpolation search settles on.
+// The search starts from the tightest bracket around target in samples,
+// and every probe it makes is added to samples.
+// As find_ledger_concurrent does, it returns the last sample if none closed
+// after target, and {0, 0} if target is before ledger 1 or a probe keeps failing.
+// If trace is true, each probe is printed as it is made.
+template <class Samples>
+std::pair<int, int>
+find_ledger(std::chrono::seconds target, Samples& samples, bool trace)
+{
+    using namespace std::chrono;
+    using namespace date;
+    auto [lo, hi] = samples.bracket(target.count());
+    if (lo && (seconds{lo->close_time} == target || !hi))
+        return {lo->seq, lo->close_time};
+    if (!hi)
+        return {0, 0};
+
+    auto l2 = hi->seq;
+    auto t2 = hi->close_time;
+    auto l1 = lo ? lo->seq : std::max(l2 - 10, 1);
+    int t1 = lo ? lo->close_time : 0;
+    auto nl = l1;
+    int* pnt = &t1;  // pointer to new guess' timestamp
+    if (l1 == l2)
+        return {0, 0};  // hi is ledger 1, and closed after target
+
+    while (true)
+    {
+        int failures = 0;
+        while ((*pnt = samples.get_close_time(nl)) == 0 && ++failures < 3)
+            ;
+        if (trace)
+            trace_probe(nl, *pnt);
+        if (*pnt == 0)
+            return {0, 0};
+        // invariant: l1 < l2, t1 < t2
+        if (seconds{*pnt} == target)
+        {
+            l1 = nl;
+            t1 = *pnt;
+            break;
+        }
+        if (l1 == 1 && t1 > target.count())
+            return {0, 0};  // even ledger 1 closed after target
+
+        auto m = double(l2-l1)/(t2-t1);
+        auto b = l1 - m*t1;
+        nl = static_cast<int>(std::round(m*(target/1s) + b));
+
+        if (nl < l1 || (nl == l1 && t1 > target.count()))
+        {   // If the guess is extrapolated below, chase it with our worst previous guess
+            l2 = l1;
+            t2 = t1;
+            l1 = nl = std::max(std::min(nl, l1 - 1), 1);
+            pnt = &t1;
+        }
+        else if (nl > l2 || (nl == l2 && t2 < target.count()))
+        {   // If the guess is extrapolated above, chase it with our worst previous guess
+            l1 = l2;
+            t1 = t2;
+            l2 = nl = std::max(nl, l2 + 1);
+            pnt = &t2;
+        }
+        else if (nl == l1)
+        {   // If the guess is the lower bound and the upper bound is one away
+            if (l2 - l1 == 1)
+                break;  // The answer is the lower bound
+            // Else set the upper bound to one above the lower bound and try again
+            l2 = nl = l1 + 1;
+            pnt = &t2;
+        }
+        else if (nl == l2)
+        {   // If the guess is the upper bound and the lower bound is one away
+            if (l1 == l2-1)
+            {   // The answer is the upper bound
+                l1 = l2;
+                t1 = t2;
+                break;
+            }
+            // Else set the lower bound to one below the upper bound and try again
+            l1 = nl = l2 - 1;
+            pnt = &t1;
+        }
+        else  // Else the guess is interpolated between the lower and upper bounds
+        {   // Move the worst guess to the new guess and try again
+            if (nl - l1 <= l2 - nl)
+            {
+                l2 = nl;
+                pnt = &t2;
+            }
+            else
+            {
+                l1 = nl;
+                pnt = &t1;
+            }
+        }
+    }
+    return {l1, t1};
+}
+
+// The most ledgers find_ledger_concurrent probes in a round.  Past a few, the
+// probes spaced by the error of the guess hardly ever save another round.
+inline constexpr unsigned max_concurrent_probes = 8;
+
+// The error to expect of a guess interpolated in a bracket of span ledgers,
+// before anything is known of how good interpolation is there: over a long
+// span, the rate at which ledgers close drifts, and over a short one, their
+// close times jitter.
+inline
+double
+interpolation_error(double span)
+{
+    return span / 100 + std::sqrt(span);
+}
+
+// Choose up to k distinct ledgers strictly inside (lo, hi) to probe in one round:
+// the two ledgers around the guess x first, then ledgers on either side of them
+// spaced by the error e expected of x, and if some of those fall outside the
+// bracket, an even k-ary split of it.  Of only two probes, the second is the
+// ledger e below x, unless x is expected to be off by less than a ledger.
+inline
+std::vector<int>
+probe_candidates(int lo, int hi, double x, double e, unsigned k)
+{
+    std::vector<int> c;
+    auto add = [&](long long p)
+    {
+        if (c.size() < k && lo < p && p < hi && std::find(c.begin(), c.end(), p) == c.end())
+            c.push_back(static_cast<int>(p));
+    };
+    long long span = hi - lo;
+    long long g = static_cast<long long>(std::floor(x));
+    long long d = std::clamp<long long>(std::llround(e), 1, std::max(1LL, span / (k + 1)));
+    add(std::clamp<long long>(g, lo + 1, hi - 1));
+    if (d == 1 || k > 2)
+        add(g + 1);
+    for (long long j = 1; c.size() < k && j <= k; ++j)
+    {
+        add(g - j*d);
+        add(g + 1 + j*d);
+    }
+    for (unsigned i = 1; c.size() < k && i <= k; ++i)
+        add(lo + span * i / (k + 1));
+    return c;
+}
+
+// Like find_ledger, but each round probes up to k ledgers at the same time, at
+// most max_concurrent_probes: the interpolated guess plus guesses on either side
+// of it, about as far from it as the guess is expected to be off.  The bracket
+// is then narrowed with whichever of the probes succeeded.  The guess of each
+// round is expected to be off by about how far it moved from the guess of the
+// round before, scaled down as the square root of the bracket.  After a round
+// in which no probe succeeded, the probes are spread over the bracket instead.
+// The result is the ledger closed at target, or else the last one closed before it.
+template <class Samples>
+std::pair<int, int>
+find_ledger_concurrent(std::chrono::seconds target, Samples& samples,
+                       unsigned k, bool trace)
+{
+    using namespace std::chrono;
+    using namespace date;
+    k = std::min(k, max_concurrent_probes);
+    unsigned failed_rounds = 0;
+    double last_guess = 0;
+    double last_span = 0;  // of the bracket of last_guess, 0 before the first
+    while (true)
+    {
+        auto [lo, hi] = samples.bracket(target.count());
+        if (lo && (seconds{lo->close_time} == target || !hi || hi->seq - lo->seq <= 1))
+            return {lo->seq, lo->close_time};
+        if (!hi)
+            return {0, 0};
+
+        std::vector<int> probes;
+        if (lo)
+        {
+            auto m = double(hi->seq - lo->seq)/(hi->close_time - lo->close_time);
+            auto x = lo->seq + m*(target.count() - lo->close_time);
+            double span = hi->seq - lo->seq;
+            auto e = last_span == 0 ? interpolation_error(span)
+                   : std::max(std::abs(x - last_guess), 0.05 * std::sqrt(last_span))
+                       * std::sqrt(span / last_span);
+            last_guess = x;
+            last_span = span;
+            probes = probe_candidates(lo->seq, hi->seq, x, failed_rounds ? span : e, k);
+        }
+        else if (auto next = samples.bracket(hi->close_time).second)
+        {   // Nothing is known to close before target: extrapolate below hi
+            auto m = double(next->seq - hi->seq)/(next->close_time - hi->close_time);
+            auto g = static_cast<int>(std::round(hi->seq - m*(hi->close_time - target.count())));
+            g = std::clamp(g, 1, hi->seq - 1);
+            double span = hi->seq - g;
+            probes = probe_candidates(std::max(0, g - (hi->seq - g)), hi->seq, g,
+                                      failed_rounds ? span : interpolation_error(span), k);
+        }
+        else  // A second sample gives a slope to extrapolate with
+            probes = {std::max(hi->seq - 10, 1)};
+
+        auto close_times = samples.get_close_times(probes);
+        bool any = false;
+        for (std::size_t i = 0; i < probes.size(); ++i)
+        {
+            if (trace)
+                trace_probe(probes[i], close_times[i]);
+            any = any || close_times[i] != 0;
+        }
+        if (any)
+            failed_rounds = 0;
+        else if (++failed_rounds == 3)
+            return {0, 0};
+    }
+}
+
+// A piecewise-linear model of the sequence number of the ledger closed at a
+// given time, fitted to samples.
+// Close times are smooth in pieces: the rate at which ledgers close drifts
+// slowly, with a few abrupt changes.  So a handful of straight segments, each
+// with a bound on how far off it was for the samples it was fitted to, can
+// place most targets within a few ledgers.
+// A segment that no sample between its ends vouches for has no bound, and
+// gives no guess: interpolating between its ends is all the search would do
+// anyway.  update() refreshes the model with each new sample: it gives such a
+// segment a bound if the sample is close enough to it, and else splits the
+// segment it falls in at the sample.  A sample past the last knot extends the
+// last segment if the line stays close to that knot, as following each new
+// validated ledger mostly does, and else adds a segment.  Splits add knots
+// that a fit of the same samples would not need: once stale() says so, fit
+// the model again.
+class close_time_model
+{
+public:
+    struct guess
+    {
+        double seq;  // between ledgers: the one closed at target is floor(seq)
+        int error;   // in ledgers, either way
+    };
+
+    // A segment is extended for as long as it stays within tolerance ledgers
+    // of every sample it spans.
+    explicit close_time_model(int tolerance = 4) : tolerance_{tolerance} {}
+
+    // Replace the model by one fitted to samples, sorted by seq
+    void fit(std::vector<sample> const& samples);
+    void update(sample s);
+
+    // True once updates have at least doubled the knots of the last fit
+    bool stale() const {return knots_.size() > 2*fitted_ + 16;}
+
+    // The ledger closed at target, extrapolated along the first or the last
+    // segment if target is outside the model, with an error growing with the
+    // distance to it.  Nothing if the segment has no bound.
+    std::optional<guess> predict(int target) const;
+
+    std::size_t size() const {return knots_.size();}
+
+private:
+    struct knot
+    {
+        sample at;
+        int error;  // of the segment from this knot to the next one, or unknown
+    };
+
+    static constexpr int unknown = -1;
+
+    std::vector<knot> knots_;  // sorted by seq, and so also by close_time
+    std::size_t fitted_ = 0;   // knots_.size() after the last fit
+    int tolerance_;
+
+    static double interpolate(sample a, sample b, int target);
+};
+
+inline
+double
+close_time_model::interpolate(sample a, sample b, int target)
+{
+    return a.seq + double(b.seq - a.seq) * (target - a.close_time) / (b.close_time - a.close_time);
+}
+
+// Greedy fit: from each knot, the segment goes to the furthest sample such that
+// a line from the knot to it passes within tolerance_ of every sample between.
+// The slopes allowed by the samples seen so far narrow down to a window, so
+// each sample is looked at once.
+inline
+void
+close_time_model::fit(std::vector<sample> const& samples)
+{
+    knots_.clear();
+    std::size_t start = 0;
+    while (start + 1 < samples.size())
+    {
+        auto s = samples[start];
+        auto lo = -std::numeric_limits<double>::infinity();
+        auto hi = std::numeric_limits<double>::infinity();
+        auto end = start + 1;
+        for (auto j = start + 1; j < samples.size(); ++j)
+        {
+            double dt = samples[j].close_time - s.close_time;
+            double slope = (samples[j].seq - s.seq) / dt;
+            if (slope < lo || slope > hi)
+                break;
+            end = j;
+            lo = std::max(lo, (samples[j].seq - tolerance_ - s.seq) / dt);
+            hi = std::min(hi, (samples[j].seq + tolerance_ - s.seq) / dt);
+        }
+        // The samples it spans bound the error of the segment, which is never
+        // taken as less than tolerance_ for lack of samples in between
+        int error = unknown;
+        for (auto i = start + 1; i < end; ++i)
+        {
+            auto e = std::abs(samples[i].seq - interpolate(s, samples[end], samples[i].close_time));
+            error = std::max({error, tolerance_, static_cast<int>(std::ceil(e)) + 1});
+        }
+        knots_.push_back({s, error});
+        start = end;
+    }
+    if (!samples.empty())
+        knots_.push_back({samples.back(), unknown});
+    fitted_ = knots_.size();
+}
+
+inline
+void
+close_time_model::update(sample s)
+{
+    auto i = std::lower_bound(knots_.begin(), knots_.end(), s.seq,
+                              [](knot const& k, int seq) {return k.at.seq < seq;});
+    if (i != knots_.end() && i->at.seq == s.seq)
+        return;
+    if (i == knots_.end() && knots_.size() >= 2)
+    {   // Past the end: the last segment is extended to s if the last knot is
+        // within tolerance_ of the extended line.  The samples the segment
+        // spanned then stay about as close as they were: close enough for a
+        // guess, which the search checks anyway, until fit() bounds it exactly.
+        auto& previous = i[-2];
+        auto dev = std::abs(i[-1].at.seq - interpolate(previous.at, s, i[-1].at.close_time));
+        if (dev <= tolerance_)
+        {
+            previous.error = std::max({previous.error, tolerance_,
+                                       static_cast<int>(std::ceil(dev)) + 1});
+            i[-1].at = s;
+            return;
+        }
+    }
+    if (i == knots_.begin() || i == knots_.end())
+    {   // Outside the model: it grows a segment to reach s
+        knots_.insert(i, {s, unknown});
+        return;
+    }
+    auto& previous = i[-1];
+    auto e = std::abs(s.seq - interpolate(previous.at, i->at, s.close_time));
+    if (previous.error == unknown && e <= tolerance_)
+        previous.error = std::max(tolerance_, static_cast<int>(std::ceil(e)) + 1);
+    else if (previous.error == unknown || e > previous.error)
+    {   // Neither side of s is vouched for any more
+        previous.error = unknown;
+        knots_.insert(i, {s, unknown});
+    }
+}
+
+inline
+std::optional<close_time_model::guess>
+close_time_model::predict(int target) const
+{
+    if (knots_.size() < 2)
+        return std::nullopt;
+    auto i = std::partition_point(knots_.begin(), knots_.end(),
+                                  [target](knot const& k) {return k.at.close_time <= target;});
+    if (i != knots_.begin() && i[-1].at.close_time == target)
+        return guess{double(i[-1].at.seq), 0};
+    auto segment = i == knots_.begin() ? i : i == knots_.end() ? i - 2 : i - 1;
+    if (segment->error == unknown)
+        return std::nullopt;
+    auto a = segment->at;
+    auto b = segment[1].at;
+    auto seq = interpolate(a, b, target);
+    auto outside = std::max({0., a.seq - seq, seq - b.seq});
+    auto error = segment->error * (1 + outside / (b.seq - a.seq));
+    if (seq < 1 || error > std::numeric_limits<int>::max() / 4)
+        return std::nullopt;
+    return guess{seq, static_cast<int>(std::ceil(error))};
+}
+
+// Probe the ledgers the model puts just around target, so that the search that
+// follows starts from a bracket about as wide as the error of the model rather
+// than from whatever samples happen to be known around target.
+// With k probes a round, k > 1, the first round of find_ledger_concurrent is
+// made around the guess of the model instead of the interpolated one.  Else
+// only the guess is probed: a probe on the far side of it costs more than it
+// saves.
+// Nothing is probed unless known samples lie on both sides of target, and the
+// guess of the model is further from the interpolated one than the error of
+// the model on its samples: else the search's own first probe is as good.
+template <class Samples>
+void
+seed_from_model(std::chrono::seconds target, Samples& samples, close_time_model const& model,
+                unsigned k, bool trace)
+{
+    auto g = model.predict(target.count());
+    if (!g)
+        return;
+    auto [lo, hi] = samples.bracket(target.count());
+    if (lo && lo->close_time == target.count())
+        return;
+    if (!lo || !hi || g->seq <= lo->seq || g->seq >= hi->seq)
+        return;
+    auto x = lo->seq + double(hi->seq - lo->seq) * (target.count() - lo->close_time)
+                                                / (hi->close_time - lo->close_time);
+    if (std::abs(g->seq - x) <= g->error + 1)
+        return;
+    int lo_seq = lo->seq;
+    int hi_seq = hi->seq;
+
+    std::vector<int> probes;
+    if (k > 1)
+        probes = probe_candidates(lo_seq, hi_seq, g->seq, g->error,
+                                  std::min(k, max_concurrent_probes));
+    else
+        probes.push_back(static_cast<int>(std::round(g->seq)));
+    if (probes.empty())
+        return;
+    auto close_times = samples.get_close_times(probes);
+    if (trace)
+        for (std::size_t i = 0; i < probes.size(); ++i)
+            trace_probe(probes[i], close_times[i]);
+}
+
+#endif  // LEDGER_SEARCH_H
@@ -0,0 +1,73 @@
+// Checks that the comments of a document survive reading it and writing it
+// back.  Exits with status 1, saying what was written, if they do not.
+//
+// The run script builds and runs it.
+
+#include <iostream>
+#include <optional>
+#include <string>
+#include <json/json.h>
+
+// A document with comments before values and after them on the same line.
+// Reading it with comments and writing it back must keep every comment, and
+// keep them in place: writing again what was written reads the same.  The
+// objects grow after a comment is attached to one of their members, and
+// values are assigned after their comment is read.
+static char const commented_document[] =
+    "// The header of a ledger\n"
+    "{\n"
+    "   \"ledger\" : {\n"
+    "      // Seconds since 2000-01-01\n"
+    "      \"close_time\" : 631151999, // 2019-12-31 23:59:59\n"
+    "      \"closed\" : true,\n"
+    "      \"hashes\" : [\n"
+    "         // The first one\n"
+    "         \"6A2E0F0A32B01DE4B2B7F8E9A7C2D3E0F1A2B3C4D5E6F708192A3B4C5D6E7F80\",\n"
+    "         \"7B3F101B43C12EF5C3C809FAB8D3E4F102B3C4D5E6F708192A3B4C5D6E7F8091\"\n"
+    "      ],\n"
+    "      \"ledger_index\" : \"56697179\",\n"
+    "      \"parent_close_time\" : 631151990,\n"
+    "      \"seqNum\" : \"56697179\", // the same\n"
+    "      \"totalCoins\" : \"99990017800360865\",\n"
+    "      \"total_coins\" : \"99990017800360865\",\n"
+    "      \"transaction_hash\" : \"\" // none\n"
+    "   },\n"
+    "   \"validated\" : true // by the network\n"
+    "}\n";
+
+static
+std::optional<std::string>
+rewrite_with_comments(std::string const& text)
+{
+    Json::Reader reader;
+    Json::Value root;
+    if (!reader.parse(text, root, true))
+    {
+        std::cerr << reader.getFormatedErrorMessages();
+        return std::nullopt;
+    }
+    return Json::StyledWriter().write(root);
+}
+
+static
+bool
+check_comments()
+{
+    auto written = rewrite_with_comments(commented_document);
+    auto rewritten = written ? rewrite_with_comments(*written) : std::nullopt;
+    bool ok = rewritten && *rewritten == *written;
+    for (auto comment : {"// The header of a ledger", "// Seconds since 2000-01-01",
+                         "// 2019-12-31 23:59:59", "// The first one", "// the same",
+                         "// none", "// by the network"})
+        ok = ok && written->find(comment) != std::string::npos;
+    if (!ok)
+        std::cerr << "Comments are lost reading and writing:\n" << written.value_or("")
+                  << "then\n" << rewritten.value_or("");
+    return ok;
+}
+
+int
+main()
+{
+    return check_comments() ? 0 : 1;
+}